@@ -0,0 +1,37 @@
+.global main
+.text
+main:
+    @ SWI vector: ldr pc, [pc, #-4], with the handler address just after it
+    ldr r0, =0xE51FF004
+    mov r1, #0x8
+    str r0, [r1]
+    ldr r0, =swi_handler
+    str r0, [r1, #4]
+    mov sp, #0x4000
+    mov r4, #0
+    ldr r0, =thumb_code + 1
+    bx r0
+
+@ Two SWIs from Thumb state, execution goes on in Thumb after each of them.
+@ At the end r1, r2 and r3 hold 1, 2 and 3, and r4 counts 2 SWIs.
+.thumb
+thumb_code:
+    mov r1, #1
+    swi 5
+    mov r2, #2
+    swi 6
+    mov r3, #3
+    ldr r0, =done
+    bx r0
+
+.arm
+.align 2
+done:
+    swi 0x123456
+
+@ The return address in lr has bit 0 clear, the Thumb state is restored from
+@ the SPSR by the LDM with the S bit
+swi_handler:
+    stmfd sp!, {r0, lr}
+    add r4, r4, #1
+    ldmfd sp!, {r0, pc}^
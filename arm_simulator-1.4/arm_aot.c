@@ -0,0 +1,253 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include "arm_aot.h"
+#include "arm_aot_abi.h"
+#include "arm_jit.h"
+#include "arm_decode.h"
+#include "arm_instruction.h"
+#include "arm_exception.h"
+#include "memory.h"
+#include "trace.h"
+#include "debug.h"
+
+/* States of the pages of the translated text */
+#define PAGE_VALID     0
+#define PAGE_WRITTEN   1
+#define PAGE_MODIFIED  2
+
+struct arm_aot_data {
+    struct arm_aot_state state;
+    void *library;
+    struct arm_aot_translation *translation;
+    arm_core p;
+};
+
+/* Memory accesses of the translated code, which only knows the memory as an
+ * opaque pointer
+ */
+static int aot_read_word(void *mem, uint32_t address, uint32_t *value) {
+    return memory_read_word(mem, address, value);
+}
+
+static int aot_read_half(void *mem, uint32_t address, uint16_t *value) {
+    return memory_read_half(mem, address, value);
+}
+
+static int aot_read_byte(void *mem, uint32_t address, uint8_t *value) {
+    return memory_read_byte(mem, address, value);
+}
+
+static int aot_write_word(void *mem, uint32_t address, uint32_t value) {
+    return memory_write_word(mem, address, value);
+}
+
+static int aot_write_half(void *mem, uint32_t address, uint16_t value) {
+    return memory_write_half(mem, address, value);
+}
+
+static int aot_write_byte(void *mem, uint32_t address, uint8_t value) {
+    return memory_write_byte(mem, address, value);
+}
+
+static int aot_read_words(void *mem, uint32_t address, uint32_t *values,
+                          int count) {
+    return memory_read_words(mem, address, values, count);
+}
+
+static int aot_write_words(void *mem, uint32_t address, uint32_t *values,
+                           int count) {
+    return memory_write_words(mem, address, values, count);
+}
+
+static uint32_t first_page(arm_aot aot) {
+    return aot->translation->start >> ARM_AOT_PAGE_BITS;
+}
+
+static uint32_t last_page(arm_aot aot) {
+    return (aot->translation->end - 1) >> ARM_AOT_PAGE_BITS;
+}
+
+arm_aot arm_aot_load(arm_core p, char *filename) {
+    struct arm_aot_translation *translation;
+    memory mem = arm_get_memory(p);
+    arm_aot aot;
+    void *library;
+
+    library = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL) {
+        warning("%s\n", dlerror());
+        return NULL;
+    }
+    translation = dlsym(library, "arm_aot_translation");
+    if ((translation == NULL) || (translation->version != ARM_AOT_VERSION) ||
+        (translation->big_endian != memory_is_big_endian(mem)) ||
+        (translation->start >= translation->end)) {
+        warning("%s is not a translation usable by this simulator\n",
+                filename);
+        dlclose(library);
+        return NULL;
+    }
+    aot = calloc(1, sizeof(struct arm_aot_data));
+    if (aot == NULL) {
+        dlclose(library);
+        return NULL;
+    }
+    aot->library = library;
+    aot->translation = translation;
+    aot->p = p;
+    aot->state.stale = malloc(last_page(aot) - first_page(aot) + 1);
+    if (aot->state.stale == NULL) {
+        dlclose(library);
+        free(aot);
+        return NULL;
+    }
+    /* The memory might not hold the executable yet, for instance when it is
+     * loaded by gdb, so the pages are checked on their first use
+     */
+    memset(aot->state.stale, PAGE_WRITTEN,
+           last_page(aot) - first_page(aot) + 1);
+    aot->state.mem = mem;
+    aot->state.read_word = aot_read_word;
+    aot->state.read_half = aot_read_half;
+    aot->state.read_byte = aot_read_byte;
+    aot->state.write_word = aot_write_word;
+    aot->state.write_half = aot_write_half;
+    aot->state.write_byte = aot_write_byte;
+    aot->state.read_words = aot_read_words;
+    aot->state.write_words = aot_write_words;
+    debug("Translation of %08x-%08x loaded from %s\n", translation->start,
+          translation->end, filename);
+    return aot;
+}
+
+void arm_aot_destroy(arm_aot aot) {
+    dlclose(aot->library);
+    free(aot->state.stale);
+    free(aot);
+}
+
+/* The translated code of the page is not used until the page is checked
+ * again, as its previous content may be restored (as gdb does when removing
+ * breakpoints)
+ */
+void arm_aot_invalidate(arm_aot aot, uint32_t page_address) {
+    uint32_t page = page_address >> ARM_AOT_PAGE_BITS;
+
+    if ((page >= first_page(aot)) && (page <= last_page(aot))) {
+        debug("Translated code written in page %08x\n", page_address);
+        aot->state.stale[page - first_page(aot)] = PAGE_WRITTEN;
+    }
+    aot->state.code_written = 1;
+}
+
+/* Compares the page holding address with the text translated, returns 1 if
+ * the translated code of the page can be used again
+ */
+static int arm_aot_check_page(arm_aot aot, uint32_t address) {
+    struct arm_aot_translation *t = aot->translation;
+    memory mem = aot->state.mem;
+    uint32_t page, start, end, value;
+    uint8_t *state;
+
+    if ((address < t->start) || (address >= t->end))
+        return 0;
+    page = address >> ARM_AOT_PAGE_BITS;
+    state = &aot->state.stale[page - first_page(aot)];
+    if (*state != PAGE_WRITTEN)
+        return 0;
+    start = page << ARM_AOT_PAGE_BITS;
+    end = start + (1 << ARM_AOT_PAGE_BITS);
+    if (start < t->start)
+        start = t->start;
+    if (end > t->end)
+        end = t->end;
+    for (address = start; address < end; address += 4) {
+        if (memory_fetch_word(mem, address, &value) ||
+            (value != t->text[(address - t->start) >> 2])) {
+            debug("Translated code modified in page %08x\n", start);
+            *state = PAGE_MODIFIED;
+            return 0;
+        }
+    }
+    /* So that we are told about the next write */
+    memory_mark_code(mem, start);
+    *state = PAGE_VALID;
+    return 1;
+}
+
+static int arm_aot_is_breakpoint(arm_core p, uint32_t address) {
+    arm_decoded d;
+
+    if (arm_in_thumb_state(p))
+        return arm_is_at_breakpoint(p);
+    d = arm_decode_at(p, address);
+
+    return d && ((d->ins & BreakpointMask) == BreakpointPattern);
+}
+
+int arm_aot_step(arm_core p, uint32_t budget) {
+    arm_aot aot = arm_get_aot(p);
+    struct arm_aot_state *s;
+    uint32_t executed, cycles;
+    int result;
+
+    if ((aot == NULL) || trace_has(MEMORY | REGISTERS | STATE))
+        return arm_jit_step(p, budget);
+    s = &aot->state;
+    executed = 0;
+    while (executed < budget) {
+        /* Only ARM code, with data accesses of the endianess of the memory
+         * and physical addresses, is translated
+         */
+        if (!arm_in_thumb_state(p) && arm_in_memory_endianess(p) &&
+            !arm_translates_addresses(p)) {
+            arm_get_context(p, s->r, &s->cpsr);
+            s->executed = 0;
+            s->budget = budget - executed;
+            s->code_written = 0;
+            result = aot->translation->run(s);
+            arm_set_context(p, s->r, s->cpsr, s->executed);
+            executed += s->executed;
+            if (result) {
+                arm_exception(p, result);
+                return result;
+            }
+            if (s->executed || arm_aot_check_page(aot, s->r[15]))
+                continue;
+        }
+        /* Code not translated, we stop before breakpoints unless they are the
+         * first instruction to execute, as the block engine
+         */
+        if (executed && arm_aot_is_breakpoint(p, arm_get_fetch_address(p)))
+            return 0;
+        cycles = arm_get_cycle_count(p);
+        result = arm_jit_step(p, 1);
+        if (result || (arm_get_cycle_count(p) == cycles))
+            return result;
+        executed += arm_get_cycle_count(p) - cycles;
+    }
+    return 0;
+}
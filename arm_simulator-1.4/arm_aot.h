@@ -0,0 +1,45 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#ifndef __ARM_AOT_H__
+#define __ARM_AOT_H__
+#include <stdint.h>
+#include "arm_core.h"
+
+/* Execution of code translated ahead of time by arm_translate. The shared
+ * object produced by arm_translate holds the native code of the .text section
+ * of an executable. Anything that has not been translated, such as system
+ * instructions or code outside of .text, runs in the interpreter, as does any
+ * page of the translated text modified since the translation.
+ * arm_aot_load returns NULL if the object cannot be used for p.
+ */
+arm_aot arm_aot_load(arm_core p, char *filename);
+void arm_aot_destroy(arm_aot aot);
+void arm_aot_invalidate(arm_aot aot, uint32_t page_address);
+
+/* Same as arm_jit_step, but runs the translated code whenever possible.
+ * Falls back to arm_jit_step when no translation is loaded for p (see
+ * arm_set_aot) or when registers, memory or state are traced.
+ */
+int arm_aot_step(arm_core p, uint32_t budget);
+
+#endif
@@ -0,0 +1,303 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#ifndef __ARM_AOT_ABI_H__
+#define __ARM_AOT_ABI_H__
+#include <stdint.h>
+#include "arm_constants.h"
+
+/* Interface between the simulator and the C code generated by arm_translate,
+ * compiled into a shared object. This header is included by the generated
+ * code, which cannot call the simulator directly: memory accesses go through
+ * the functions given in the state.
+ * Changing anything here requires to increase ARM_AOT_VERSION.
+ */
+#define ARM_AOT_VERSION 3
+#define ARM_AOT_PAGE_BITS 12
+
+struct arm_aot_state {
+    /* Registers of the current mode, r[15] holds the address of the next
+     * instruction to execute
+     */
+    uint32_t r[16];
+    uint32_t cpsr;
+    /* Instructions executed since the call, the translated code returns to
+     * the simulator at the first branch once budget is reached
+     */
+    uint32_t executed, budget;
+    /* Set by the simulator when a store modifies code */
+    uint8_t code_written;
+    /* For each page of the translated text, not zero when the translated
+     * code of the page cannot be used as the page has been written
+     */
+    uint8_t *stale;
+    void *mem;
+    int (*read_word)(void *mem, uint32_t address, uint32_t *value);
+    int (*read_half)(void *mem, uint32_t address, uint16_t *value);
+    int (*read_byte)(void *mem, uint32_t address, uint8_t *value);
+    int (*write_word)(void *mem, uint32_t address, uint32_t value);
+    int (*write_half)(void *mem, uint32_t address, uint16_t value);
+    int (*write_byte)(void *mem, uint32_t address, uint8_t value);
+    /* Transfers of count consecutive words, all or none of them */
+    int (*read_words)(void *mem, uint32_t address, uint32_t *values,
+                      int count);
+    int (*write_words)(void *mem, uint32_t address, uint32_t *values,
+                       int count);
+};
+
+/* Runs translated code from s->r[15]. Returns 0 when leaving the translated
+ * code, with s->r[15] as the address of the next instruction, or the
+ * exception raised by the last instruction executed.
+ */
+typedef int (*arm_aot_entry)(struct arm_aot_state *s);
+
+/* Descriptor exported by the shared object as arm_aot_translation, text holds
+ * the instructions translated
+ */
+struct arm_aot_translation {
+    int version;
+    int big_endian;
+    uint32_t start, end;
+    const uint32_t *text;
+    arm_aot_entry run;
+};
+
+/* Semantics used by the generated code, they mirror the ones of the
+ * interpreter and are simplified by the compiler as most of their arguments
+ * are constants.
+ */
+#define arm_aot_bit(x, i) (((x) >> (i)) & 1)
+
+static inline uint32_t arm_aot_ror(uint32_t value, uint8_t rotation) {
+    rotation &= 31;
+    return rotation ? (value >> rotation) | (value << (32 - rotation)) : value;
+}
+
+static inline uint32_t arm_aot_asr(uint32_t value, uint8_t shift) {
+    if (shift > 31)
+        return -(value >> 31);
+    return (int32_t) value >> shift;
+}
+
+static inline int arm_aot_condition(uint32_t cpsr, uint8_t cond) {
+    int n = arm_aot_bit(cpsr, N), z = arm_aot_bit(cpsr, Z);
+    int c = arm_aot_bit(cpsr, C), v = arm_aot_bit(cpsr, V);
+
+    switch (cond) {
+      case 0x0: return z;
+      case 0x1: return !z;
+      case 0x2: return c;
+      case 0x3: return !c;
+      case 0x4: return n;
+      case 0x5: return !n;
+      case 0x6: return v;
+      case 0x7: return !v;
+      case 0x8: return c && !z;
+      case 0x9: return !c || z;
+      case 0xA: return n == v;
+      case 0xB: return n != v;
+      case 0xC: return !z && (n == v);
+      case 0xD: return z || (n != v);
+      default: return 1;
+    }
+}
+
+/* Register shifted by an immediate (ARM manual A5-2) */
+static inline uint32_t arm_aot_shift_immediate(uint32_t value, uint8_t shift,
+                                               uint8_t amount, int *carry) {
+    uint32_t result;
+
+    switch (shift) {
+      case LSL:
+        if (amount == 0)
+            return value;
+        *carry = arm_aot_bit(value, 32 - amount);
+        return value << amount;
+      case LSR:
+        if (amount == 0) {
+            *carry = arm_aot_bit(value, 31);
+            return 0;
+        }
+        *carry = arm_aot_bit(value, amount - 1);
+        return value >> amount;
+      case ASR:
+        if (amount == 0) {
+            *carry = arm_aot_bit(value, 31);
+            return -(uint32_t) *carry;
+        }
+        *carry = arm_aot_bit(value, amount - 1);
+        return arm_aot_asr(value, amount);
+      default:
+        if (amount == 0) {
+            result = ((uint32_t) *carry << 31) | (value >> 1);
+            *carry = arm_aot_bit(value, 0);
+            return result;
+        }
+        *carry = arm_aot_bit(value, amount - 1);
+        return arm_aot_ror(value, amount);
+    }
+}
+
+/* Register shifted by a register */
+static inline uint32_t arm_aot_shift_register(uint32_t value, uint8_t shift,
+                                              uint8_t amount, int *carry) {
+    if (amount == 0)
+        return value;
+    switch (shift) {
+      case LSL:
+        if (amount < 32) {
+            *carry = arm_aot_bit(value, 32 - amount);
+            return value << amount;
+        }
+        *carry = (amount == 32) ? arm_aot_bit(value, 0) : 0;
+        return 0;
+      case LSR:
+        if (amount < 32) {
+            *carry = arm_aot_bit(value, amount - 1);
+            return value >> amount;
+        }
+        *carry = (amount == 32) ? arm_aot_bit(value, 31) : 0;
+        return 0;
+      case ASR:
+        if (amount < 32) {
+            *carry = arm_aot_bit(value, amount - 1);
+            return arm_aot_asr(value, amount);
+        }
+        *carry = arm_aot_bit(value, 31);
+        return -(uint32_t) *carry;
+      default:
+        amount &= 31;
+        if (amount == 0) {
+            *carry = arm_aot_bit(value, 31);
+            return value;
+        }
+        *carry = arm_aot_bit(value, amount - 1);
+        return arm_aot_ror(value, amount);
+    }
+}
+
+/* Data processing operation (ARM manual A4), the carry holds the shifter carry
+ * out. Flags are set when s is not zero.
+ */
+static inline uint32_t arm_aot_data_processing(uint32_t *cpsr, uint8_t opcode,
+                                               uint32_t a, uint32_t b,
+                                               int carry, int s) {
+    uint32_t result;
+    uint64_t wide;
+    int c = carry, v = arm_aot_bit(*cpsr, V), in = arm_aot_bit(*cpsr, C);
+
+    switch (opcode) {
+      case 0x0:
+      case 0x8:
+        result = a & b;
+        break;
+      case 0x1:
+      case 0x9:
+        result = a ^ b;
+        break;
+      case 0x3:
+        result = a;
+        a = b;
+        b = result;
+        /* Fall through */
+      case 0x2:
+      case 0xA:
+        result = a - b;
+        c = a >= b;
+        v = arm_aot_bit((a ^ b) & (a ^ result), 31);
+        break;
+      case 0x4:
+      case 0xB:
+      case 0x5:
+        wide = (uint64_t) a + b + ((opcode == 0x5) ? in : 0);
+        result = wide;
+        c = wide >> 32;
+        v = arm_aot_bit((a ^ result) & (b ^ result), 31);
+        break;
+      case 0x7:
+        result = a;
+        a = b;
+        b = result;
+        /* Fall through */
+      case 0x6:
+        wide = (uint64_t) b + !in;
+        result = a - (uint32_t) wide;
+        c = a >= wide;
+        v = arm_aot_bit((a ^ b) & (a ^ result), 31);
+        break;
+      case 0xC:
+        result = a | b;
+        break;
+      case 0xD:
+        result = b;
+        break;
+      case 0xE:
+        result = a & ~b;
+        break;
+      default:
+        result = ~b;
+    }
+    if (s)
+        *cpsr = (*cpsr & 0x0FFFFFFF) | (arm_aot_bit(result, 31) << N) |
+                ((result == 0) << Z) | (c << C) | (v << V);
+    return result;
+}
+
+/* Macros used by the generated code, which keeps the target of indirect
+ * branches in a local variable named target
+ */
+#define ARM_AOT_STALE(address) \
+    s->stale[((address) >> ARM_AOT_PAGE_BITS) - \
+             (TEXT_START >> ARM_AOT_PAGE_BITS)]
+
+/* Leaves the translated code, the instruction at address is executed next */
+#define ARM_AOT_EXIT(address) \
+    do { s->r[15] = (address); return 0; } while (0)
+
+/* Data abort in the instruction at address, as seen after its fetch */
+#define ARM_AOT_ABORT(address) \
+    do { s->r[15] = (address) + 4; return DATA_ABORT; } while (0)
+
+#define ARM_AOT_JUMP(address, label) \
+    do { \
+        if (ARM_AOT_STALE(address) || (s->executed >= s->budget)) \
+            ARM_AOT_EXIT(address); \
+        goto label; \
+    } while (0)
+
+#define ARM_AOT_JUMP_INDIRECT(address) \
+    do { target = (address); goto dispatch; } while (0)
+
+/* Loads to the pc switch to Thumb state on bit 0 set, Thumb code is left to
+ * the interpreter
+ */
+#define ARM_AOT_JUMP_EXCHANGE(address) \
+    do { \
+        target = (address); \
+        if (target & 1) { \
+            s->cpsr |= StateMask; \
+            ARM_AOT_EXIT(target & 0xFFFFFFFE); \
+        } \
+        ARM_AOT_JUMP_INDIRECT(target & 0xFFFFFFFC); \
+    } while (0)
+
+#endif
@@ -0,0 +1,99 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "arm.h"
+#include "arm_block.h"
+#include "memory.h"
+
+/* Measures the speed of the basic blocks execution engine on a small loop of
+ * data processing, load/store, conditional and branch instructions. The
+ * interpreter is chosen at build time (THREADED_INTERPRETER), so comparing
+ * them is a matter of running this benchmark from both builds.
+ */
+
+#define MEMORY_SIZE 0x2000
+#define BUDGET 4096
+
+static uint32_t program[] = {
+    0xe3a00000,     /*          mov r0, #0                  */
+    0xe3a01a01,     /*          mov r1, #0x1000             */
+    0xe3a02000,     /*          mov r2, #0                  */
+    0xe3a07000,     /*          mov r7, #0                  */
+    0xe20040ff,     /* loop:    and r4, r0, #0xFF           */
+    0xe0822000,     /*          add r2, r2, r0              */
+    0xe0223180,     /*          eor r3, r2, r0, lsl #3      */
+    0xe7813104,     /*          str r3, [r1, r4, lsl #2]    */
+    0xe7915104,     /*          ldr r5, [r1, r4, lsl #2]    */
+    0xe0556002,     /*          subs r6, r5, r2             */
+    0x42877001,     /*          addmi r7, r7, #1            */
+    0xe3100001,     /*          tst r0, #1                  */
+    0x0b000001,     /*          bleq function               */
+    0xe2800001,     /*          add r0, r0, #1              */
+    0xeafffff4,     /*          b loop                      */
+    0xe1a08122,     /* function: mov r8, r2, lsr #2         */
+    0xe1888007,     /*          orr r8, r8, r7              */
+    0xe1a0f00e      /*          mov pc, lr                  */
+};
+
+int main(int argc, char *argv[]) {
+    uint32_t i, instructions;
+    clock_t start, time;
+    memory mem;
+    arm_core arm;
+
+    instructions = 100000000;
+    if (argc > 1)
+        instructions = strtoul(argv[1], NULL, 10);
+
+    mem = memory_create(MEMORY_SIZE, 1);
+    if (mem == NULL) {
+        fprintf(stderr, "Cannot create the memory\n");
+        exit(1);
+    }
+    for (i=0; i<sizeof(program)/sizeof(program[0]); i++)
+        memory_write_word(mem, 4*i, program[i]);
+    arm_init();
+    arm = arm_create(mem);
+
+    start = clock();
+    while (arm_get_cycle_count(arm) < instructions)
+        if (arm_block_step(arm, BUDGET)) {
+            fprintf(stderr, "Unexpected exception\n");
+            exit(1);
+        }
+    time = clock() - start;
+
+#ifdef THREADED_INTERPRETER
+    printf("Threaded interpreter: ");
+#else
+    printf("Portable interpreter: ");
+#endif
+    printf("%u instructions in %.2f s, %.1f millions per second\n",
+           arm_get_cycle_count(arm), (double) time / CLOCKS_PER_SEC,
+           arm_get_cycle_count(arm) / 1e6 * CLOCKS_PER_SEC / (time ? time : 1));
+    arm_destroy(arm);
+    memory_destroy(mem);
+    return 0;
+}
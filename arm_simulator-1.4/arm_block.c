@@ -0,0 +1,658 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "arm_block.h"
+#include "arm_decode.h"
+#include "arm_core_fast.h"
+#include "arm_instruction.h"
+#include "arm_exception.h"
+#include "arm_constants.h"
+#include "memory.h"
+#include "util.h"
+
+#define ARM_BLOCK_MAX_SIZE 64
+#define ARM_BLOCK_HASH_BITS 12
+#define ARM_BLOCK_HASH_SIZE (1 << ARM_BLOCK_HASH_BITS)
+#define ARM_BLOCK_HASH(address) \
+                    (((address) >> 2) & (ARM_BLOCK_HASH_SIZE - 1))
+/* Beyond these numbers of built or invalidated blocks, the whole cache is
+ * flushed at the next dispatch
+ */
+#define ARM_BLOCK_MAX_COUNT 16384
+#define ARM_BLOCK_MAX_DEAD  1024
+/* Instructions are word aligned, this target never matches */
+#define ARM_BLOCK_NO_TARGET 1
+/* With the MMU enabled, access permissions only hold for 1 KB, the size of
+ * tiny pages and of the subpages of small pages (ARM manual B4)
+ */
+#define ARM_BLOCK_MMU_UNIT 1024
+
+typedef struct arm_block *arm_block;
+
+struct arm_block {
+    uint32_t address;
+    /* Address following the last instruction and target of the final branch
+     * when known at decode time
+     */
+    uint32_t end, target;
+    /* Successors of the block, when the final branch is taken or not */
+    arm_block taken, not_taken;
+    /* Invalidated blocks stay allocated until the next flush, as they might
+     * still be linked or executing
+     */
+    int valid;
+    int breakpoint;
+    arm_block next;
+    int size;
+    struct arm_decoded_instruction ins[];
+};
+
+/* Superinstructions, formed when building blocks: a flag setting data
+ * processing followed by a conditional branch, a load followed by a data
+ * processing, any instruction followed by a return (mov pc, lr), and a call
+ * followed by the push of the callee, within the same page. Their pieces are
+ * run with the same accesses, thus the same trace, as the separate
+ * instructions.
+ */
+#define ARM_FUSION_NONE           0
+#define ARM_FUSION_COMPARE_BRANCH 1
+#define ARM_FUSION_LOAD_USE       2
+#define ARM_FUSION_RETURN         3
+#define ARM_FUSION_CALL_PUSH      4
+#define ARM_FUSION_COUNT          5
+
+static char *arm_fusion_names[ARM_FUSION_COUNT] = {
+    NULL, "compare and branch", "load and use", "return", "call and push"
+};
+
+/* Number of instructions of the block taken by each superinstruction, the
+ * push of the callee is stored past the end of the block
+ */
+static int arm_fusion_size[ARM_FUSION_COUNT] = { 1, 2, 2, 2, 1 };
+
+#define ARM_RETURN_INSTRUCTION 0xE1A0F00E
+
+struct arm_block_statistics {
+    unsigned long blocks;
+    unsigned long fusions[ARM_FUSION_COUNT];
+    unsigned long fused_runs[ARM_FUSION_COUNT];
+};
+
+struct arm_block_cache_data {
+    arm_block table[ARM_BLOCK_HASH_SIZE];
+    arm_block dead;
+    int count, dead_count;
+    struct arm_block_statistics statistics;
+};
+
+arm_block_cache arm_block_cache_create() {
+    return calloc(1, sizeof(struct arm_block_cache_data));
+}
+
+void arm_block_cache_destroy(arm_block_cache cache) {
+    arm_block_cache_flush(cache);
+    free(cache);
+}
+
+static void arm_block_free_list(arm_block b) {
+    arm_block next;
+
+    while (b) {
+        next = b->next;
+        free(b);
+        b = next;
+    }
+}
+
+void arm_block_cache_flush(arm_block_cache cache) {
+    int i;
+
+    for (i=0; i<ARM_BLOCK_HASH_SIZE; i++) {
+        arm_block_free_list(cache->table[i]);
+        cache->table[i] = NULL;
+    }
+    arm_block_free_list(cache->dead);
+    cache->dead = NULL;
+    cache->count = 0;
+    cache->dead_count = 0;
+}
+
+/* Invalid blocks are kept until the next flush, as one of them may be running
+ * or linked from another one
+ */
+static void arm_block_kill(arm_block_cache cache, arm_block *b) {
+    arm_block dead = *b;
+
+    *b = dead->next;
+    dead->valid = 0;
+    dead->next = cache->dead;
+    cache->dead = dead;
+    cache->count--;
+    cache->dead_count++;
+}
+
+/* Blocks never cross a page boundary, so only the blocks starting in the
+ * page are concerned
+ */
+void arm_block_cache_invalidate(arm_block_cache cache, uint32_t page_address) {
+    arm_block *b;
+    int i;
+
+    for (i=0; i<ARM_BLOCK_HASH_SIZE; i++) {
+        b = &cache->table[i];
+        while (*b) {
+            if ((*b)->address - page_address < MEMORY_PAGE_SIZE)
+                arm_block_kill(cache, b);
+            else
+                b = &(*b)->next;
+        }
+    }
+}
+
+void arm_block_cache_invalidate_all(arm_block_cache cache) {
+    int i;
+
+    for (i=0; i<ARM_BLOCK_HASH_SIZE; i++)
+        while (cache->table[i])
+            arm_block_kill(cache, &cache->table[i]);
+}
+
+/* Conservatively, any instruction of the data processing and load/store
+ * classes having 15 in its Rd field may write the pc
+ */
+static int arm_block_ends_with(arm_decoded d) {
+    uint32_t ins = d->ins;
+
+    if ((d->handler == arm_undefined) || (d->cond == 0xF))
+        return 1;
+    switch (get_bits(ins, 27, 25)) {
+      case 0:
+        /* bx, blx and bkpt */
+        if ((ins & 0x0FF000D0) == 0x01200010)
+            return 1;
+        /* Fall through */
+      case 1:
+      case 2:
+      case 3:
+        return get_bits(ins, 15, 12) == 15;
+      case 4:
+        return get_bit(ins, 20) && get_bit(ins, 15);
+      default:
+        return 1;
+    }
+}
+
+static int arm_block_is_breakpoint(arm_decoded d) {
+    return (d->ins & BreakpointMask) == BreakpointPattern;
+}
+
+/* Conservatively, swaps and extra load/store are considered as stores */
+static int arm_block_may_write(arm_decoded d) {
+    uint32_t ins = d->ins;
+
+    switch (get_bits(ins, 27, 25)) {
+      case 0:
+        return get_bit(ins, 7) && get_bit(ins, 4) &&
+               (get_bits(ins, 6, 5) || get_bit(ins, 24));
+      case 2:
+      case 3:
+      case 4:
+        return !get_bit(ins, 20);
+      default:
+        return 0;
+    }
+}
+
+/* Unconditional instructions, out of the unconditional instructions space */
+static int arm_block_always(arm_decoded d) {
+    return d->cond == 0xE;
+}
+
+static int arm_block_is_data_processing(arm_decoded d) {
+    uint32_t ins = d->ins;
+
+    switch (get_bits(ins, 27, 25)) {
+      case 0:
+        /* Multiplies, extra load/store and miscellaneous instructions */
+        if ((get_bit(ins, 7) && get_bit(ins, 4)) ||
+            ((get_bits(ins, 24, 23) == 2) && !get_bit(ins, 20)))
+            return 0;
+        return 1;
+      case 1:
+        return (get_bits(ins, 24, 23) != 2) || get_bit(ins, 20);
+      default:
+        return 0;
+    }
+}
+
+static int arm_block_is_load(arm_decoded d) {
+    uint32_t ins = d->ins;
+
+    return ((get_bits(ins, 27, 26) == 1) && get_bit(ins, 20) &&
+            !(get_bit(ins, 25) && get_bit(ins, 4)));
+}
+
+static int arm_block_is_branch(arm_decoded d) {
+    return (d->cond != 0xF) && (get_bits(d->ins, 27, 25) == 5);
+}
+
+/* Pushes (stmdb sp!) saving the link register */
+static int arm_block_is_push(arm_decoded d) {
+    return (d->ins & 0xFFFF4000) == 0xE92D4000;
+}
+
+static int arm_block_fuse_pair(arm_decoded first, arm_decoded second) {
+    if (arm_block_always(first) && arm_block_is_data_processing(first) &&
+        get_bit(first->ins, 20) && (first->rd != 15) &&
+        arm_block_is_branch(second) && !arm_block_always(second))
+        return ARM_FUSION_COMPARE_BRANCH;
+    if (arm_block_always(first) && arm_block_is_load(first) &&
+        (first->rd != 15) && arm_block_is_data_processing(second))
+        return ARM_FUSION_LOAD_USE;
+    if ((second->ins == ARM_RETURN_INSTRUCTION) && !arm_block_may_write(first))
+        return ARM_FUSION_RETURN;
+    return ARM_FUSION_NONE;
+}
+
+/* Blocks do not cross a page, as they are invalidated according to the page
+ * they start in, nor, with the MMU enabled, a 1 KB unit of access permissions,
+ * so that checking the fetch of their first instruction covers all of them.
+ * Enabling or disabling the MMU invalidates all the blocks.
+ */
+static uint32_t arm_block_unit(arm_core p) {
+    return p->mmu_enabled ? ARM_BLOCK_MMU_UNIT : MEMORY_PAGE_SIZE;
+}
+
+/* The callee push is only fused within the unit of the block */
+static void arm_block_fuse(arm_block_cache cache, arm_core p, arm_block b) {
+    arm_decoded d, push;
+    int i;
+
+    for (i=0; i<=b->size; i++)
+        b->ins[i].fusion = ARM_FUSION_NONE;
+    i = 0;
+    while (i < b->size-1) {
+        d = &b->ins[i];
+        d->fusion = arm_block_fuse_pair(d, d+1);
+        if (d->fusion)
+            cache->statistics.fusions[d->fusion]++;
+        i += arm_fusion_size[d->fusion];
+    }
+    d = &b->ins[b->size-1];
+    if ((i == b->size-1) && arm_block_always(d) && arm_block_is_branch(d) &&
+        get_bit(d->ins, 24) &&
+        ((d->imm ^ b->address) < arm_block_unit(p))) {
+        push = arm_decode_at(p, d->imm);
+        if (push && arm_block_is_push(push)) {
+            b->ins[b->size] = *push;
+            b->ins[b->size].fusion = ARM_FUSION_NONE;
+            d->fusion = ARM_FUSION_CALL_PUSH;
+            cache->statistics.fusions[d->fusion]++;
+            b->target = d->imm + 4;
+        }
+    }
+}
+
+/* Runs the superinstruction starting with d, from the fetch of its first
+ * piece
+ */
+static int arm_block_execute_fused(arm_core p, arm_decoded d) {
+    int result;
+
+    arm_get_block_cache(p)->statistics.fused_runs[d->fusion]++;
+    arm_fetch_predecoded(p, d);
+    switch (d->fusion) {
+      case ARM_FUSION_COMPARE_BRANCH:
+        /* Data processing never fails */
+        d->handler(p, d);
+        d++;
+        arm_fetch_predecoded(p, d);
+        if (arm_condition_passed(p, d->cond)) {
+            if (get_bit(d->ins, 24))
+                arm_fast_write_register(p, 14, d->address + 4);
+            arm_fast_write_register(p, 15, d->imm);
+        }
+        return 0;
+      case ARM_FUSION_LOAD_USE:
+        result = d->handler(p, d);
+        if (result)
+            return result;
+        d++;
+        arm_fetch_predecoded(p, d);
+        if (arm_condition_passed(p, d->cond))
+            return d->handler(p, d);
+        return 0;
+      case ARM_FUSION_RETURN:
+        if (arm_condition_passed(p, d->cond)) {
+            result = d->handler(p, d);
+            if (result)
+                return result;
+        }
+        d++;
+        arm_fetch_predecoded(p, d);
+        arm_fast_write_register(p, 15, arm_fast_read_register(p, 14));
+        return 0;
+      default:
+        arm_fast_write_register(p, 14, d->address + 4);
+        arm_fast_write_register(p, 15, d->imm);
+        d++;
+        arm_fetch_predecoded(p, d);
+        return d->handler(p, d);
+    }
+}
+
+#ifdef THREADED_INTERPRETER
+/* Entries of the threaded interpreter, instructions that might write to
+ * memory have to check that their block is still valid
+ */
+#define ARM_THREAD_END 0
+#define ARM_THREAD_ALWAYS 1
+#define ARM_THREAD_CONDITIONAL 2
+#define ARM_THREAD_ALWAYS_STORE 3
+#define ARM_THREAD_CONDITIONAL_STORE 4
+#define ARM_THREAD_FUSED 5
+
+static void arm_block_thread(arm_block b) {
+    arm_decoded d;
+    int i;
+
+    for (i=0; i<b->size; i+=arm_fusion_size[d->fusion]) {
+        d = &b->ins[i];
+        if (d->fusion) {
+            d->thread = ARM_THREAD_FUSED;
+            continue;
+        }
+        if (d->cond >= 0xE)
+            d->thread = ARM_THREAD_ALWAYS;
+        else
+            d->thread = ARM_THREAD_CONDITIONAL;
+        if (arm_block_may_write(d))
+            d->thread += ARM_THREAD_ALWAYS_STORE - ARM_THREAD_ALWAYS;
+    }
+    b->ins[b->size].thread = ARM_THREAD_END;
+}
+#endif
+
+/* Returns NULL when the first instruction cannot be fetched */
+static arm_block arm_block_build(arm_block_cache cache, arm_core p,
+                                 uint32_t address) {
+    struct arm_decoded_instruction buffer[ARM_BLOCK_MAX_SIZE];
+    arm_decoded d;
+    arm_block b;
+    uint32_t unit;
+    int size, end;
+
+    unit = arm_block_unit(p);
+    size = 0;
+    end = 0;
+    while (!end && (size < ARM_BLOCK_MAX_SIZE)) {
+        d = arm_decode_at(p, address + 4*size);
+        if (d == NULL)
+            break;
+        if (size && arm_block_is_breakpoint(d))
+            break;
+        buffer[size++] = *d;
+        end = arm_block_ends_with(d) ||
+              ((address + 4*size) % unit == 0);
+    }
+    if (size == 0)
+        return NULL;
+
+    /* One more instruction for the end of the threaded execution */
+    b = malloc(sizeof(struct arm_block) +
+               (size+1)*sizeof(struct arm_decoded_instruction));
+    if (b == NULL)
+        return NULL;
+    memcpy(b->ins, buffer, size*sizeof(struct arm_decoded_instruction));
+    b->address = address;
+    b->size = size;
+    b->end = address + 4*size;
+    d = &b->ins[size-1];
+    if ((d->cond != 0xF) && (get_bits(d->ins, 27, 25) == 5))
+        b->target = d->imm;
+    else
+        b->target = ARM_BLOCK_NO_TARGET;
+    b->taken = NULL;
+    b->not_taken = NULL;
+    b->valid = 1;
+    b->breakpoint = arm_block_is_breakpoint(&b->ins[0]);
+    arm_block_fuse(cache, p, b);
+    cache->statistics.blocks++;
+#ifdef THREADED_INTERPRETER
+    arm_block_thread(b);
+#endif
+    b->next = cache->table[ARM_BLOCK_HASH(address)];
+    cache->table[ARM_BLOCK_HASH(address)] = b;
+    cache->count++;
+    return b;
+}
+
+static arm_block arm_block_lookup(arm_block_cache cache, arm_core p,
+                                  uint32_t address) {
+    arm_block b;
+
+    for (b = cache->table[ARM_BLOCK_HASH(address)]; b; b = b->next)
+        if (b->address == address)
+            return b;
+    return arm_block_build(cache, p, address);
+}
+
+/* Successor of b when execution continues at address, links are created on
+ * first use
+ */
+static arm_block arm_block_follow(arm_block_cache cache, arm_core p,
+                                  arm_block b, uint32_t address) {
+    arm_block *link;
+
+    if (!b->valid)
+        return arm_block_lookup(cache, p, address);
+    if (address == b->target)
+        link = &b->taken;
+    else if (address == b->end)
+        link = &b->not_taken;
+    else
+        return arm_block_lookup(cache, p, address);
+    if ((*link == NULL) || !(*link)->valid)
+        *link = arm_block_lookup(cache, p, address);
+    return *link;
+}
+
+#ifdef THREADED_INTERPRETER
+/* Direct threaded execution using GCC labels as values: there is no central
+ * loop, the code of each entry ends with its own jump to the entry of the
+ * next instruction, until the final one of the block
+ */
+#define ARM_THREAD_NEXT() \
+    d++; \
+    goto *entries[d->thread]
+
+/* Inlined arm_fetch_predecoded and arm_condition_passed, the entries already
+ * know whether the instruction is conditional
+ */
+#define ARM_THREAD_FETCH() \
+    if (trace_is_active(MEMORY | REGISTERS)) { \
+        arm_fetch_predecoded(p, d); \
+    } else { \
+        p->cycle_count++; \
+        arm_inline_write_register(p, 15, d->address + 4); \
+    }
+
+#define ARM_THREAD_CONDITION_PASSED() \
+    ((arm_condition_table[d->cond] >> (arm_fast_read_cpsr(p) >> 28)) & 1)
+
+#define ARM_THREAD_EXECUTE() \
+    result = d->handler(p, d); \
+    if (result) { \
+        *count += d - b->ins + 1; \
+        return result; \
+    }
+
+/* The block has been overwritten by the instruction */
+#define ARM_THREAD_CHECK_VALID() \
+    if (!b->valid) { \
+        *count += d - b->ins + 1; \
+        return 0; \
+    }
+
+static int arm_block_execute(arm_core p, arm_block b, uint32_t *count) {
+    static void *entries[] = {
+        [ARM_THREAD_END] = &&end,
+        [ARM_THREAD_ALWAYS] = &&always,
+        [ARM_THREAD_CONDITIONAL] = &&conditional,
+        [ARM_THREAD_ALWAYS_STORE] = &&always_store,
+        [ARM_THREAD_CONDITIONAL_STORE] = &&conditional_store,
+        [ARM_THREAD_FUSED] = &&fused
+    };
+    arm_decoded d = b->ins;
+    int result;
+
+    goto *entries[d->thread];
+  always:
+    ARM_THREAD_FETCH();
+    ARM_THREAD_EXECUTE();
+    ARM_THREAD_NEXT();
+  conditional:
+    ARM_THREAD_FETCH();
+    if (ARM_THREAD_CONDITION_PASSED()) {
+        ARM_THREAD_EXECUTE();
+    }
+    ARM_THREAD_NEXT();
+  always_store:
+    ARM_THREAD_FETCH();
+    ARM_THREAD_EXECUTE();
+    ARM_THREAD_CHECK_VALID();
+    ARM_THREAD_NEXT();
+  conditional_store:
+    ARM_THREAD_FETCH();
+    if (ARM_THREAD_CONDITION_PASSED()) {
+        ARM_THREAD_EXECUTE();
+        ARM_THREAD_CHECK_VALID();
+    }
+    ARM_THREAD_NEXT();
+  fused:
+    result = arm_block_execute_fused(p, d);
+    d += arm_fusion_size[d->fusion] - 1;
+    if (result) {
+        *count += d - b->ins + 1;
+        return result;
+    }
+    ARM_THREAD_NEXT();
+  end:
+    *count += b->size;
+    return 0;
+}
+#else
+/* Portable execution loop */
+static int arm_block_execute(arm_core p, arm_block b, uint32_t *count) {
+    arm_decoded d;
+    int i, result;
+
+    for (i=0; i<b->size; i++) {
+        d = &b->ins[i];
+        if (d->fusion) {
+            /* Superinstructions never write to memory before their end */
+            i += arm_fusion_size[d->fusion] - 1;
+            *count += arm_fusion_size[d->fusion];
+            result = arm_block_execute_fused(p, d);
+            if (result)
+                return result;
+            continue;
+        }
+        arm_fetch_predecoded(p, d);
+        (*count)++;
+        if (arm_condition_passed(p, d->cond)) {
+            result = d->handler(p, d);
+            if (result)
+                return result;
+        }
+        /* The block has been overwritten by the instruction */
+        if (!b->valid)
+            break;
+    }
+    return 0;
+}
+#endif
+
+/* Thumb code is not gathered into blocks, its instructions are predecoded once
+ * for all (see arm_thumb) and run one at a time, until the state changes
+ */
+static int arm_block_step_thumb(arm_core p, uint32_t budget) {
+    uint32_t start = arm_get_cycle_count(p);
+    int result;
+
+    do {
+        result = arm_step(p);
+        if (result)
+            return result;
+    } while (arm_inline_in_thumb_state(p) &&
+             (arm_get_cycle_count(p) - start < budget) &&
+             !arm_is_at_breakpoint(p));
+    return 0;
+}
+
+int arm_block_step(arm_core p, uint32_t budget) {
+    arm_block_cache cache = arm_get_block_cache(p);
+    uint32_t count = 0;
+    arm_block b;
+    int result;
+
+    if (arm_inline_in_thumb_state(p))
+        return arm_block_step_thumb(p, budget);
+    if ((cache->count > ARM_BLOCK_MAX_COUNT) ||
+        (cache->dead_count > ARM_BLOCK_MAX_DEAD))
+        arm_block_cache_flush(cache);
+    b = arm_block_lookup(cache, p, arm_get_fetch_address(p));
+    while (1) {
+        /* Fetch failure, the single step raises the prefetch abort. The
+         * block is checked with the permissions of the current mode.
+         */
+        if ((b == NULL) || !arm_inline_can_fetch(p, b->address))
+            return arm_step(p);
+        result = arm_block_execute(p, b, &count);
+        if (result) {
+            arm_exception(p, result);
+            return result;
+        }
+        if ((count >= budget) || arm_inline_in_thumb_state(p))
+            return 0;
+        b = arm_block_follow(cache, p, b, arm_get_fetch_address(p));
+        if (b && b->breakpoint)
+            return 0;
+    }
+}
+
+void arm_block_print_statistics(arm_block_cache cache, FILE *out) {
+    struct arm_block_statistics *st = &cache->statistics;
+    char label[32];
+    int i;
+
+    fprintf(out, "Block engine statistics:\n"
+            "  built blocks:              %lu\n"
+            "  superinstructions (built / runs):\n", st->blocks);
+    for (i=1; i<ARM_FUSION_COUNT; i++) {
+        sprintf(label, "%s:", arm_fusion_names[i]);
+        fprintf(out, "    %-24s %lu / %lu\n", label, st->fusions[i],
+                st->fused_runs[i]);
+    }
+}
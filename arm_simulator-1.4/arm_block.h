@@ -0,0 +1,52 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#ifndef __ARM_BLOCK_H__
+#define __ARM_BLOCK_H__
+#include <stdint.h>
+#include <stdio.h>
+#include "arm_core.h"
+
+/* Basic blocks execution engine. A block is a run of decoded instructions
+ * ending with a branch, a write to the pc, a SWI or a page boundary. Blocks
+ * are cached by start address and linked to the blocks following them, so
+ * that a loop runs without any lookup once all its blocks are built.
+ */
+arm_block_cache arm_block_cache_create();
+void arm_block_cache_destroy(arm_block_cache cache);
+void arm_block_cache_invalidate(arm_block_cache cache, uint32_t page_address);
+/* Invalidates every block, when virtual addresses are remapped */
+void arm_block_cache_invalidate_all(arm_block_cache cache);
+void arm_block_cache_flush(arm_block_cache cache);
+
+/* Executes blocks starting at the current pc until at least budget
+ * instructions have been executed or an exception occurs, in which case it
+ * is raised and returned, as arm_step does. Execution stops before any block
+ * starting with a gdb soft breakpoint, except the first one, and on a switch
+ * to or from the Thumb state.
+ */
+int arm_block_step(arm_core p, uint32_t budget);
+
+/* Prints the number of built blocks and of superinstructions built and run */
+void arm_block_print_statistics(arm_block_cache cache, FILE *out);
+
+#endif
@@ -21,26 +21,185 @@ Contact: Guillaume.Huard@imag.fr
 	 38401 Saint Martin d'Hres
 */
 #include "arm_branch_other.h"
+#include "arm_data_processing.h"
+#include "arm_decode.h"
+#include "arm_core_fast.h"
 #include "arm_constants.h"
 #include "util.h"
 #include <debug.h>
 #include <stdlib.h>
 
+/* Miscellaneous instructions, stored in the opcode field of decoded
+ * instructions (ARM manual A3-4)
+ */
+#define MRS  0
+#define BX   1
+#define BLX  2
+#define CLZ  3
+#define BKPT 4
+
+/* B, BL (ARM manual A4-10), the target is computed at decode time */
+static int branch(arm_core p, arm_decoded d) {
+    if (get_bit(d->ins, 24))
+        arm_fast_write_register(p, 14, d->address + 4);
+    arm_fast_write_register(p, 15, d->imm);
+    return 0;
+}
+
+/* BLX immediate (ARM manual A4-16), always switches to Thumb state */
+static int branch_link_exchange(arm_core p, arm_decoded d) {
+    arm_fast_write_register(p, 14, d->address + 4);
+    arm_write_pc_exchange(p, d->imm | 1);
+    return 0;
+}
+
+/* BX, BLX register (ARM manual A4-19 and A4-20), bit 0 of the target selects
+ * the Thumb state
+ */
+static int branch_exchange(arm_core p, arm_decoded d) {
+    uint32_t target = arm_fast_read_register(p, d->rm);
+
+    if (d->opcode == BLX)
+        arm_fast_write_register(p, 14, d->address + 4);
+    arm_write_pc_exchange(p, target);
+    return 0;
+}
+
+static int software_interrupt(arm_core p, arm_decoded d) {
+    /* Here we implement the end of the simulation as swi 0x123456 */
+    if ((d->ins & 0xFFFFFF) == 0x123456)
+        return HALT;
+    return SOFTWARE_INTERRUPT;
+}
+
+/* MCR, MRC (ARM manual A4-62 and A4-70), only CP15 is present, which cannot
+ * be accessed in user mode. MRC to the pc sets the flags from the value.
+ */
+static int coprocessor_move(arm_core p, arm_decoded d) {
+    uint32_t value;
+
+    if (!arm_in_a_privileged_mode(p))
+        return UNDEFINED_INSTRUCTION;
+    if (get_bit(d->ins, 20)) {
+        if (arm_read_cp15(p, d->rn, d->rm, d->opcode, &value))
+            return UNDEFINED_INSTRUCTION;
+        if (d->rd == 15)
+            arm_write_cpsr(p, (arm_fast_read_cpsr(p) & 0x0FFFFFFF) |
+                              (value & 0xF0000000));
+        else
+            arm_fast_write_register(p, d->rd, value);
+    } else {
+        if (arm_write_cp15(p, d->rn, d->rm, d->opcode,
+                           arm_fast_read_register(p, d->rd)))
+            return UNDEFINED_INSTRUCTION;
+    }
+    return 0;
+}
+
+/* MRS (ARM manual A4-74) */
+static int move_status(arm_core p, arm_decoded d) {
+    if (get_bit(d->ins, 22))
+        arm_fast_write_register(p, d->rd, arm_read_spsr(p));
+    else
+        arm_fast_write_register(p, d->rd, arm_fast_read_cpsr(p));
+    return 0;
+}
+
+/* CLZ (ARM manual A4-36) */
+static int count_leading_zeros(arm_core p, arm_decoded d) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+
+    arm_fast_write_register(p, d->rd, value ? __builtin_clz(value) : 32);
+    return 0;
+}
+
+/* BKPT (ARM manual A4-14) */
+static int breakpoint(arm_core p, arm_decoded d) {
+    return PREFETCH_ABORT;
+}
+
+void arm_branch_decode(arm_decoded d) {
+    int32_t offset;
+
+    /* Sign extension of the 24 bits offset */
+    offset = (int32_t) (d->ins << 8) >> 6;
+    d->imm = d->address + 8 + offset;
+    if (d->cond == 0xF) {
+        /* BLX immediate targets Thumb code, H is bit 1 of the target */
+        d->imm += get_bit(d->ins, 24) << 1;
+        d->handler = branch_link_exchange;
+    } else {
+        d->handler = branch;
+    }
+}
+
+void arm_coprocessor_others_swi_decode(arm_decoded d) {
+    uint32_t ins = d->ins;
+
+    if (get_bit(ins, 24)) {
+        d->handler = software_interrupt;
+    } else if (get_bit(ins, 4) && (get_bits(ins, 11, 8) == 15) &&
+               (get_bits(ins, 23, 21) == 0)) {
+        d->rn = get_bits(ins, 19, 16);
+        d->rd = get_bits(ins, 15, 12);
+        d->rm = get_bits(ins, 3, 0);
+        d->opcode = get_bits(ins, 7, 5);
+        d->handler = coprocessor_move;
+    } else {
+        /* CDP and other coprocessors are not implemented */
+        d->handler = arm_undefined;
+    }
+}
+
+void arm_miscellaneous_decode(arm_decoded d) {
+    uint32_t ins = d->ins;
+
+    d->rd = get_bits(ins, 15, 12);
+    d->rm = get_bits(ins, 3, 0);
+    switch (get_bits(ins, 7, 4)) {
+      case 0:
+        if (get_bit(ins, 21)) {
+            arm_data_processing_msr_register_decode(d);
+        } else {
+            d->opcode = MRS;
+            d->handler = move_status;
+        }
+        return;
+      case 1:
+        if (get_bits(ins, 22, 21) == 1) {
+            d->opcode = BX;
+            d->handler = branch_exchange;
+        } else if (get_bits(ins, 22, 21) == 3) {
+            d->opcode = CLZ;
+            d->handler = count_leading_zeros;
+        } else {
+            d->handler = arm_undefined;
+        }
+        return;
+      case 3:
+        d->opcode = BLX;
+        d->handler = (get_bits(ins, 22, 21) == 1) ? branch_exchange :
+                                                   arm_undefined;
+        return;
+      case 7:
+        d->opcode = BKPT;
+        d->handler = (get_bits(ins, 22, 21) == 1) ? breakpoint :
+                                                   arm_undefined;
+        return;
+      default:
+        /* Enhanced DSP extension, ARMv5TE */
+        d->handler = arm_undefined;
+    }
+}
 
 int arm_branch(arm_core p, uint32_t ins) {
-    return UNDEFINED_INSTRUCTION;
+    return arm_decode_and_execute(p, ins, arm_branch_decode);
 }
 
 int arm_coprocessor_others_swi(arm_core p, uint32_t ins) {
-    if (get_bit(ins, 24)) {
-        /* Here we implement the end of the simulation as swi 0x123456 */
-        if ((ins & 0xFFFFFF) == 0x123456)
-            exit(0);
-        return SOFTWARE_INTERRUPT;
-    } 
-    return UNDEFINED_INSTRUCTION;
+    return arm_decode_and_execute(p, ins, arm_coprocessor_others_swi_decode);
 }
 
 int arm_miscellaneous(arm_core p, uint32_t ins) {
-    return UNDEFINED_INSTRUCTION;
+    return arm_decode_and_execute(p, ins, arm_miscellaneous_decode);
 }
@@ -29,4 +29,8 @@ int arm_branch(arm_core p, uint32_t ins);
 int arm_coprocessor_others_swi(arm_core p, uint32_t ins);
 int arm_miscellaneous(arm_core p, uint32_t ins);
 
+void arm_branch_decode(arm_decoded d);
+void arm_coprocessor_others_swi_decode(arm_decoded d);
+void arm_miscellaneous_decode(arm_decoded d);
+
 #endif
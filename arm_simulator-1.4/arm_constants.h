@@ -41,6 +41,8 @@ Contact: Guillaume.Huard@imag.fr
 #define DATA_ABORT              5
 #define INTERRUPT               6
 #define FAST_INTERRUPT          7
+/* Not an exception, end of the simulation requested by swi 0x123456 */
+#define HALT                    8
 
 /* Some CPSR bits */
 #define N 31
@@ -54,12 +56,21 @@ Contact: Guillaume.Huard@imag.fr
 #define ASR 2
 #define ROR 3
 
+/* Architecturally undefined instructions used by gdb as soft breakpoints */
+#define BreakpointMask    0xFFF000F0
+#define BreakpointPattern 0xE7F000F0
+/* and the BKPT instruction they use in Thumb code */
+#define ThumbBreakpoint   0xBEBE
+
 /* Bit mask constants for msr */
-/* We simulate architecture v5T */
-#define UnallocMask 0x0FFFFF00
+/* We simulate architecture v5T, plus the E bit of v6 which selects the
+ * endianess of data accesses (ARM manual A2-11)
+ */
+#define UnallocMask 0x0FFFFD00
 #define UserMask    0xF0000000
 #define PrivMask    0x0000000F
 #define StateMask   0x00000020
+#define EndianMask  0x00000200
 
 char *arm_get_exception_name(unsigned char exception);
 char *arm_get_mode_name(uint8_t mode);
@@ -21,6 +21,12 @@ Contact: Guillaume.Huard@imag.fr
 	 38401 Saint Martin d'Hres
 */
 #include "arm_core.h"
+#include "arm_core_fast.h"
+#include "arm_decode.h"
+#include "arm_thumb.h"
+#include "arm_block.h"
+#include "arm_jit.h"
+#include "arm_aot.h"
 #include "registers.h"
 #include "no_trace_location.h"
 #include "arm_constants.h"
@@ -29,19 +35,46 @@ Contact: Guillaume.Huard@imag.fr
 #include "trace.h"
 #include <stdlib.h>
 
-struct arm_core_data {
-    uint32_t cycle_count;
-    registers reg;
-    memory mem;
-};
+/* Called by the memory on the first write to a page holding cached code.
+ * While the MMU is enabled, the caches of the interpreter are indexed by
+ * virtual addresses, so they are entirely invalidated. Translated code is
+ * not run in this case and keeps physical addresses.
+ */
+static void arm_code_written(void *data, uint32_t page_address) {
+    arm_core p = (arm_core) data;
+
+    if (p->mmu_enabled) {
+        arm_decode_cache_flush(p->decode_cache);
+        arm_block_cache_invalidate_all(p->block_cache);
+    } else {
+        arm_decode_cache_invalidate(p->decode_cache, page_address);
+        arm_block_cache_invalidate(p->block_cache, page_address);
+    }
+    if (p->jit)
+        arm_jit_invalidate(p->jit, page_address);
+    if (p->aot)
+        arm_aot_invalidate(p->aot, page_address);
+}
 
 arm_core arm_create(memory mem) {
     arm_core p;
 
-    p = malloc(sizeof(struct arm_core_data));
+    if (posix_memalign((void **) &p, 64, sizeof(struct arm_core_data)))
+        p = NULL;
     if (p) {
         p->mem = mem;
+        p->data_access = memory_get_access(mem);
 	p->reg = registers_create();
+        p->decode_cache = arm_decode_cache_create(mem);
+        p->block_cache = arm_block_cache_create();
+        p->jit = NULL;
+        p->aot = NULL;
+        p->flags_kind = ARM_FLAGS_NONE;
+        p->posted_interrupt = 0;
+        p->mmu = arm_mmu_create(mem);
+        p->mmu_enabled = 0;
+        p->user_access = 0;
+        memory_set_code_hook(mem, arm_code_written, p);
         arm_exception(p, RESET);
         p->cycle_count = 0;
     }
@@ -49,6 +82,14 @@ arm_core arm_create(memory mem) {
 }
 
 void arm_destroy(arm_core p) {
+    memory_set_code_hook(p->mem, NULL, NULL);
+    if (p->aot)
+        arm_aot_destroy(p->aot);
+    if (p->jit)
+        arm_jit_destroy(p->jit);
+    arm_block_cache_destroy(p->block_cache);
+    arm_decode_cache_destroy(p->decode_cache);
+    arm_mmu_destroy(p->mmu);
     registers_destroy(p->reg);
     free(p);
 }
@@ -65,16 +106,208 @@ uint32_t arm_get_cycle_count(arm_core p) {
     return p->cycle_count;
 }
 
+arm_block_cache arm_get_block_cache(arm_core p) {
+    return p->block_cache;
+}
+
+memory arm_get_memory(arm_core p) {
+    return p->mem;
+}
+
+arm_jit arm_get_jit(arm_core p) {
+    return p->jit;
+}
+
+void arm_set_jit(arm_core p, arm_jit jit) {
+    p->jit = jit;
+}
+
+arm_aot arm_get_aot(arm_core p) {
+    return p->aot;
+}
+
+void arm_set_aot(arm_core p, arm_aot aot) {
+    p->aot = aot;
+}
+
+arm_mmu arm_get_mmu(arm_core p) {
+    return p->mmu;
+}
+
+void arm_post_interrupt(arm_core p, unsigned char exception) {
+    p->posted_interrupt = exception;
+}
+
+/* A masked interrupt is dropped */
+int arm_take_interrupt(arm_core p) {
+    unsigned char exception = p->posted_interrupt;
+
+    if (exception == 0)
+        return 0;
+    p->posted_interrupt = 0;
+    if (arm_exception(p, exception))
+        return 0;
+    return exception;
+}
+
+/* Address of the next instruction to fetch. This is not an architectural
+ * access to the pc, so it is not traced.
+ */
+uint32_t arm_get_fetch_address(arm_core p) {
+    return read_register(p->reg, 15);
+}
+
+/* The T bit is never part of the flags left pending by arm_write_flags */
+int arm_in_thumb_state(arm_core p) {
+    return (read_cpsr(p->reg) & StateMask) != 0;
+}
+
+/* Same for the E bit */
+int arm_in_memory_endianess(arm_core p) {
+    return ((read_cpsr(p->reg) & EndianMask) != 0) ==
+           memory_is_big_endian(p->mem);
+}
+
+int arm_translates_addresses(arm_core p) {
+    return p->mmu_enabled;
+}
+
+/* Accesses with user permissions in user mode and for LDRT and STRT */
+int arm_translate_data(arm_core p, uint32_t *address, int write) {
+    int access = write ? ARM_MMU_WRITE : ARM_MMU_READ;
+
+    if (p->user_access || !in_a_privileged_mode(p->reg))
+        access |= ARM_MMU_USER;
+    return arm_mmu_translate(p->mmu, *address, access, address);
+}
+
+int arm_translate_fetch(arm_core p, uint32_t *address) {
+    int access = ARM_MMU_FETCH | ARM_MMU_READ;
+
+    if (!in_a_privileged_mode(p->reg))
+        access |= ARM_MMU_USER;
+    return arm_mmu_translate(p->mmu, *address, access, address);
+}
+
+int arm_read_cp15(arm_core p, uint8_t crn, uint8_t crm, uint8_t opcode_2,
+                  uint32_t *value) {
+    return arm_mmu_read_register(p->mmu, crn, crm, opcode_2, value);
+}
+
+/* The caches of decoded instructions and of blocks are indexed by virtual
+ * address. The block being executed, if any, is only marked invalid.
+ */
+int arm_write_cp15(arm_core p, uint8_t crn, uint8_t crm, uint8_t opcode_2,
+                   uint32_t value) {
+    int result;
+
+    result = arm_mmu_write_register(p->mmu, crn, crm, opcode_2, value);
+    if (result == ARM_MMU_REMAPPED) {
+        p->mmu_enabled = arm_mmu_is_enabled(p->mmu);
+        arm_decode_cache_flush(p->decode_cache);
+        arm_block_cache_invalidate_all(p->block_cache);
+        result = 0;
+    }
+    return result;
+}
+
+/* Decoded instruction at address, taken from the decode cache or read from
+ * memory (without trace) and decoded. Returns NULL if the memory access fails.
+ */
+arm_decoded arm_decode_at(arm_core p, uint32_t address) {
+    arm_decoded d;
+    uint32_t physical, value;
+
+    d = arm_decode_cache_lookup(p->decode_cache, address);
+    physical = address;
+    if ((d == NULL) && (arm_inline_translate_fetch(p, &physical) == 0) &&
+        (memory_fetch_word(p->mem, physical, &value) == 0))
+        d = arm_decode_cache_fill(p->decode_cache, address, physical, value);
+    return d;
+}
+
+/* Computes the NZCV flags left pending by arm_write_flags and stores them into
+ * the CPSR. For additions and subtractions, the carry or borrow input is
+ * retrieved from the operands and the result.
+ */
+void arm_evaluate_flags(arm_core p) {
+    uint32_t cpsr, a = p->flags_a, b = p->flags_b, result = p->flags_result;
+    uint32_t input;
+
+    if (p->flags_kind == ARM_FLAGS_NONE)
+        return;
+    cpsr = read_cpsr(p->reg) & 0x3FFFFFFF;
+    cpsr |= (get_bit(result, 31) << N) | ((result == 0) << Z);
+    switch (p->flags_kind) {
+      case ARM_FLAGS_LOGICAL:
+        if (a != ARM_FLAGS_SAME_CARRY)
+            cpsr = (cpsr & ~(1 << C)) | (a << C);
+        break;
+      case ARM_FLAGS_ADD:
+        input = result - a - b;
+        cpsr &= 0xCFFFFFFF;
+        cpsr |= ((((uint64_t) a + b + input) >> 32) << C) |
+                (get_bit((a ^ result) & (b ^ result), 31) << V);
+        break;
+      default:
+        input = a - b - result;
+        cpsr &= 0xCFFFFFFF;
+        cpsr |= (((uint64_t) a >= (uint64_t) b + input) << C) |
+                (get_bit((a ^ b) & (a ^ result), 31) << V);
+    }
+    write_cpsr(p->reg, cpsr);
+    p->flags_kind = ARM_FLAGS_NONE;
+}
+
+/* Selects the data accesses matching the E bit along with each write of the
+ * CPSR
+ */
+static void arm_set_cpsr(arm_core p, uint32_t value) {
+    write_cpsr(p->reg, value);
+    if (value & EndianMask)
+        p->data_access = &memory_big_endian_access;
+    else
+        p->data_access = &memory_little_endian_access;
+}
+
+/* Untraced transfer of the registers of the current mode, for the translated
+ * code which works on its own copy of the registers. The pc is the address of
+ * the next instruction to fetch and cycles the number of instructions executed
+ * since the copy.
+ */
+void arm_get_context(arm_core p, uint32_t *regs, uint32_t *cpsr) {
+    int i;
+
+    for (i=0; i<16; i++)
+        regs[i] = read_register(p->reg, i);
+    arm_evaluate_flags(p);
+    *cpsr = read_cpsr(p->reg);
+}
+
+void arm_set_context(arm_core p, uint32_t *regs, uint32_t cpsr,
+                     uint32_t cycles) {
+    int i;
+
+    for (i=0; i<16; i++)
+        write_register(p->reg, i, regs[i]);
+    arm_set_cpsr(p, cpsr);
+    p->flags_kind = ARM_FLAGS_NONE;
+    p->cycle_count += cycles;
+}
+
 /* In this implementation, the program counter is incremented during the fetch.
  * Thus, to meet the specification (see manual A2-9), we add 4 whenever the
  * value of the pc is read, so that instructions read their own address + 8 when
- * reading the pc.
+ * reading the pc. Thumb instructions are 2 bytes long and read their own
+ * address + 4 (see manual chapter A6).
  */
 uint32_t arm_read_register(arm_core p, uint8_t reg) {
     uint32_t value = read_register(p->reg, reg);
     if (reg == 15) {
-        value += 4;
-        value &= 0xFFFFFFFD;
+        if (arm_in_thumb_state(p))
+            value += 2;
+        else
+            value = (value + 4) & 0xFFFFFFFD;
     }
     trace_register(p->cycle_count, READ, reg, get_mode(p->reg), value);
     return value;
@@ -83,21 +316,30 @@ uint32_t arm_read_register(arm_core p, uint8_t reg) {
 uint32_t arm_read_usr_register(arm_core p, uint8_t reg) {
     uint32_t value = read_usr_register(p->reg, reg);
     if (reg == 15) {
-        value += 4;
-        value &= 0xFFFFFFFD;
+        if (arm_in_thumb_state(p))
+            value += 2;
+        else
+            value = (value + 4) & 0xFFFFFFFD;
     }
     trace_register(p->cycle_count, READ, reg, USR, value);
     return value;
 }
 
 uint32_t arm_read_cpsr(arm_core p) {
-    uint32_t value = read_cpsr(p->reg);
+    uint32_t value;
+
+    arm_evaluate_flags(p);
+    value = read_cpsr(p->reg);
     trace_register(p->cycle_count, READ, CPSR, 0, value);
     return value;
 }
 
 uint32_t arm_read_spsr(arm_core p) {
-    uint32_t value = read_spsr(p->reg);
+    uint32_t value;
+
+    /* Modes without SPSR read the CPSR instead */
+    arm_evaluate_flags(p);
+    value = read_spsr(p->reg);
     trace_register(p->cycle_count, READ, SPSR, get_mode(p->reg), value);
     return value;
 }
@@ -113,7 +355,8 @@ void arm_write_usr_register(arm_core p, uint8_t reg, uint32_t value) {
 }
 
 void arm_write_cpsr(arm_core p, uint32_t value) {
-    write_cpsr(p->reg, value);
+    p->flags_kind = ARM_FLAGS_NONE;
+    arm_set_cpsr(p, value);
     trace_register(p->cycle_count, WRITE, CPSR, 0, value);
 }
 
@@ -122,37 +365,163 @@ void arm_write_spsr(arm_core p, uint32_t value) {
     trace_register(p->cycle_count, WRITE, SPSR, get_mode(p->reg), value);
 }
 
+/* Interworking branches (ARM manual A4-20), the CPSR is only written when the
+ * state changes
+ */
+void arm_write_pc_exchange(arm_core p, uint32_t value) {
+    if (get_bit(value, 0) != arm_in_thumb_state(p))
+        arm_write_cpsr(p, arm_read_cpsr(p) ^ StateMask);
+    if (get_bit(value, 0))
+        arm_write_register(p, 15, value & 0xFFFFFFFE);
+    else
+        arm_write_register(p, 15, value & 0xFFFFFFFC);
+}
+
+/* Most flags are overwritten before being read, so we only record the
+ * operation and compute NZCV when the CPSR is read. When tracing registers,
+ * flags are computed at once so that the trace shows the CPSR write.
+ */
+void arm_write_flags(arm_core p, uint8_t kind, uint32_t a, uint32_t b,
+                     uint32_t result) {
+    /* Logical operations keep V, and possibly C, from the previous state */
+    if (kind == ARM_FLAGS_LOGICAL)
+        arm_evaluate_flags(p);
+    p->flags_kind = kind;
+    p->flags_a = a;
+    p->flags_b = b;
+    p->flags_result = result;
+    if (trace_has(REGISTERS)) {
+        arm_evaluate_flags(p);
+        trace_register(p->cycle_count, WRITE, CPSR, 0, read_cpsr(p->reg));
+    }
+}
+
+/* Instruction fetches (without trace) through the MMU, if enabled. Faults
+ * are reported as failed memory accesses and raise a prefetch abort.
+ */
+static int arm_read_instruction_word(arm_core p, uint32_t address,
+                                     uint32_t *value) {
+    if (arm_inline_translate_fetch(p, &address)) {
+        *value = 0;
+        return -1;
+    }
+    return memory_fetch_word(p->mem, address, value);
+}
+
+static int arm_read_instruction_half(arm_core p, uint32_t address,
+                                     uint16_t *value) {
+    if (arm_inline_translate_fetch(p, &address)) {
+        *value = 0;
+        return -1;
+    }
+    return memory_fetch_half(p->mem, address, value);
+}
+
 /* According to the previous comment, the PC is read 8 byte after the address of the
  * instruction being executed and the fetch increments the PC (this makes the
- * implementation of branches easier).
+ * implementation of branches easier). In Thumb state, halfwords are fetched.
  */
 int arm_fetch(arm_core p, uint32_t *value) {
     int result;
     uint32_t address;
+    uint16_t half;
 
     p->cycle_count++;
-    address = arm_read_register(p, 15) - 4;
-    result = memory_read_word(p->mem, address, value);
-    trace_memory(p->cycle_count, READ, 4, OPCODE_FETCH, address, *value);
-    arm_write_register(p, 15, address + 4);
+    if (arm_inline_in_thumb_state(p)) {
+        address = arm_fast_read_register(p, 15) - 2;
+        result = arm_read_instruction_half(p, address, &half);
+        *value = half;
+        if (trace_is_active(MEMORY))
+            trace_memory(p->cycle_count, READ, 2, OPCODE_FETCH, address,
+                         *value);
+        arm_fast_write_register(p, 15, address + 2);
+        return result;
+    }
+    address = arm_fast_read_register(p, 15) - 4;
+    result = arm_read_instruction_word(p, address, value);
+    if (trace_is_active(MEMORY))
+        trace_memory(p->cycle_count, READ, 4, OPCODE_FETCH, address, *value);
+    arm_fast_write_register(p, 15, address + 4);
     return result;
 }
 
+/* Thumb instructions are predecoded once for all in a table indexed by the
+ * halfword (see arm_thumb), so the memory is always read.
+ */
+static int arm_fetch_thumb(arm_core p, arm_decoded *d) {
+    int result;
+    uint32_t address;
+    uint16_t value;
+
+    address = arm_fast_read_register(p, 15) - 2;
+    result = arm_read_instruction_half(p, address, &value);
+    if (result == 0)
+        *d = arm_thumb_predecoded(value);
+    if (trace_is_active(MEMORY))
+        trace_memory(p->cycle_count, READ, 2, OPCODE_FETCH, address, value);
+    arm_fast_write_register(p, 15, address + 2);
+    return result;
+}
+
+/* Same as arm_fetch, but returns the decoded instruction. The memory is only
+ * read, and the instruction decoded, when the decode cache misses.
+ */
+int arm_fetch_decoded(arm_core p, arm_decoded *d) {
+    int result = 0;
+    uint32_t address, physical, value;
+
+    p->cycle_count++;
+    if (arm_inline_in_thumb_state(p))
+        return arm_fetch_thumb(p, d);
+    address = arm_fast_read_register(p, 15) - 4;
+    physical = address;
+    /* Cached instructions are still checked against user permissions */
+    if (arm_inline_translate_fetch(p, &physical)) {
+        result = -1;
+        value = 0;
+    } else {
+        *d = arm_decode_cache_lookup(p->decode_cache, address);
+        if (*d == NULL) {
+            result = memory_fetch_word(p->mem, physical, &value);
+            if (result == 0)
+                *d = arm_decode_cache_fill(p->decode_cache, address, physical,
+                                           value);
+        } else {
+            value = (*d)->ins;
+        }
+    }
+    if (trace_is_active(MEMORY))
+        trace_memory(p->cycle_count, READ, 4, OPCODE_FETCH, address, value);
+    arm_fast_write_register(p, 15, address + 4);
+    return result;
+}
+
+/* Fetch of an instruction already decoded by the caller, which knows it is
+ * located at the current pc. Only the cycle count, trace and pc are updated.
+ */
+void arm_fetch_predecoded(arm_core p, arm_decoded d) {
+    p->cycle_count++;
+    (void) arm_fast_read_register(p, 15);
+    if (trace_is_active(MEMORY))
+        trace_memory(p->cycle_count, READ, 4, OPCODE_FETCH, d->address, d->ins);
+    arm_fast_write_register(p, 15, d->address + 4);
+}
+
 int arm_read_byte(arm_core p, uint32_t address, uint8_t *value) {
     int result;
 
-    result = memory_read_byte(p->mem, address, value);
+    result = arm_inline_read_byte(p, address, value);
     trace_memory(p->cycle_count, READ, 1, OTHER_ACCESS, address, *value);
     return result;
 }
 
-/* Data access endianess should comply with bit 9 of cpsr (E), see ARM
- * manual A4-129
+/* Data access endianess complies with bit 9 of cpsr (E), see ARM manual
+ * A4-129, instructions are fetched with the endianess of the memory
  */
 int arm_read_half(arm_core p, uint32_t address, uint16_t *value) {
     int result;
 
-    result = memory_read_half(p->mem, address, value);
+    result = arm_inline_read_half(p, address, value);
     trace_memory(p->cycle_count, READ, 2, OTHER_ACCESS, address, *value);
     return result;
 }
@@ -160,7 +529,7 @@ int arm_read_half(arm_core p, uint32_t address, uint16_t *value) {
 int arm_read_word(arm_core p, uint32_t address, uint32_t *value) {
     int result;
 
-    result = memory_read_word(p->mem, address, value);
+    result = arm_inline_read_word(p, address, value);
     trace_memory(p->cycle_count, READ, 4, OTHER_ACCESS, address, *value);
     return result;
 }
@@ -168,7 +537,7 @@ int arm_read_word(arm_core p, uint32_t address, uint32_t *value) {
 int arm_write_byte(arm_core p, uint32_t address, uint8_t value) {
     int result;
 
-    result = memory_write_byte(p->mem, address, value);
+    result = arm_inline_write_byte(p, address, value);
     trace_memory(p->cycle_count, WRITE, 1, OTHER_ACCESS, address, value);
     return result;
 }
@@ -176,7 +545,7 @@ int arm_write_byte(arm_core p, uint32_t address, uint8_t value) {
 int arm_write_half(arm_core p, uint32_t address, uint16_t value) {
     int result;
 
-    result = memory_write_half(p->mem, address, value);
+    result = arm_inline_write_half(p, address, value);
     trace_memory(p->cycle_count, WRITE, 2, OTHER_ACCESS, address, value);
     return result;
 }
@@ -184,11 +553,80 @@ int arm_write_half(arm_core p, uint32_t address, uint16_t value) {
 int arm_write_word(arm_core p, uint32_t address, uint32_t value) {
     int result;
 
-    result = memory_write_word(p->mem, address, value);
+    result = arm_inline_write_word(p, address, value);
     trace_memory(p->cycle_count, WRITE, 4, OTHER_ACCESS, address, value);
     return result;
 }
 
+/* The smallest pages of the MMU are 1 KB tiny pages, in which the words are
+ * physically consecutive and have the same permissions. Otherwise, they are
+ * translated and transferred one at a time.
+ */
+#define ARM_TINY_PAGE_SIZE 0x400
+
+static int arm_translate_words(arm_core p, uint32_t address,
+                               uint32_t *physical, int count, int write) {
+    int i;
+
+    if ((address ^ (address + 4*count - 4)) < ARM_TINY_PAGE_SIZE) {
+        physical[0] = address;
+        return arm_translate_data(p, &physical[0], write);
+    }
+    for (i=0; i<count; i++) {
+        physical[i] = address + 4*i;
+        if (arm_translate_data(p, &physical[i], write))
+            return -1;
+    }
+    return 1;
+}
+
+int arm_read_words(arm_core p, uint32_t address, uint32_t *values, int count) {
+    uint32_t physical[16];
+    int i, result;
+
+    if (!p->mmu_enabled) {
+        result = p->data_access->read_words(p->mem, address, values, count);
+    } else {
+        result = arm_translate_words(p, address, physical, count, 0);
+        if (result == 0)
+            result = p->data_access->read_words(p->mem, physical[0], values,
+                                                count);
+        else if (result > 0)
+            for (i=0, result=0; (i<count) && (result == 0); i++)
+                result = p->data_access->read_word(p->mem, physical[i],
+                                                   &values[i]);
+    }
+    if ((result == 0) && trace_has(MEMORY))
+        for (i=0; i<count; i++)
+            trace_memory(p->cycle_count, READ, 4, OTHER_ACCESS, address + 4*i,
+                         values[i]);
+    return result;
+}
+
+int arm_write_words(arm_core p, uint32_t address, uint32_t *values,
+                    int count) {
+    uint32_t physical[16];
+    int i, result;
+
+    if (!p->mmu_enabled) {
+        result = p->data_access->write_words(p->mem, address, values, count);
+    } else {
+        result = arm_translate_words(p, address, physical, count, 1);
+        if (result == 0)
+            result = p->data_access->write_words(p->mem, physical[0], values,
+                                                 count);
+        else if (result > 0)
+            for (i=0, result=0; (i<count) && (result == 0); i++)
+                result = p->data_access->write_word(p->mem, physical[i],
+                                                    values[i]);
+    }
+    if ((result == 0) && trace_has(MEMORY))
+        for (i=0; i<count; i++)
+            trace_memory(p->cycle_count, WRITE, 4, OTHER_ACCESS, address + 4*i,
+                         values[i]);
+    return result;
+}
+
 void arm_print_state(arm_core p, FILE *out) {
     int mode, reg, count;
 
@@ -203,13 +641,13 @@ void arm_print_state(arm_core p, FILE *out) {
                             fprintf(out, "\n    ");
                         fprintf(out, "   %3s=%08X", arm_get_register_name(reg),
                                 arm_read_usr_register(p, reg));
-                } else //if ((p->registers[mode][reg] - p->registers_storage) > 15) 
-                       {
+                } else if (is_banked_register(p->reg, mode, reg)) {
+                        /* Other modes only show their own registers */
                         if ((count > 0) && (count%5 == 0))
                             fprintf(out, "\n    ");
                         count++;
                         fprintf(out, "   %3s=%08X", arm_get_register_name(reg),
-                                arm_read_register(p, reg));
+                                read_mode_register(p->reg, mode, reg));
                 }
             }
             if (mode == USR)
@@ -26,8 +26,13 @@ Contact: Guillaume.Huard@imag.fr
 #include <stdint.h>
 #include <stdio.h>
 #include "memory.h"
+#include "arm_mmu.h"
 
 typedef struct arm_core_data *arm_core;
+typedef struct arm_decoded_instruction *arm_decoded;
+typedef struct arm_block_cache_data *arm_block_cache;
+typedef struct arm_jit_data *arm_jit;
+typedef struct arm_aot_data *arm_aot;
 
 void arm_init();
 arm_core arm_create(memory mem);
@@ -37,6 +42,45 @@ void arm_print_state(arm_core p, FILE *out);
 int arm_current_mode_has_spsr(arm_core p);
 int arm_in_a_privileged_mode(arm_core p);
 uint32_t arm_get_cycle_count(arm_core p);
+arm_block_cache arm_get_block_cache(arm_core p);
+memory arm_get_memory(arm_core p);
+arm_jit arm_get_jit(arm_core p);
+void arm_set_jit(arm_core p, arm_jit jit);
+arm_aot arm_get_aot(arm_core p);
+void arm_set_aot(arm_core p, arm_aot aot);
+arm_mmu arm_get_mmu(arm_core p);
+uint32_t arm_get_fetch_address(arm_core p);
+int arm_in_thumb_state(arm_core p);
+/* Whether data accesses have the endianess of the memory (the E bit of the
+ * CPSR matches it), which translated code assumes
+ */
+int arm_in_memory_endianess(arm_core p);
+/* Whether the MMU translates addresses, which translated code does not do */
+int arm_translates_addresses(arm_core p);
+
+/* MRC and MCR accesses to the system control coprocessor (see arm_mmu), the
+ * caches of decoded instructions and of blocks are flushed when the
+ * translation of addresses changes. Return -1 if the register cannot be
+ * accessed.
+ */
+int arm_read_cp15(arm_core p, uint8_t crn, uint8_t crm, uint8_t opcode_2,
+                  uint32_t *value);
+int arm_write_cp15(arm_core p, uint8_t crn, uint8_t crm, uint8_t opcode_2,
+                   uint32_t value);
+
+/* Exceptions sent to the simulator (by send_irq) are posted, without holding
+ * the lock of the core, so that arm_run stops running instructions to raise
+ * them. The thread posting also takes the lock and takes the interrupt, to
+ * raise it when the core is stopped. Returns the exception raised, if any,
+ * which is not the case of an interrupt masked in the cpsr or of an unknown
+ * exception.
+ */
+void arm_post_interrupt(arm_core p, unsigned char exception);
+int arm_take_interrupt(arm_core p);
+arm_decoded arm_decode_at(arm_core p, uint32_t address);
+void arm_get_context(arm_core p, uint32_t *regs, uint32_t *cpsr);
+void arm_set_context(arm_core p, uint32_t *regs, uint32_t cpsr,
+                     uint32_t cycles);
 
 uint32_t arm_read_register(arm_core p, uint8_t reg);
 uint32_t arm_read_usr_register(arm_core p, uint8_t reg);
@@ -46,14 +90,40 @@ void arm_write_register(arm_core p, uint8_t reg, uint32_t value);
 void arm_write_usr_register(arm_core p, uint8_t reg, uint32_t value);
 void arm_write_cpsr(arm_core p, uint32_t value);
 void arm_write_spsr(arm_core p, uint32_t value);
+/* Write to the pc by an interworking instruction (BX, BLX, loads of the pc),
+ * bit 0 of value selects the Thumb state
+ */
+void arm_write_pc_exchange(arm_core p, uint32_t value);
+
+/* Lazy update of the NZCV flags by a data processing instruction, evaluated
+ * on the next read of the CPSR. The kind gives the operation: a logical one
+ * (N and Z from the result, C from a unless a is ARM_FLAGS_SAME_CARRY, V
+ * unchanged), or an addition or a subtraction, possibly with carry, of a and
+ * b (a - b for subtractions).
+ */
+#define ARM_FLAGS_NONE    0
+#define ARM_FLAGS_LOGICAL 1
+#define ARM_FLAGS_ADD     2
+#define ARM_FLAGS_SUB     3
+#define ARM_FLAGS_SAME_CARRY 2
+void arm_write_flags(arm_core p, uint8_t kind, uint32_t a, uint32_t b,
+                     uint32_t result);
 
 int arm_fetch(arm_core p, uint32_t *value);
+int arm_fetch_decoded(arm_core p, arm_decoded *d);
+void arm_fetch_predecoded(arm_core p, arm_decoded d);
 int arm_read_byte(arm_core p, uint32_t address, uint8_t *value);
 int arm_read_half(arm_core p, uint32_t address, uint16_t *value);
 int arm_read_word(arm_core p, uint32_t address, uint32_t *value);
 int arm_write_byte(arm_core p, uint32_t address, uint8_t value);
 int arm_write_half(arm_core p, uint32_t address, uint16_t value);
 int arm_write_word(arm_core p, uint32_t address, uint32_t value);
+/* Block transfers of consecutive words (see memory_read_words), each word is
+ * still traced on its own. When the MMU is enabled, all the words are
+ * translated before the transfer, so that none is transferred on a fault.
+ */
+int arm_read_words(arm_core p, uint32_t address, uint32_t *values, int count);
+int arm_write_words(arm_core p, uint32_t address, uint32_t *values, int count);
 
 #include "trace_location.h"
 #endif
@@ -0,0 +1,217 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#ifndef __ARM_CORE_FAST_H__
+#define __ARM_CORE_FAST_H__
+#include <stdint.h>
+#include "arm_core.h"
+#include "arm_decode.h"
+#include "arm_constants.h"
+#include "registers.h"
+#include "memory.h"
+#include "trace.h"
+
+/* Fast accessors to the core for the execution hot path (instruction handlers,
+ * fetch and execution engines). They are inlined in the caller and go straight
+ * to the registers and the memory, without the trace and location layers.
+ * Each arm_fast_* macro falls back to the matching traced accessor of arm_core
+ * while the trace it would produce is active, so traces are unchanged. When
+ * compiled with -DNO_TRACE, only the inlined versions remain.
+ */
+
+/* The fields used by every instruction come first, in a single cache line (the
+ * core is allocated aligned on 64 bytes)
+ */
+struct arm_core_data {
+    registers reg;
+    memory mem;
+    /* Halfword and word accesses of the endianess given by the E bit of the
+     * CPSR, changed along with it
+     */
+    const struct memory_access *data_access;
+    arm_decode_cache decode_cache;
+    uint32_t cycle_count;
+    /* Flags of the last flag setting operation, not yet stored in the CPSR
+     * (see arm_write_flags)
+     */
+    uint8_t flags_kind;
+    /* Addresses are translated by the MMU, data accesses checked with user
+     * permissions by LDRT and STRT even in privileged modes
+     */
+    uint8_t mmu_enabled, user_access;
+    uint32_t flags_a, flags_b, flags_result;
+    /* Exception posted by another thread (see arm_post_interrupt) */
+    volatile unsigned char posted_interrupt;
+    arm_mmu mmu;
+    arm_block_cache block_cache;
+    arm_jit jit;
+    arm_aot aot;
+};
+
+void arm_evaluate_flags(arm_core p);
+/* Translations through the MMU, only called while it is enabled. They return
+ * -1 on a fault, with the physical address in *address otherwise.
+ */
+int arm_translate_data(arm_core p, uint32_t *address, int write);
+int arm_translate_fetch(arm_core p, uint32_t *address);
+
+/* Same pc offsets as arm_read_register */
+static inline uint32_t arm_inline_read_register(arm_core p, uint8_t reg) {
+    uint32_t value = read_register(p->reg, reg);
+    if (reg == 15) {
+        if (read_cpsr(p->reg) & StateMask)
+            value += 2;
+        else
+            value = (value + 4) & 0xFFFFFFFD;
+    }
+    return value;
+}
+
+static inline void arm_inline_write_register(arm_core p, uint8_t reg,
+                                             uint32_t value) {
+    write_register(p->reg, reg, value);
+}
+
+static inline uint32_t arm_inline_read_cpsr(arm_core p) {
+    if (p->flags_kind != ARM_FLAGS_NONE)
+        arm_evaluate_flags(p);
+    return read_cpsr(p->reg);
+}
+
+static inline void arm_inline_write_flags(arm_core p, uint8_t kind, uint32_t a,
+                                          uint32_t b, uint32_t result) {
+    if ((kind == ARM_FLAGS_LOGICAL) && (p->flags_kind != ARM_FLAGS_NONE))
+        arm_evaluate_flags(p);
+    p->flags_kind = kind;
+    p->flags_a = a;
+    p->flags_b = b;
+    p->flags_result = result;
+}
+
+static inline int arm_inline_in_thumb_state(arm_core p) {
+    return (read_cpsr(p->reg) & StateMask) != 0;
+}
+
+static inline int arm_inline_translate_fetch(arm_core p, uint32_t *address) {
+    return p->mmu_enabled ? arm_translate_fetch(p, address) : 0;
+}
+
+/* Whether the instruction at address can be fetched without prefetch abort */
+static inline int arm_inline_can_fetch(arm_core p, uint32_t address) {
+    return arm_inline_translate_fetch(p, &address) == 0;
+}
+
+/* Data accesses, with the same return value as the memory ones */
+static inline int arm_inline_read_byte(arm_core p, uint32_t address,
+                                       uint8_t *value) {
+    if (p->mmu_enabled && arm_translate_data(p, &address, 0))
+        return -1;
+    return memory_read_byte(p->mem, address, value);
+}
+
+static inline int arm_inline_read_half(arm_core p, uint32_t address,
+                                       uint16_t *value) {
+    if (p->mmu_enabled && arm_translate_data(p, &address, 0))
+        return -1;
+    return p->data_access->read_half(p->mem, address, value);
+}
+
+static inline int arm_inline_read_word(arm_core p, uint32_t address,
+                                       uint32_t *value) {
+    if (p->mmu_enabled && arm_translate_data(p, &address, 0))
+        return -1;
+    return p->data_access->read_word(p->mem, address, value);
+}
+
+static inline int arm_inline_write_byte(arm_core p, uint32_t address,
+                                        uint8_t value) {
+    if (p->mmu_enabled && arm_translate_data(p, &address, 1))
+        return -1;
+    return memory_write_byte(p->mem, address, value);
+}
+
+static inline int arm_inline_write_half(arm_core p, uint32_t address,
+                                        uint16_t value) {
+    if (p->mmu_enabled && arm_translate_data(p, &address, 1))
+        return -1;
+    return p->data_access->write_half(p->mem, address, value);
+}
+
+static inline int arm_inline_write_word(arm_core p, uint32_t address,
+                                        uint32_t value) {
+    if (p->mmu_enabled && arm_translate_data(p, &address, 1))
+        return -1;
+    return p->data_access->write_word(p->mem, address, value);
+}
+
+#ifdef NO_TRACE
+#define arm_fast_read_register(p, reg) arm_inline_read_register(p, reg)
+#define arm_fast_write_register(p, reg, value) \
+        arm_inline_write_register(p, reg, value)
+#define arm_fast_read_cpsr(p) arm_inline_read_cpsr(p)
+#define arm_fast_write_flags(p, kind, a, b, result) \
+        arm_inline_write_flags(p, kind, a, b, result)
+#define arm_fast_read_byte(p, address, value) \
+        arm_inline_read_byte(p, address, value)
+#define arm_fast_read_half(p, address, value) \
+        arm_inline_read_half(p, address, value)
+#define arm_fast_read_word(p, address, value) \
+        arm_inline_read_word(p, address, value)
+#define arm_fast_write_byte(p, address, value) \
+        arm_inline_write_byte(p, address, value)
+#define arm_fast_write_half(p, address, value) \
+        arm_inline_write_half(p, address, value)
+#define arm_fast_write_word(p, address, value) \
+        arm_inline_write_word(p, address, value)
+#else
+#define arm_fast_read_register(p, reg) (trace_is_active(REGISTERS) ? \
+        arm_read_register(p, reg) : arm_inline_read_register(p, reg))
+#define arm_fast_write_register(p, reg, value) (trace_is_active(REGISTERS) ? \
+        (void) arm_write_register(p, reg, value) : \
+        arm_inline_write_register(p, reg, value))
+#define arm_fast_read_cpsr(p) (trace_is_active(REGISTERS) ? \
+        arm_read_cpsr(p) : arm_inline_read_cpsr(p))
+#define arm_fast_write_flags(p, kind, a, b, result) \
+        (trace_is_active(REGISTERS) ? \
+         (void) arm_write_flags(p, kind, a, b, result) : \
+         arm_inline_write_flags(p, kind, a, b, result))
+#define arm_fast_read_byte(p, address, value) (trace_is_active(MEMORY) ? \
+        arm_read_byte(p, address, value) : \
+        arm_inline_read_byte(p, address, value))
+#define arm_fast_read_half(p, address, value) (trace_is_active(MEMORY) ? \
+        arm_read_half(p, address, value) : \
+        arm_inline_read_half(p, address, value))
+#define arm_fast_read_word(p, address, value) (trace_is_active(MEMORY) ? \
+        arm_read_word(p, address, value) : \
+        arm_inline_read_word(p, address, value))
+#define arm_fast_write_byte(p, address, value) (trace_is_active(MEMORY) ? \
+        arm_write_byte(p, address, value) : \
+        arm_inline_write_byte(p, address, value))
+#define arm_fast_write_half(p, address, value) (trace_is_active(MEMORY) ? \
+        arm_write_half(p, address, value) : \
+        arm_inline_write_half(p, address, value))
+#define arm_fast_write_word(p, address, value) (trace_is_active(MEMORY) ? \
+        arm_write_word(p, address, value) : \
+        arm_inline_write_word(p, address, value))
+#endif
+
+#endif
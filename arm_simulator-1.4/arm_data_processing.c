@@ -21,17 +21,469 @@ Contact: Guillaume.Huard@imag.fr
 	 38401 Saint Martin d'Hres
 */
 #include "arm_data_processing.h"
+#include "arm_decode.h"
+#include "arm_core_fast.h"
 #include "arm_exception.h"
 #include "arm_constants.h"
 #include "arm_branch_other.h"
 #include "util.h"
 #include "debug.h"
 
+/* Data processing opcodes (ARM manual A4-3) */
+#define AND 0x0
+#define EOR 0x1
+#define SUB 0x2
+#define RSB 0x3
+#define ADD 0x4
+#define ADC 0x5
+#define SBC 0x6
+#define RSC 0x7
+#define TST 0x8
+#define TEQ 0x9
+#define CMP 0xA
+#define CMN 0xB
+#define ORR 0xC
+#define MOV 0xD
+#define BIC 0xE
+#define MVN 0xF
+
+/* Kinds of shifter operand, stored in the shift_imm field of decoded
+ * instructions, the shift type being stored in the shift field
+ */
+#define SHIFT_BY_IMMEDIATE 0
+#define SHIFT_BY_REGISTER  1
+#define ROTATED_IMMEDIATE  2
+
+#define is_test(opcode) (((opcode) >= TST) && ((opcode) <= CMN))
+
+/* Shifter operands (ARM manual A5-2), one function for each kind of operand
+ * and shift amount known at decode time. The carry parameter holds the C flag
+ * on entry and receives the shifter carry out only when s is set, that is
+ * when the instruction updates the flags.
+ */
+typedef uint32_t (*shifter_operand)(arm_core p, arm_decoded d, int *carry,
+                                    int s);
+
+static inline uint32_t immediate(arm_core p, arm_decoded d, int *carry,
+                                 int s) {
+    return d->imm;
+}
+
+/* Rotation performed at decode time, with a non zero rotate_imm field */
+static inline uint32_t rotated_immediate(arm_core p, arm_decoded d,
+                                         int *carry, int s) {
+    if (s)
+        *carry = get_bit(d->imm, 31);
+    return d->imm;
+}
+
+/* Register operand, that is LSL #0 */
+static inline uint32_t plain_register(arm_core p, arm_decoded d, int *carry,
+                                      int s) {
+    return arm_fast_read_register(p, d->rm);
+}
+
+static inline uint32_t lsl_immediate(arm_core p, arm_decoded d, int *carry,
+                                     int s) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+
+    if (s)
+        *carry = get_bit(value, 32 - d->imm);
+    return value << d->imm;
+}
+
+static inline uint32_t lsr_immediate(arm_core p, arm_decoded d, int *carry,
+                                     int s) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+
+    if (s)
+        *carry = get_bit(value, d->imm - 1);
+    return value >> d->imm;
+}
+
+/* LSR #32, encoded as LSR #0 */
+static inline uint32_t lsr_32(arm_core p, arm_decoded d, int *carry, int s) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+
+    if (s)
+        *carry = get_bit(value, 31);
+    return 0;
+}
+
+static inline uint32_t asr_immediate(arm_core p, arm_decoded d, int *carry,
+                                     int s) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+
+    if (s)
+        *carry = get_bit(value, d->imm - 1);
+    return asr(value, d->imm);
+}
+
+/* ASR #32, encoded as ASR #0 */
+static inline uint32_t asr_32(arm_core p, arm_decoded d, int *carry, int s) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+
+    if (s)
+        *carry = get_bit(value, 31);
+    return get_bit(value, 31) ? 0xFFFFFFFF : 0;
+}
+
+static inline uint32_t ror_immediate(arm_core p, arm_decoded d, int *carry,
+                                     int s) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+
+    if (s)
+        *carry = get_bit(value, d->imm - 1);
+    return ror(value, d->imm);
+}
+
+/* RRX, encoded as ROR #0, the only one using the C flag as an input */
+static inline uint32_t rrx(arm_core p, arm_decoded d, int *carry, int s) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+    uint32_t result = ((uint32_t) *carry << 31) | (value >> 1);
+
+    if (s)
+        *carry = get_bit(value, 0);
+    return result;
+}
+
+static inline uint32_t lsl_register(arm_core p, arm_decoded d, int *carry,
+                                    int s) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+    uint8_t amount = arm_fast_read_register(p, d->rs);
+
+    if (amount == 0)
+        return value;
+    if (amount < 32) {
+        if (s)
+            *carry = get_bit(value, 32 - amount);
+        return value << amount;
+    }
+    if (s)
+        *carry = (amount == 32) ? get_bit(value, 0) : 0;
+    return 0;
+}
+
+static inline uint32_t lsr_register(arm_core p, arm_decoded d, int *carry,
+                                    int s) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+    uint8_t amount = arm_fast_read_register(p, d->rs);
+
+    if (amount == 0)
+        return value;
+    if (amount < 32) {
+        if (s)
+            *carry = get_bit(value, amount - 1);
+        return value >> amount;
+    }
+    if (s)
+        *carry = (amount == 32) ? get_bit(value, 31) : 0;
+    return 0;
+}
+
+static inline uint32_t asr_register(arm_core p, arm_decoded d, int *carry,
+                                    int s) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+    uint8_t amount = arm_fast_read_register(p, d->rs);
+
+    if (amount == 0)
+        return value;
+    if (amount < 32) {
+        if (s)
+            *carry = get_bit(value, amount - 1);
+        return asr(value, amount);
+    }
+    if (s)
+        *carry = get_bit(value, 31);
+    return get_bit(value, 31) ? 0xFFFFFFFF : 0;
+}
+
+static inline uint32_t ror_register(arm_core p, arm_decoded d, int *carry,
+                                    int s) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+    uint8_t amount = arm_fast_read_register(p, d->rs);
+
+    if (amount == 0)
+        return value;
+    amount &= 0x1F;
+    if (amount == 0) {
+        if (s)
+            *carry = get_bit(value, 31);
+        return value;
+    }
+    if (s)
+        *carry = get_bit(value, amount - 1);
+    return ror(value, amount);
+}
+
+/* Data processing instructions semantics (ARM manual A4). Flags are evaluated
+ * lazily by the core, from the operands and the result (see arm_write_flags).
+ * This body is instantiated for each kind of shifter operand, with and
+ * without the S bit, by the DATA_PROCESSING macro below.
+ */
+static inline __attribute__((always_inline))
+int data_processing(arm_core p, arm_decoded d, shifter_operand shifter,
+                    int s) {
+    uint32_t a, b, result;
+    uint8_t kind;
+    int carry, c;
+
+    /* The carry is only read by the instructions using it as an input and by
+     * RRX, otherwise the shifter carry out replaces the flag, if any
+     */
+    if (((d->opcode >= ADC) && (d->opcode <= RSC)) || (shifter == rrx))
+        carry = get_bit(arm_fast_read_cpsr(p), C);
+    else
+        carry = ARM_FLAGS_SAME_CARRY;
+    c = carry;
+    b = shifter(p, d, &c, s);
+    if ((d->opcode == MOV) || (d->opcode == MVN))
+        a = 0;
+    else
+        a = arm_fast_read_register(p, d->rn);
+    kind = ARM_FLAGS_LOGICAL;
+    switch (d->opcode) {
+      case AND:
+      case TST:
+        result = a & b;
+        break;
+      case EOR:
+      case TEQ:
+        result = a ^ b;
+        break;
+      case RSB:
+        result = a;
+        a = b;
+        b = result;
+        /* Fall through */
+      case SUB:
+      case CMP:
+        result = a - b;
+        kind = ARM_FLAGS_SUB;
+        break;
+      case ADD:
+      case CMN:
+        result = a + b;
+        kind = ARM_FLAGS_ADD;
+        break;
+      case ADC:
+        result = a + b + carry;
+        kind = ARM_FLAGS_ADD;
+        break;
+      case RSC:
+        result = a;
+        a = b;
+        b = result;
+        /* Fall through */
+      case SBC:
+        result = a - b - !carry;
+        kind = ARM_FLAGS_SUB;
+        break;
+      case ORR:
+        result = a | b;
+        break;
+      case MOV:
+        result = b;
+        break;
+      case BIC:
+        result = a & ~b;
+        break;
+      default:
+        result = ~b;
+    }
+    if (!is_test(d->opcode))
+        arm_fast_write_register(p, d->rd, result);
+    if (s) {
+        if (d->rd == 15 && !is_test(d->opcode)) {
+            /* Return from exception, unpredictable without SPSR */
+            if (arm_current_mode_has_spsr(p))
+                arm_write_cpsr(p, arm_read_spsr(p));
+        } else if (kind == ARM_FLAGS_LOGICAL) {
+            arm_fast_write_flags(p, kind, c, 0, result);
+        } else {
+            arm_fast_write_flags(p, kind, a, b, result);
+        }
+    }
+    return 0;
+}
+
+#define DATA_PROCESSING(shifter) \
+static int data_processing_##shifter(arm_core p, arm_decoded d) { \
+    return data_processing(p, d, shifter, 0); \
+} \
+static int data_processing_##shifter##_s(arm_core p, arm_decoded d) { \
+    return data_processing(p, d, shifter, 1); \
+}
+
+DATA_PROCESSING(immediate)
+DATA_PROCESSING(rotated_immediate)
+DATA_PROCESSING(plain_register)
+DATA_PROCESSING(lsl_immediate)
+DATA_PROCESSING(lsr_immediate)
+DATA_PROCESSING(lsr_32)
+DATA_PROCESSING(asr_immediate)
+DATA_PROCESSING(asr_32)
+DATA_PROCESSING(ror_immediate)
+DATA_PROCESSING(rrx)
+DATA_PROCESSING(lsl_register)
+DATA_PROCESSING(lsr_register)
+DATA_PROCESSING(asr_register)
+DATA_PROCESSING(ror_register)
+
+/* Handlers without then with the S bit */
+#define HANDLERS(shifter) \
+    { data_processing_##shifter, data_processing_##shifter##_s }
+
+static arm_handler immediate_handlers[2] = HANDLERS(immediate);
+static arm_handler rotated_immediate_handlers[2] =
+    HANDLERS(rotated_immediate);
+/* Indexed by the shift type */
+static arm_handler shift_by_immediate_handlers[4][2] = {
+    HANDLERS(lsl_immediate), HANDLERS(lsr_immediate),
+    HANDLERS(asr_immediate), HANDLERS(ror_immediate)
+};
+/* Shifts encoded with a zero amount: LSL #0, LSR #32, ASR #32 and RRX */
+static arm_handler shift_by_zero_handlers[4][2] = {
+    HANDLERS(plain_register), HANDLERS(lsr_32),
+    HANDLERS(asr_32), HANDLERS(rrx)
+};
+static arm_handler shift_by_register_handlers[4][2] = {
+    HANDLERS(lsl_register), HANDLERS(lsr_register),
+    HANDLERS(asr_register), HANDLERS(ror_register)
+};
+
+/* Multiply and multiply long (ARM manual A4-66, A4-80 and following), the
+ * opcode field holds bits 23 to 21. As decoded for data processing, rn holds
+ * the destination (Rd or RdHi) and rd holds the accumulator (Rn or RdLo).
+ */
+static int multiply(arm_core p, arm_decoded d) {
+    uint32_t cpsr, high, low;
+    uint64_t result;
+
+    if (d->opcode & 4) {
+        if (d->opcode & 2)
+            result = (int64_t) (int32_t) arm_fast_read_register(p, d->rm) *
+                     (int32_t) arm_fast_read_register(p, d->rs);
+        else
+            result = (uint64_t) arm_fast_read_register(p, d->rm) *
+                     arm_fast_read_register(p, d->rs);
+        if (d->opcode & 1)
+            result += ((uint64_t) arm_fast_read_register(p, d->rn) << 32) |
+                      arm_fast_read_register(p, d->rd);
+        high = result >> 32;
+        low = result;
+        arm_fast_write_register(p, d->rd, low);
+        arm_fast_write_register(p, d->rn, high);
+    } else {
+        high = arm_fast_read_register(p, d->rm) *
+               arm_fast_read_register(p, d->rs);
+        if (d->opcode & 1)
+            high += arm_fast_read_register(p, d->rd);
+        low = 0;
+        arm_fast_write_register(p, d->rn, high);
+    }
+    if (get_bit(d->ins, 20)) {
+        /* C is unpredictable and V unaffected, we leave both unchanged */
+        cpsr = arm_fast_read_cpsr(p) & 0x3FFFFFFF;
+        cpsr |= (get_bit(high, 31) << N) | (((high | low) == 0) << Z);
+        arm_write_cpsr(p, cpsr);
+    }
+    return 0;
+}
+
+/* Move to status register (ARM manual A4-76) */
+static int msr(arm_core p, arm_decoded d) {
+    uint32_t operand, byte_mask, mask;
+    int i;
+
+    if (d->shift_imm == ROTATED_IMMEDIATE)
+        operand = d->imm;
+    else
+        operand = arm_fast_read_register(p, d->rm);
+    byte_mask = 0;
+    for (i=0; i<4; i++)
+        if (get_bit(d->rn, i))
+            byte_mask |= 0xFF << (8*i);
+    if (get_bit(d->ins, 22)) {
+        if (!arm_current_mode_has_spsr(p))
+            return 0;
+        mask = byte_mask & (UserMask | EndianMask | PrivMask | StateMask);
+        arm_write_spsr(p, (arm_read_spsr(p) & ~mask) | (operand & mask));
+    } else {
+        if (arm_in_a_privileged_mode(p))
+            mask = byte_mask & (UserMask | EndianMask | PrivMask);
+        else
+            mask = byte_mask & (UserMask | EndianMask);
+        arm_write_cpsr(p, (arm_fast_read_cpsr(p) & ~mask) | (operand & mask));
+    }
+    return 0;
+}
+
 /* Decoding functions for different classes of instructions */
+void arm_data_processing_shift_decode(arm_decoded d) {
+    uint32_t ins = d->ins;
+
+    d->rn = get_bits(ins, 19, 16);
+    d->rd = get_bits(ins, 15, 12);
+    d->rs = get_bits(ins, 11, 8);
+    d->rm = get_bits(ins, 3, 0);
+    if (get_bit(ins, 7) && get_bit(ins, 4)) {
+        /* Multiplies */
+        d->opcode = get_bits(ins, 23, 21);
+        if ((d->opcode == 2) || (d->opcode == 3))
+            d->handler = arm_undefined;
+        else
+            d->handler = multiply;
+        return;
+    }
+    d->opcode = get_bits(ins, 24, 21);
+    d->shift = get_bits(ins, 6, 5);
+    if (get_bit(ins, 4)) {
+        d->shift_imm = SHIFT_BY_REGISTER;
+        d->handler = shift_by_register_handlers[d->shift][get_bit(ins, 20)];
+    } else {
+        d->shift_imm = SHIFT_BY_IMMEDIATE;
+        d->imm = get_bits(ins, 11, 7);
+        if (d->imm)
+            d->handler =
+                shift_by_immediate_handlers[d->shift][get_bit(ins, 20)];
+        else
+            d->handler = shift_by_zero_handlers[d->shift][get_bit(ins, 20)];
+    }
+}
+
+void arm_data_processing_immediate_msr_decode(arm_decoded d) {
+    uint32_t ins = d->ins;
+
+    d->rn = get_bits(ins, 19, 16);
+    d->rd = get_bits(ins, 15, 12);
+    d->rs = get_bits(ins, 11, 8);
+    d->opcode = get_bits(ins, 24, 21);
+    d->shift_imm = ROTATED_IMMEDIATE;
+    d->imm = get_bits(ins, 7, 0);
+    if (d->rs)
+        d->imm = ror(d->imm, 2*d->rs);
+    if ((get_bits(ins, 24, 23) == 2) && !get_bit(ins, 20))
+        d->handler = msr;
+    else if (d->rs)
+        d->handler = rotated_immediate_handlers[get_bit(ins, 20)];
+    else
+        d->handler = immediate_handlers[get_bit(ins, 20)];
+}
+
+/* MSR with a register operand belongs to the miscellaneous instructions */
+void arm_data_processing_msr_register_decode(arm_decoded d) {
+    d->rn = get_bits(d->ins, 19, 16);
+    d->rm = get_bits(d->ins, 3, 0);
+    d->shift_imm = SHIFT_BY_REGISTER;
+    d->handler = msr;
+}
+
 int arm_data_processing_shift(arm_core p, uint32_t ins) {
-    return UNDEFINED_INSTRUCTION;
+    return arm_decode_and_execute(p, ins, arm_data_processing_shift_decode);
 }
 
 int arm_data_processing_immediate_msr(arm_core p, uint32_t ins) {
-    return UNDEFINED_INSTRUCTION;
+    return arm_decode_and_execute(p, ins,
+                                  arm_data_processing_immediate_msr_decode);
 }
@@ -28,4 +28,8 @@ Contact: Guillaume.Huard@imag.fr
 int arm_data_processing_shift(arm_core p, uint32_t ins);
 int arm_data_processing_immediate_msr(arm_core p, uint32_t ins);
 
+void arm_data_processing_shift_decode(arm_decoded d);
+void arm_data_processing_immediate_msr_decode(arm_decoded d);
+void arm_data_processing_msr_register_decode(arm_decoded d);
+
 #endif
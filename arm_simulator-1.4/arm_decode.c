@@ -0,0 +1,110 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include <stdlib.h>
+#include "arm_decode.h"
+#include "arm_instruction.h"
+#include "arm_constants.h"
+#include "util.h"
+
+#define ARM_DECODE_CACHE_BITS 16
+#define ARM_DECODE_CACHE_SIZE (1 << ARM_DECODE_CACHE_BITS)
+#define ARM_DECODE_CACHE_INDEX(address) \
+                    (((address) >> 2) & (ARM_DECODE_CACHE_SIZE - 1))
+/* Instructions are word aligned, this tag never matches */
+#define ARM_DECODE_INVALID 1
+
+struct arm_decode_cache_data {
+    memory mem;
+    struct arm_decoded_instruction entries[ARM_DECODE_CACHE_SIZE];
+};
+
+arm_decode_cache arm_decode_cache_create(memory mem) {
+    arm_decode_cache cache;
+
+    cache = malloc(sizeof(struct arm_decode_cache_data));
+    if (cache) {
+        cache->mem = mem;
+        arm_decode_cache_flush(cache);
+    }
+    return cache;
+}
+
+void arm_decode_cache_destroy(arm_decode_cache cache) {
+    free(cache);
+}
+
+arm_decoded arm_decode_cache_lookup(arm_decode_cache cache, uint32_t address) {
+    arm_decoded d = &cache->entries[ARM_DECODE_CACHE_INDEX(address)];
+
+    return (d->address == address) ? d : NULL;
+}
+
+arm_decoded arm_decode_cache_fill(arm_decode_cache cache, uint32_t address,
+                                  uint32_t physical, uint32_t ins) {
+    arm_decoded d = &cache->entries[ARM_DECODE_CACHE_INDEX(address)];
+
+    d->address = address;
+    d->ins = ins;
+    arm_decode_instruction(d);
+    memory_mark_code(cache->mem, physical);
+    return d;
+}
+
+/* The cache is larger than a page, so the entries of a page are contiguous */
+void arm_decode_cache_invalidate(arm_decode_cache cache,
+                                 uint32_t page_address) {
+    uint32_t address;
+    arm_decoded d;
+
+    for (address = page_address; address - page_address < MEMORY_PAGE_SIZE;
+         address += 4) {
+        d = &cache->entries[ARM_DECODE_CACHE_INDEX(address)];
+        if (d->address == address)
+            d->address = ARM_DECODE_INVALID;
+    }
+}
+
+void arm_decode_cache_flush(arm_decode_cache cache) {
+    int i;
+
+    for (i=0; i<ARM_DECODE_CACHE_SIZE; i++)
+        cache->entries[i].address = ARM_DECODE_INVALID;
+}
+
+int arm_decode_and_execute(arm_core p, uint32_t ins, arm_decoder decoder) {
+    struct arm_decoded_instruction d;
+
+    d.address = arm_read_register(p, 15) - 8;
+    d.ins = ins;
+    d.cond = get_bits(ins, 31, 28);
+    decoder(&d);
+    return d.handler(p, &d);
+}
+
+int arm_undefined(arm_core p, arm_decoded d) {
+    return UNDEFINED_INSTRUCTION;
+}
+
+void arm_undefined_decode(arm_decoded d) {
+    d->handler = arm_undefined;
+}
@@ -0,0 +1,79 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#ifndef __ARM_DECODE_H__
+#define __ARM_DECODE_H__
+#include <stdint.h>
+#include "arm_core.h"
+#include "memory.h"
+
+typedef int (*arm_handler)(arm_core p, arm_decoded d);
+typedef void (*arm_decoder)(arm_decoded d);
+
+/* Predecoded instruction. Everything that only depends on the instruction
+ * word and on its address is extracted once by the decoder of its class,
+ * which also selects the handler performing the execution. The meaning of
+ * imm, opcode and shift fields depends on the class of the instruction.
+ */
+struct arm_decoded_instruction {
+    arm_handler handler;
+    uint32_t address;
+    uint32_t ins;
+    uint32_t imm;
+    uint8_t cond;
+    uint8_t opcode;
+    uint8_t rd, rn, rs, rm;
+    uint8_t shift, shift_imm;
+    /* Entry of the threaded interpreter of arm_block, only meaningful for
+     * instructions copied into a block
+     */
+    uint8_t thread;
+    /* Superinstruction starting with this instruction in a block (arm_block),
+     * 0 if none
+     */
+    uint8_t fusion;
+};
+
+typedef struct arm_decode_cache_data *arm_decode_cache;
+
+/* Direct mapped cache of decoded instructions indexed by address. Filled
+ * entries mark the page of their physical address as code in mem, the owner
+ * of the cache is expected to call arm_decode_cache_invalidate on writes to
+ * such pages (or to flush it when virtual addresses differ from physical ones).
+ */
+arm_decode_cache arm_decode_cache_create(memory mem);
+void arm_decode_cache_destroy(arm_decode_cache cache);
+arm_decoded arm_decode_cache_lookup(arm_decode_cache cache, uint32_t address);
+arm_decoded arm_decode_cache_fill(arm_decode_cache cache, uint32_t address,
+                                  uint32_t physical, uint32_t ins);
+void arm_decode_cache_invalidate(arm_decode_cache cache,
+                                 uint32_t page_address);
+void arm_decode_cache_flush(arm_decode_cache cache);
+
+/* Decodes ins, located at pc - 8, using the given class decoder and executes
+ * it right away. Used by the per class entry points (arm_branch, ...).
+ */
+int arm_decode_and_execute(arm_core p, uint32_t ins, arm_decoder decoder);
+int arm_undefined(arm_core p, arm_decoded d);
+void arm_undefined_decode(arm_decoded d);
+
+#endif
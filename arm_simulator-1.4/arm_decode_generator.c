@@ -0,0 +1,129 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include <stdio.h>
+#include <stdint.h>
+
+/* Generates arm_decode_table.c, holding the class decoder of each instruction
+ * indexed by bits 27 to 20 and 7 to 4 of the instruction word, and the
+ * condition field evaluation for each combination of the NZCV flags.
+ */
+
+#define TABLE_SIZE 4096
+
+/* Encoding of the instruction classes (ARM manual A3-2), patterns match bits
+ * 27 to 20 then bits 7 to 4, x matches any value. The first pattern matching
+ * an index gives its decoder.
+ */
+struct encoding {
+    char *pattern;
+    char *decoder;
+};
+
+static struct encoding encodings[] = {
+    /* Multiplies, swap and extra load/store */
+    { "0000xxxx1001", "arm_data_processing_shift_decode" },
+    { "000xxxxx1xx1", "arm_load_store_decode" },
+    /* Test and compare opcodes without the S bit */
+    { "00010xx0xxxx", "arm_miscellaneous_decode" },
+    { "000xxxxxxxxx", "arm_data_processing_shift_decode" },
+    { "00110x00xxxx", "arm_undefined_decode" },
+    { "001xxxxxxxxx", "arm_data_processing_immediate_msr_decode" },
+    { "011xxxxxxxx1", "arm_undefined_decode" },
+    { "01xxxxxxxxxx", "arm_load_store_decode" },
+    { "100xxxxxxxxx", "arm_load_store_multiple_decode" },
+    { "101xxxxxxxxx", "arm_branch_decode" },
+    { "110xxxxxxxxx", "arm_coprocessor_load_store_decode" },
+    { "111xxxxxxxxx", "arm_coprocessor_others_swi_decode" },
+    { NULL, NULL }
+};
+
+static int matches(char *pattern, int index) {
+    int i, bit;
+
+    for (i=0; i<12; i++) {
+        bit = (index >> (11 - i)) & 1;
+        if ((pattern[i] != 'x') && (pattern[i] - '0' != bit))
+            return 0;
+    }
+    return 1;
+}
+
+static char *decoder(int index) {
+    int i;
+
+    for (i=0; encodings[i].pattern; i++)
+        if (matches(encodings[i].pattern, index))
+            return encodings[i].decoder;
+    return "arm_undefined_decode";
+}
+
+/* Condition field evaluation (ARM manual A3-4), cond 0xF denotes the
+ * unconditional instructions space, whose decoding is handled separately.
+ */
+static int condition_holds(int flags, int cond) {
+    int n = (flags >> 3) & 1, z = (flags >> 2) & 1;
+    int c = (flags >> 1) & 1, v = flags & 1;
+
+    switch (cond) {
+      case 0x0: return z;
+      case 0x1: return !z;
+      case 0x2: return c;
+      case 0x3: return !c;
+      case 0x4: return n;
+      case 0x5: return !n;
+      case 0x6: return v;
+      case 0x7: return !v;
+      case 0x8: return c && !z;
+      case 0x9: return !c || z;
+      case 0xA: return n == v;
+      case 0xB: return n != v;
+      case 0xC: return !z && (n == v);
+      case 0xD: return z || (n != v);
+      default:  return 1;
+    }
+}
+
+int main() {
+    uint16_t conditions;
+    int i, flags;
+
+    printf("/* Generated by arm_decode_generator, do not edit */\n"
+           "#include \"arm_instruction.h\"\n"
+           "#include \"arm_decode.h\"\n"
+           "#include \"arm_data_processing.h\"\n"
+           "#include \"arm_load_store.h\"\n"
+           "#include \"arm_branch_other.h\"\n\n"
+           "arm_decoder arm_decode_table[%d] = {\n", TABLE_SIZE);
+    for (i=0; i<TABLE_SIZE; i++)
+        printf("    /* %03x */ %s,\n", i, decoder(i));
+    printf("};\n\n"
+           "uint16_t arm_condition_table[16] = {\n");
+    for (i=0; i<16; i++) {
+        conditions = 0;
+        for (flags=0; flags<16; flags++)
+            conditions |= condition_holds(flags, i) << flags;
+        printf("    0x%04x,\n", conditions);
+    }
+    printf("};\n");
+    return 0;
+}
@@ -23,18 +23,75 @@ Contact: Guillaume.Huard@imag.fr
 #include "arm_exception.h"
 #include "arm_constants.h"
 #include "arm_core.h"
+#include "memory.h"
 #include "util.h"
 
-// Not supported below ARMv6, should read as 0
-#define CP15_reg1_EEbit 0
+/* The E bit is set on exception entry from the EE bit of CP15 register 1
+ * (ARMv6), which we take from the endianess of the memory
+ */
+#define Exception_bit_9(p) \
+        (memory_is_big_endian(arm_get_memory(p)) ? EndianMask : 0)
 
-#define Exception_bit_9 (CP15_reg1_EEbit << 9)
+/* Bits of the CPSR modified on exception entry */
+#define I 7
+#define F 6
+#define T 5
+
+/* Exception vectors, modes and offsets of the return address with respect to
+ * the value read from the pc in ARM and in Thumb state (ARM manual A2-13 and
+ * following), indexed by exception number
+ */
+static struct {
+    uint32_t vector;
+    uint8_t mode;
+    int8_t link_offset;
+    int8_t thumb_link_offset;
+} exception_entry[] = {
+    { 0, 0, 0, 0 },
+    { 0x00, SVC, 0, 0 },
+    { 0x04, UND, -4, -2 },
+    { 0x08, SVC, -4, -2 },
+    { 0x0C, ABT, -4, 0 },
+    { 0x10, ABT, 0, 4 },
+    { 0x18, IRQ, 0, 2 },
+    { 0x1C, FIQ, 0, 2 }
+};
+
+int arm_exception(arm_core p, unsigned char exception) {
+    uint32_t cpsr, link, vector;
 
-void arm_exception(arm_core p, unsigned char exception) {
-    /* We only support RESET initially */
     /* Semantics of reset interrupt (ARM manual A2-18) */
     if (exception == RESET) {
-        arm_write_cpsr(p, 0x1d3 | Exception_bit_9);
+        arm_write_cpsr(p, 0x1d3 | Exception_bit_9(p));
 	arm_write_usr_register(p, 15, 0);
+        return 0;
     }
+    if ((exception < UNDEFINED_INSTRUCTION) || (exception > FAST_INTERRUPT))
+        return -1;
+    cpsr = arm_read_cpsr(p);
+    /* Masked interrupts are ignored */
+    if (((exception == INTERRUPT) && get_bit(cpsr, I)) ||
+        ((exception == FAST_INTERRUPT) && get_bit(cpsr, F)))
+        return -1;
+    /* Synchronous exceptions occur after the fetch of the offending
+     * instruction, interrupts between two instructions, hence the pc read
+     * is always the address of the next instruction + 4 (+ 2 in Thumb state)
+     */
+    link = arm_read_register(p, 15);
+    if (get_bit(cpsr, T))
+        link += exception_entry[exception].thumb_link_offset;
+    else
+        link += exception_entry[exception].link_offset;
+    arm_write_cpsr(p, (clr_bit(cpsr, T) & ~(EndianMask | 0x1F)) |
+                      set_bit(0, I) |
+                      ((exception == FAST_INTERRUPT) ? set_bit(0, F) : 0) |
+                      exception_entry[exception].mode | Exception_bit_9(p));
+    arm_write_spsr(p, cpsr);
+    arm_write_register(p, 14, link);
+    /* High vectors are selected by the V bit of CP15 register 1 */
+    vector = exception_entry[exception].vector;
+    if (arm_mmu_high_vectors(arm_get_mmu(p)))
+        vector |= 0xFFFF0000;
+    arm_write_register(p, 15, vector);
+    return 0;
 }
@@ -25,6 +25,9 @@ Contact: Guillaume.Huard@imag.fr
 #include <stdint.h>
 #include "arm_core.h"
 
-void arm_exception(arm_core p, unsigned char exception);
+/* Returns 0 if the exception is raised, -1 if it is ignored: an interrupt
+ * masked in the cpsr or an unknown exception
+ */
+int arm_exception(arm_core p, unsigned char exception);
 
 #endif
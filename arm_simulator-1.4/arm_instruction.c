@@ -21,17 +21,61 @@ Contact: Guillaume.Huard@imag.fr
 	 38401 Saint Martin d'Hres
 */
 #include "arm_instruction.h"
+#include "arm_decode.h"
+#include "arm_core_fast.h"
 #include "arm_exception.h"
-#include "arm_data_processing.h"
-#include "arm_load_store.h"
 #include "arm_branch_other.h"
 #include "arm_constants.h"
+#include "arm_aot.h"
+#include "memory.h"
+#include "trace.h"
 #include "util.h"
 
-static int arm_execute_instruction(arm_core p) {
-    return 0;
+/* Maximal number of instructions run by an execution engine before checking
+ * for posted interrupts
+ */
+#define ARM_RUN_SLICE 4096
+
+/* The condition table, generated by arm_decode_generator, holds for each
+ * condition a bit per value of the NZCV flags
+ */
+int arm_condition_holds(uint32_t cpsr, uint8_t cond) {
+    return (arm_condition_table[cond] >> (cpsr >> 28)) & 1;
 }
 
+int arm_condition_passed(arm_core p, uint8_t cond) {
+    if (cond >= 0xE)
+        return 1;
+    return arm_condition_holds(arm_fast_read_cpsr(p), cond);
+}
+
+/* Class decoders are selected by a table indexed by bits 27 to 20 and 7 to 4,
+ * generated by arm_decode_generator from the encoding of instruction classes
+ */
+void arm_decode_instruction(arm_decoded d) {
+    uint32_t ins = d->ins;
+
+    d->cond = get_bits(ins, 31, 28);
+    if (d->cond == 0xF) {
+        /* Unconditional instructions, only blx is part of ARMv5T */
+        if (get_bits(ins, 27, 25) == 5)
+            arm_branch_decode(d);
+        else
+            d->handler = arm_undefined;
+        return;
+    }
+    arm_decode_table[(get_bits(ins, 27, 20) << 4) | get_bits(ins, 7, 4)](d);
+}
+
+static int arm_execute_instruction(arm_core p) {
+    arm_decoded d;
+
+    if (arm_fetch_decoded(p, &d))
+        return PREFETCH_ABORT;
+    if (!arm_condition_passed(p, d->cond))
+        return 0;
+    return d->handler(p, d);
+}
 int arm_step(arm_core p) {
     int result;
 
@@ -40,3 +84,59 @@ int arm_step(arm_core p) {
         arm_exception(p, result);
     return result;
 }
+
+/* Not an architectural access, not traced */
+int arm_is_at_breakpoint(arm_core p) {
+    uint32_t address, ins;
+    uint16_t half;
+
+    address = arm_get_fetch_address(p);
+    if (arm_inline_translate_fetch(p, &address))
+        return 0;
+    if (arm_inline_in_thumb_state(p))
+        return !memory_fetch_half(arm_get_memory(p), address, &half) &&
+               (half == ThumbBreakpoint);
+    if (memory_fetch_word(arm_get_memory(p), address, &ins))
+        return 0;
+    return (ins & BreakpointMask) == BreakpointPattern;
+}
+
+/* Execution engines never run through a breakpoint that is not the first
+ * instruction they execute, so breakpoints and posted interrupts are only
+ * checked between two runs. When the state is traced, we single step to
+ * output it after each instruction, and so do we when watchpoints are set, to
+ * stop right after the access hitting one of them.
+ */
+int arm_run(arm_core p, uint32_t budget, int *exception) {
+    uint32_t start, executed;
+    int result;
+
+    *exception = 0;
+    start = arm_get_cycle_count(p);
+    executed = 0;
+    while (executed < budget) {
+        result = arm_take_interrupt(p);
+        if (result) {
+            *exception = result;
+            return ARM_STOP_INTERRUPT;
+        }
+        if (arm_is_at_breakpoint(p))
+            return ARM_STOP_BREAKPOINT;
+        if (trace_has(STATE) || memory_has_watches(arm_get_memory(p))) {
+            result = arm_step(p);
+            trace_arm_state(p);
+            if (memory_watch_hit(arm_get_memory(p), NULL)) {
+                *exception = result;
+                return ARM_STOP_WATCHPOINT;
+            }
+        } else {
+            result = arm_aot_step(p, min(budget - executed, ARM_RUN_SLICE));
+        }
+        if (result) {
+            *exception = result;
+            return (result == HALT) ? ARM_STOP_HALT : ARM_STOP_EXCEPTION;
+        }
+        executed = arm_get_cycle_count(p) - start;
+    }
+    return ARM_STOP_BUDGET;
+}
@@ -23,7 +23,34 @@ Contact: Guillaume.Huard@imag.fr
 #ifndef __ARM_INSTRUCTION_H__
 #define __ARM_INSTRUCTION_H__
 #include "arm_core.h"
+#include "arm_decode.h"
 
 int arm_step(arm_core p);
+/* Tells if the next instruction is a gdb soft breakpoint */
+int arm_is_at_breakpoint(arm_core p);
+
+/* Runs at least budget instructions, unless the execution has to stop before
+ * that for one of the following reasons: the next instruction is a gdb soft
+ * breakpoint, which is not executed, an exception is raised, including the
+ * end of the simulation (swi 0x123456), a posted interrupt has been raised,
+ * or an instruction has hit a watchpoint (see memory_watch_hit), after which
+ * it stops. The exception, if any, is stored in exception.
+ */
+#define ARM_STOP_BUDGET     0
+#define ARM_STOP_BREAKPOINT 1
+#define ARM_STOP_EXCEPTION  2
+#define ARM_STOP_HALT       3
+#define ARM_STOP_INTERRUPT  4
+#define ARM_STOP_WATCHPOINT 5
+int arm_run(arm_core p, uint32_t budget, int *exception);
+
+/* Selects the class decoder of the instruction word held in d */
+void arm_decode_instruction(arm_decoded d);
+int arm_condition_holds(uint32_t cpsr, uint8_t cond);
+int arm_condition_passed(arm_core p, uint8_t cond);
+
+/* Generated tables, see arm_decode_generator */
+extern arm_decoder arm_decode_table[4096];
+extern uint16_t arm_condition_table[16];
 
 #endif
@@ -0,0 +1,917 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "arm_jit.h"
+#include "arm_block.h"
+#include "arm_decode.h"
+#include "arm_instruction.h"
+#include "arm_exception.h"
+#include "arm_constants.h"
+#include "memory.h"
+#include "trace.h"
+#include "util.h"
+#include "debug.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#define ARM_JIT_CODE_SIZE (8 << 20)
+/* Room always left in the code buffer before translating a block */
+#define ARM_JIT_MAX_TRANSLATION (64 << 10)
+#define ARM_JIT_MAX_SIZE 64
+#define ARM_JIT_HASH_BITS 12
+#define ARM_JIT_HASH_SIZE (1 << ARM_JIT_HASH_BITS)
+#define ARM_JIT_HASH(address) (((address) >> 2) & (ARM_JIT_HASH_SIZE - 1))
+#define ARM_JIT_MAX_DEAD 1024
+/* Number of interpreted executions of a block before its translation */
+#define ARM_JIT_THRESHOLD 16
+
+/* Kinds of the last flag setting operation */
+#define FLAGS_NONE    0
+#define FLAGS_LOGICAL 1
+#define FLAGS_ADD     2
+#define FLAGS_SUB     3
+/* Only used at translation time, the kind depends on the execution path */
+#define FLAGS_UNKNOWN 4
+
+/* State seen by the translated code, which holds a pointer to it in rbx */
+struct arm_jit_state {
+    uint32_t r[16];
+    uint32_t cpsr;
+    /* Lazy flags: NZCV in cpsr are only valid when flags_kind is FLAGS_NONE,
+     * C and V are taken from the cpsr for FLAGS_LOGICAL.
+     */
+    uint32_t flags_kind, flags_a, flags_b, flags_result;
+    uint32_t executed;
+    uint32_t write_back;
+    uint8_t code_written;
+    memory mem;
+};
+
+typedef int (*arm_jit_code)(struct arm_jit_state *s);
+
+typedef struct arm_jit_translation *arm_jit_translation;
+
+struct arm_jit_translation {
+    uint32_t address;
+    int size;
+    /* NULL when the first instruction cannot be translated */
+    arm_jit_code code;
+    arm_jit_translation next;
+};
+
+struct arm_jit_statistics {
+    unsigned long translations, translated_instructions, untranslatable;
+    unsigned long native_runs, interpreted_runs;
+    unsigned long invalidations, flushes;
+};
+
+struct arm_jit_data {
+    struct arm_jit_state state;
+    arm_core p;
+    uint8_t *code, *code_top;
+    arm_jit_translation table[ARM_JIT_HASH_SIZE];
+    arm_jit_translation dead;
+    int dead_count;
+    uint8_t hotness[ARM_JIT_HASH_SIZE];
+    struct arm_jit_statistics statistics;
+};
+
+/* Helpers called by the translated code */
+
+static void arm_jit_materialize_flags(struct arm_jit_state *s) {
+    uint32_t a = s->flags_a, b = s->flags_b, result = s->flags_result;
+    uint32_t flags;
+
+    switch (s->flags_kind) {
+      case FLAGS_NONE:
+        return;
+      case FLAGS_LOGICAL:
+        flags = s->cpsr & ((1 << C) | (1 << V));
+        break;
+      case FLAGS_ADD:
+        flags = ((result < a) << C) |
+                (get_bit((a ^ result) & (b ^ result), 31) << V);
+        break;
+      default:
+        flags = ((a >= b) << C) | (get_bit((a ^ b) & (a ^ result), 31) << V);
+    }
+    flags |= (get_bit(result, 31) << N) | ((result == 0) << Z);
+    s->cpsr = (s->cpsr & 0x0FFFFFFF) | flags;
+    s->flags_kind = FLAGS_NONE;
+}
+
+static int arm_jit_condition(struct arm_jit_state *s, uint32_t cond) {
+    arm_jit_materialize_flags(s);
+    return arm_condition_holds(s->cpsr, cond);
+}
+
+/* Loads return the value in the low word, a set bit 32 denotes a failure */
+static uint64_t arm_jit_load_word(struct arm_jit_state *s, uint32_t address) {
+    uint32_t value;
+
+    if (memory_read_word(s->mem, address & 0xFFFFFFFC, &value))
+        return (uint64_t) 1 << 32;
+    if (address & 3)
+        value = ror(value, 8*(address & 3));
+    return value;
+}
+
+static uint64_t arm_jit_load_byte(struct arm_jit_state *s, uint32_t address) {
+    uint8_t value;
+
+    if (memory_read_byte(s->mem, address, &value))
+        return (uint64_t) 1 << 32;
+    return value;
+}
+
+static int arm_jit_store_word(struct arm_jit_state *s, uint32_t address,
+                              uint32_t value) {
+    return memory_write_word(s->mem, address & 0xFFFFFFFC, value);
+}
+
+static int arm_jit_store_byte(struct arm_jit_state *s, uint32_t address,
+                              uint32_t value) {
+    return memory_write_byte(s->mem, address, value);
+}
+
+/* x86-64 code emission. Guest registers and lazy flags are accessed in memory
+ * relative to rbx, eax, ecx and edx are scratch registers.
+ */
+#define EAX 0
+#define ECX 1
+#define EDX 2
+#define EBX 3
+#define ESI 6
+
+/* x86 condition codes */
+#define CC_O  0x0
+#define CC_B  0x2
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A  0x7
+#define CC_S  0x8
+#define CC_NS 0x9
+#define CC_L  0xC
+#define CC_GE 0xD
+#define CC_LE 0xE
+#define CC_G  0xF
+#define CC_NONE 0xFF
+
+#define OFFSET(field) ((uint32_t) offsetof(struct arm_jit_state, field))
+#define REG(i) (OFFSET(r) + 4*(i))
+
+struct emitter {
+    uint8_t *position, *limit;
+};
+
+static void emit_byte(struct emitter *e, uint8_t value) {
+    if (e->position < e->limit)
+        *e->position = value;
+    e->position++;
+}
+
+static void emit_word(struct emitter *e, uint32_t value) {
+    int i;
+
+    for (i=0; i<4; i++)
+        emit_byte(e, value >> (8*i));
+}
+
+/* op reg, [rbx + offset] */
+static void emit_load(struct emitter *e, uint8_t opcode, int reg,
+                      uint32_t offset) {
+    emit_byte(e, opcode);
+    emit_byte(e, 0x80 | (reg << 3) | EBX);
+    emit_word(e, offset);
+}
+
+/* mov reg, [rbx + offset] */
+static void emit_read(struct emitter *e, int reg, uint32_t offset) {
+    emit_load(e, 0x8B, reg, offset);
+}
+
+/* mov [rbx + offset], reg */
+static void emit_write(struct emitter *e, uint32_t offset, int reg) {
+    emit_load(e, 0x89, reg, offset);
+}
+
+/* mov dword [rbx + offset], value */
+static void emit_write_immediate(struct emitter *e, uint32_t offset,
+                                 uint32_t value) {
+    emit_load(e, 0xC7, 0, offset);
+    emit_word(e, value);
+}
+
+/* mov reg, value */
+static void emit_move_immediate(struct emitter *e, int reg, uint32_t value) {
+    emit_byte(e, 0xB8 | reg);
+    emit_word(e, value);
+}
+
+/* op destination, source */
+static void emit_alu(struct emitter *e, uint8_t opcode, int destination,
+                     int source) {
+    emit_byte(e, opcode);
+    emit_byte(e, 0xC0 | (source << 3) | destination);
+}
+
+#define ADD_OPCODE  0x01
+#define OR_OPCODE   0x09
+#define AND_OPCODE  0x21
+#define SUB_OPCODE  0x29
+#define XOR_OPCODE  0x31
+#define TEST_OPCODE 0x85
+#define MOV_OPCODE  0x89
+
+/* shift reg, amount, extension gives the kind of shift */
+static void emit_shift(struct emitter *e, int extension, int reg,
+                       uint8_t amount) {
+    emit_byte(e, 0xC1);
+    emit_byte(e, 0xC0 | (extension << 3) | reg);
+    emit_byte(e, amount);
+}
+
+#define ROR_EXTENSION 1
+#define SHL_EXTENSION 4
+#define SHR_EXTENSION 5
+#define SAR_EXTENSION 7
+
+static void emit_not(struct emitter *e, int reg) {
+    emit_byte(e, 0xF7);
+    emit_byte(e, 0xD0 | reg);
+}
+
+/* Conditional jump with a 32 bits displacement to patch, returns the
+ * position of the displacement
+ */
+static uint8_t *emit_jump_if(struct emitter *e, int condition) {
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x80 | condition);
+    emit_word(e, 0);
+    return e->position - 4;
+}
+
+static void patch_jump(struct emitter *e, uint8_t *displacement) {
+    int32_t value = e->position - (displacement + 4);
+
+    if (e->position <= e->limit)
+        memcpy(displacement, &value, 4);
+}
+
+/* Call of a helper with the state as first argument, other arguments must
+ * already be in esi and edx
+ */
+static void emit_call(struct emitter *e, void *function) {
+    uint64_t address = (uint64_t) function;
+    int i;
+
+    /* mov rdi, rbx */
+    emit_byte(e, 0x48);
+    emit_byte(e, 0x89);
+    emit_byte(e, 0xDF);
+    /* mov rax, function; call rax */
+    emit_byte(e, 0x48);
+    emit_byte(e, 0xB8);
+    for (i=0; i<8; i++)
+        emit_byte(e, address >> (8*i));
+    emit_byte(e, 0xFF);
+    emit_byte(e, 0xD0);
+}
+
+/* Leaves the translated code, with pc as the address of the next instruction
+ * and count instructions executed since the beginning
+ */
+static void emit_exit(struct emitter *e, uint32_t pc, int count,
+                      int status) {
+    emit_write_immediate(e, REG(15), pc);
+    /* add dword [rbx + executed], count */
+    emit_load(e, 0x81, 0, OFFSET(executed));
+    emit_word(e, count);
+    emit_move_immediate(e, EAX, status);
+    /* pop rbx; ret */
+    emit_byte(e, 0x5B);
+    emit_byte(e, 0xC3);
+}
+
+/* Translation of instructions */
+
+/* Data processing opcodes (ARM manual A4-3) */
+#define AND 0x0
+#define EOR 0x1
+#define SUB 0x2
+#define RSB 0x3
+#define ADD 0x4
+#define ADC 0x5
+#define RSC 0x7
+#define TST 0x8
+#define TEQ 0x9
+#define CMP 0xA
+#define CMN 0xB
+#define MOV 0xD
+#define BIC 0xE
+#define MVN 0xF
+
+#define is_test(opcode) (((opcode) >= TST) && ((opcode) <= CMN))
+#define is_logical(opcode) (((opcode) < SUB) || ((opcode) == TST) || \
+                            ((opcode) == TEQ) || ((opcode) >= 0xC))
+
+/* For each ARM condition, the x86 condition giving the same result after a
+ * cmp (subtraction) or an add of the lazy operands, or a test of the lazy
+ * result for logical operations
+ */
+static uint8_t sub_condition[] = { CC_E, CC_NE, CC_AE, CC_B, CC_S, CC_NS,
+                                   CC_O, CC_O ^ 1, CC_A, CC_BE, CC_GE, CC_L,
+                                   CC_G, CC_LE };
+static uint8_t add_condition[] = { CC_E, CC_NE, CC_B, CC_AE, CC_S, CC_NS,
+                                   CC_O, CC_O ^ 1, CC_NONE, CC_NONE, CC_GE,
+                                   CC_L, CC_G, CC_LE };
+static uint8_t logical_condition[] = { CC_E, CC_NE, CC_NONE, CC_NONE, CC_S,
+                                       CC_NS, CC_NONE, CC_NONE, CC_NONE,
+                                       CC_NONE, CC_NONE, CC_NONE, CC_NONE,
+                                       CC_NONE };
+
+/* Emits the evaluation of cond and a jump taken when it fails. When the kind
+ * of the lazy flags is known, the condition is evaluated inline.
+ */
+static uint8_t *emit_condition(struct emitter *e, uint8_t cond, int kind) {
+    uint8_t condition = CC_NONE;
+
+    switch (kind) {
+      case FLAGS_SUB:
+        condition = sub_condition[cond];
+        break;
+      case FLAGS_ADD:
+        condition = add_condition[cond];
+        break;
+      case FLAGS_LOGICAL:
+        condition = logical_condition[cond];
+        break;
+    }
+    if (condition == CC_NONE) {
+        emit_move_immediate(e, ESI, cond);
+        emit_call(e, arm_jit_condition);
+        emit_alu(e, TEST_OPCODE, EAX, EAX);
+        return emit_jump_if(e, CC_E);
+    }
+    if (kind == FLAGS_LOGICAL) {
+        emit_read(e, EAX, OFFSET(flags_result));
+        emit_alu(e, TEST_OPCODE, EAX, EAX);
+    } else {
+        emit_read(e, EAX, OFFSET(flags_a));
+        /* cmp or add eax, [rbx + flags_b] */
+        emit_load(e, (kind == FLAGS_SUB) ? 0x3B : 0x03, EAX, OFFSET(flags_b));
+    }
+    return emit_jump_if(e, condition ^ 1);
+}
+
+/* Value of a register read by the instruction at address */
+static void emit_read_register(struct emitter *e, int reg, int source,
+                               uint32_t address) {
+    if (source == 15)
+        emit_move_immediate(e, reg, address + 8);
+    else
+        emit_read(e, reg, REG(source));
+}
+
+/* Register shifted by an immediate into ecx (ARM manual A5-2), RRX is not
+ * supported
+ */
+static void emit_shifted_register(struct emitter *e, uint32_t ins,
+                                  uint32_t address) {
+    uint8_t amount = get_bits(ins, 11, 7);
+
+    emit_read_register(e, ECX, get_bits(ins, 3, 0), address);
+    switch (get_bits(ins, 6, 5)) {
+      case LSL:
+        if (amount)
+            emit_shift(e, SHL_EXTENSION, ECX, amount);
+        break;
+      case LSR:
+        if (amount)
+            emit_shift(e, SHR_EXTENSION, ECX, amount);
+        else
+            emit_move_immediate(e, ECX, 0);
+        break;
+      case ASR:
+        emit_shift(e, SAR_EXTENSION, ECX, amount ? amount : 31);
+        break;
+      default:
+        emit_shift(e, ROR_EXTENSION, ECX, amount);
+    }
+}
+
+static int is_miscellaneous(uint32_t ins) {
+    return (get_bits(ins, 24, 23) == 2) && !get_bit(ins, 20);
+}
+
+/* Shifts without any effect on the carry out of the shifter */
+static int keeps_carry(uint32_t ins) {
+    if (get_bit(ins, 25))
+        return get_bits(ins, 11, 8) == 0;
+    return (get_bits(ins, 6, 5) == LSL) && (get_bits(ins, 11, 7) == 0);
+}
+
+static int arm_jit_supported(arm_decoded d) {
+    uint32_t ins = d->ins;
+    uint8_t opcode = get_bits(ins, 24, 21), rd = get_bits(ins, 15, 12);
+    int s = get_bit(ins, 20);
+
+    if (d->cond == 0xF)
+        return 0;
+    switch (get_bits(ins, 27, 25)) {
+      case 0:
+        if (get_bit(ins, 4) ||
+            ((get_bits(ins, 6, 5) == ROR) && (get_bits(ins, 11, 7) == 0)))
+            return 0;
+        /* Fall through */
+      case 1:
+        if (is_miscellaneous(ins) || ((opcode >= ADC) && (opcode <= RSC)))
+            return 0;
+        if (s && is_logical(opcode) && !keeps_carry(ins))
+            return 0;
+        /* Only mov pc, rm may write the pc */
+        if ((rd == 15) && !is_test(opcode))
+            return (opcode == MOV) && !s && !get_bit(ins, 25) &&
+                   keeps_carry(ins);
+        return 1;
+      case 3:
+        if (get_bit(ins, 4) || (get_bits(ins, 3, 0) == 15) ||
+            ((get_bits(ins, 6, 5) == ROR) && (get_bits(ins, 11, 7) == 0)))
+            return 0;
+        /* Fall through */
+      case 2:
+        /* No user mode accesses, no load to the pc, no pc write back */
+        if (!get_bit(ins, 24) && get_bit(ins, 21))
+            return 0;
+        if (get_bit(ins, 20) && (rd == 15))
+            return 0;
+        if ((get_bits(ins, 19, 16) == 15) &&
+            (!get_bit(ins, 24) || get_bit(ins, 21)))
+            return 0;
+        return 1;
+      case 5:
+        return 1;
+      default:
+        return 0;
+    }
+}
+
+static void translate_data_processing(struct emitter *e, arm_decoded d,
+                                      int *kind) {
+    uint32_t ins = d->ins;
+    uint8_t opcode = get_bits(ins, 24, 21), rd = get_bits(ins, 15, 12);
+    int s = get_bit(ins, 20), new_kind = FLAGS_NONE;
+
+    /* Logical operations keep C and V, which must be computed first */
+    if (s && is_logical(opcode)) {
+        if (*kind != FLAGS_NONE)
+            emit_call(e, arm_jit_materialize_flags);
+        new_kind = FLAGS_LOGICAL;
+    }
+    if (get_bit(ins, 25))
+        emit_move_immediate(e, ECX, d->imm);
+    else
+        emit_shifted_register(e, ins, d->address);
+    if ((opcode != MOV) && (opcode != MVN))
+        emit_read_register(e, EAX, get_bits(ins, 19, 16), d->address);
+    switch (opcode) {
+      case AND:
+      case TST:
+        emit_alu(e, AND_OPCODE, EAX, ECX);
+        break;
+      case EOR:
+      case TEQ:
+        emit_alu(e, XOR_OPCODE, EAX, ECX);
+        break;
+      case SUB:
+      case CMP:
+        if (s) {
+            emit_write(e, OFFSET(flags_a), EAX);
+            emit_write(e, OFFSET(flags_b), ECX);
+            new_kind = FLAGS_SUB;
+        }
+        emit_alu(e, SUB_OPCODE, EAX, ECX);
+        break;
+      case RSB:
+        if (s) {
+            emit_write(e, OFFSET(flags_a), ECX);
+            emit_write(e, OFFSET(flags_b), EAX);
+            new_kind = FLAGS_SUB;
+        }
+        emit_alu(e, SUB_OPCODE, ECX, EAX);
+        emit_alu(e, MOV_OPCODE, EAX, ECX);
+        break;
+      case ADD:
+      case CMN:
+        if (s) {
+            emit_write(e, OFFSET(flags_a), EAX);
+            emit_write(e, OFFSET(flags_b), ECX);
+            new_kind = FLAGS_ADD;
+        }
+        emit_alu(e, ADD_OPCODE, EAX, ECX);
+        break;
+      case MOV:
+        emit_alu(e, MOV_OPCODE, EAX, ECX);
+        break;
+      case BIC:
+        emit_not(e, ECX);
+        emit_alu(e, AND_OPCODE, EAX, ECX);
+        break;
+      case MVN:
+        emit_not(e, ECX);
+        emit_alu(e, MOV_OPCODE, EAX, ECX);
+        break;
+      default:
+        emit_alu(e, OR_OPCODE, EAX, ECX);
+    }
+    if (s) {
+        emit_write(e, OFFSET(flags_result), EAX);
+        emit_write_immediate(e, OFFSET(flags_kind), new_kind);
+        *kind = (d->cond == 0xE) ? new_kind : FLAGS_UNKNOWN;
+    }
+    if (!is_test(opcode))
+        emit_write(e, REG(rd), EAX);
+}
+
+/* LDR, LDRB, STR, STRB, the abort and code_written checks leave the
+ * translated code after the instruction, which counts as the index-th one.
+ */
+static void translate_load_store(struct emitter *e, arm_decoded d,
+                                 int index) {
+    uint32_t ins = d->ins;
+    uint8_t rn = get_bits(ins, 19, 16), rd = get_bits(ins, 15, 12);
+    int write_back = !get_bit(ins, 24) || get_bit(ins, 21);
+    uint8_t *ok;
+
+    emit_read_register(e, EAX, rn, d->address);
+    if (get_bit(ins, 25))
+        emit_shifted_register(e, ins, d->address);
+    else
+        emit_move_immediate(e, ECX, get_bits(ins, 11, 0));
+    /* edx = base +/- offset */
+    emit_alu(e, MOV_OPCODE, EDX, EAX);
+    emit_alu(e, get_bit(ins, 23) ? ADD_OPCODE : SUB_OPCODE, EDX, ECX);
+    if (write_back)
+        emit_write(e, OFFSET(write_back), EDX);
+    emit_alu(e, MOV_OPCODE, ESI, get_bit(ins, 24) ? EDX : EAX);
+    if (get_bit(ins, 20)) {
+        emit_call(e, get_bit(ins, 22) ? (void *) arm_jit_load_byte :
+                                        (void *) arm_jit_load_word);
+        /* bt rax, 32 */
+        emit_byte(e, 0x48);
+        emit_byte(e, 0x0F);
+        emit_byte(e, 0xBA);
+        emit_byte(e, 0xE0);
+        emit_byte(e, 32);
+        ok = emit_jump_if(e, CC_AE);
+        emit_exit(e, d->address + 4, index, DATA_ABORT);
+        patch_jump(e, ok);
+        if (write_back) {
+            emit_read(e, ECX, OFFSET(write_back));
+            emit_write(e, REG(rn), ECX);
+        }
+        emit_write(e, REG(rd), EAX);
+    } else {
+        emit_read_register(e, EDX, rd, d->address);
+        emit_call(e, get_bit(ins, 22) ? (void *) arm_jit_store_byte :
+                                        (void *) arm_jit_store_word);
+        emit_alu(e, TEST_OPCODE, EAX, EAX);
+        ok = emit_jump_if(e, CC_E);
+        emit_exit(e, d->address + 4, index, DATA_ABORT);
+        patch_jump(e, ok);
+        if (write_back) {
+            emit_read(e, ECX, OFFSET(write_back));
+            emit_write(e, REG(rn), ECX);
+        }
+        /* cmp byte [rbx + code_written], 0 */
+        emit_load(e, 0x80, 7, OFFSET(code_written));
+        emit_byte(e, 0);
+        ok = emit_jump_if(e, CC_E);
+        emit_exit(e, d->address + 4, index, 0);
+        patch_jump(e, ok);
+    }
+}
+
+/* Translates the instructions starting at address up to the end of the basic
+ * block or to the first unsupported instruction. Returns the number of
+ * instructions translated.
+ */
+static int arm_jit_translate(arm_jit jit, uint32_t address,
+                             arm_jit_code *code) {
+    struct emitter e;
+    arm_decoded d;
+    uint8_t *skip;
+    int size, kind, end, is_branch;
+
+    e.position = jit->code_top;
+    e.limit = jit->code + ARM_JIT_CODE_SIZE;
+    /* push rbx; mov rbx, rdi */
+    emit_byte(&e, 0x53);
+    emit_byte(&e, 0x48);
+    emit_byte(&e, 0x89);
+    emit_byte(&e, 0xFB);
+    kind = FLAGS_UNKNOWN;
+    end = 0;
+    for (size=0; !end && (size < ARM_JIT_MAX_SIZE); size++) {
+        d = arm_decode_at(jit->p, address + 4*size);
+        if ((d == NULL) || !arm_jit_supported(d))
+            break;
+        is_branch = get_bits(d->ins, 27, 25) == 5;
+        end = is_branch || (get_bits(d->ins, 15, 12) == 15) ||
+              ((address + 4*(size+1)) % MEMORY_PAGE_SIZE == 0);
+        skip = NULL;
+        if (d->cond != 0xE)
+            skip = emit_condition(&e, d->cond, kind);
+        if (is_branch) {
+            if (get_bit(d->ins, 24))
+                emit_write_immediate(&e, REG(14), d->address + 4);
+            emit_exit(&e, d->imm, size + 1, 0);
+        } else if (get_bits(d->ins, 27, 26) == 1) {
+            translate_load_store(&e, d, size + 1);
+        } else if (get_bits(d->ins, 15, 12) == 15 &&
+                   !is_test(get_bits(d->ins, 24, 21))) {
+            /* mov pc, rm */
+            emit_read_register(&e, EAX, get_bits(d->ins, 3, 0), d->address);
+            emit_write(&e, REG(15), EAX);
+            emit_load(&e, 0x81, 0, OFFSET(executed));
+            emit_word(&e, size + 1);
+            emit_move_immediate(&e, EAX, 0);
+            emit_byte(&e, 0x5B);
+            emit_byte(&e, 0xC3);
+        } else {
+            translate_data_processing(&e, d, &kind);
+        }
+        if (skip)
+            patch_jump(&e, skip);
+    }
+    if (size == 0)
+        return 0;
+    /* Unreachable after an unconditional branch, harmless */
+    emit_exit(&e, address + 4*size, size, 0);
+    if (e.position > e.limit)
+        return 0;
+    *code = (arm_jit_code) jit->code_top;
+    jit->code_top = e.position;
+    return size;
+}
+
+arm_jit arm_jit_create(arm_core p) {
+    arm_jit jit;
+
+    jit = calloc(1, sizeof(struct arm_jit_data));
+    if (jit) {
+        jit->code = mmap(NULL, ARM_JIT_CODE_SIZE,
+                         PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (jit->code == MAP_FAILED) {
+            free(jit);
+            return NULL;
+        }
+        jit->code_top = jit->code;
+        jit->p = p;
+        jit->state.mem = arm_get_memory(p);
+    }
+    return jit;
+}
+
+void arm_jit_destroy(arm_jit jit) {
+    arm_jit_flush(jit);
+    munmap(jit->code, ARM_JIT_CODE_SIZE);
+    free(jit);
+}
+
+static void arm_jit_free_list(arm_jit_translation t) {
+    arm_jit_translation next;
+
+    while (t) {
+        next = t->next;
+        free(t);
+        t = next;
+    }
+}
+
+void arm_jit_flush(arm_jit jit) {
+    int i;
+
+    for (i=0; i<ARM_JIT_HASH_SIZE; i++) {
+        arm_jit_free_list(jit->table[i]);
+        jit->table[i] = NULL;
+    }
+    arm_jit_free_list(jit->dead);
+    jit->dead = NULL;
+    jit->dead_count = 0;
+    jit->code_top = jit->code;
+    jit->statistics.flushes++;
+}
+
+/* Translations never cross a page boundary. Their code is only reclaimed by
+ * the next flush, as one of them might be running.
+ */
+void arm_jit_invalidate(arm_jit jit, uint32_t page_address) {
+    arm_jit_translation *t, dead;
+    int i;
+
+    for (i=0; i<ARM_JIT_HASH_SIZE; i++) {
+        t = &jit->table[i];
+        while (*t) {
+            if ((*t)->address - page_address < MEMORY_PAGE_SIZE) {
+                dead = *t;
+                *t = dead->next;
+                dead->next = jit->dead;
+                jit->dead = dead;
+                jit->dead_count++;
+                jit->statistics.invalidations++;
+            } else {
+                t = &(*t)->next;
+            }
+        }
+    }
+    jit->state.code_written = 1;
+}
+
+static arm_jit_translation arm_jit_lookup(arm_jit jit, uint32_t address) {
+    arm_jit_translation t;
+
+    for (t = jit->table[ARM_JIT_HASH(address)]; t; t = t->next)
+        if (t->address == address)
+            return t;
+    return NULL;
+}
+
+static arm_jit_translation arm_jit_add(arm_jit jit, uint32_t address) {
+    arm_jit_translation t;
+
+    if (jit->code + ARM_JIT_CODE_SIZE - jit->code_top <
+        ARM_JIT_MAX_TRANSLATION)
+        return NULL;
+    t = malloc(sizeof(struct arm_jit_translation));
+    if (t == NULL)
+        return NULL;
+    t->address = address;
+    t->code = NULL;
+    t->size = arm_jit_translate(jit, address, &t->code);
+    if (t->size) {
+        jit->statistics.translations++;
+        jit->statistics.translated_instructions += t->size;
+    } else {
+        t->code = NULL;
+        jit->statistics.untranslatable++;
+    }
+    t->next = jit->table[ARM_JIT_HASH(address)];
+    jit->table[ARM_JIT_HASH(address)] = t;
+    return t;
+}
+
+static int arm_jit_is_breakpoint(arm_core p, uint32_t address) {
+    arm_decoded d;
+
+    if (arm_in_thumb_state(p))
+        return arm_is_at_breakpoint(p);
+    d = arm_decode_at(p, address);
+
+    return d && ((d->ins & BreakpointMask) == BreakpointPattern);
+}
+
+int arm_jit_step(arm_core p, uint32_t budget) {
+    arm_jit jit = arm_get_jit(p);
+    struct arm_jit_state *s;
+    arm_jit_translation t;
+    uint32_t pc, cycles, executed;
+    int loaded, result;
+
+    if ((jit == NULL) || trace_has(MEMORY | REGISTERS | STATE))
+        return arm_block_step(p, budget);
+    if ((jit->dead_count > ARM_JIT_MAX_DEAD) ||
+        (jit->code + ARM_JIT_CODE_SIZE - jit->code_top <
+         ARM_JIT_MAX_TRANSLATION))
+        arm_jit_flush(jit);
+    s = &jit->state;
+    loaded = 0;
+    executed = 0;
+    while (executed + (loaded ? s->executed : 0) < budget) {
+        pc = loaded ? s->r[15] : arm_get_fetch_address(p);
+        /* Translated code never switches to Thumb state, whose code is left
+         * to the interpreter, as well as data accesses of the other
+         * endianess and virtual addresses translated by the MMU
+         */
+        if (!loaded &&
+            (arm_in_thumb_state(p) || !arm_in_memory_endianess(p) ||
+             arm_translates_addresses(p))) {
+            t = NULL;
+        } else {
+            t = arm_jit_lookup(jit, pc);
+            if ((t == NULL) &&
+                (++jit->hotness[ARM_JIT_HASH(pc)] >= ARM_JIT_THRESHOLD)) {
+                jit->hotness[ARM_JIT_HASH(pc)] = 0;
+                t = arm_jit_add(jit, pc);
+            }
+        }
+        if (t && t->code) {
+            if (!loaded) {
+                arm_get_context(p, s->r, &s->cpsr);
+                s->flags_kind = FLAGS_NONE;
+                s->executed = 0;
+                loaded = 1;
+            }
+            s->code_written = 0;
+            result = t->code(s);
+            jit->statistics.native_runs++;
+            if (result) {
+                arm_jit_materialize_flags(s);
+                arm_set_context(p, s->r, s->cpsr, s->executed);
+                arm_exception(p, result);
+                return result;
+            }
+            continue;
+        }
+        if (loaded) {
+            arm_jit_materialize_flags(s);
+            arm_set_context(p, s->r, s->cpsr, s->executed);
+            executed += s->executed;
+            loaded = 0;
+        }
+        /* As the block engine, we stop before breakpoints unless they are
+         * the first instruction to execute
+         */
+        if (executed && arm_jit_is_breakpoint(p, pc))
+            return 0;
+        cycles = arm_get_cycle_count(p);
+        result = arm_block_step(p, 1);
+        jit->statistics.interpreted_runs++;
+        if (result || (arm_get_cycle_count(p) == cycles))
+            return result;
+        executed += arm_get_cycle_count(p) - cycles;
+    }
+    if (loaded) {
+        arm_jit_materialize_flags(s);
+        arm_set_context(p, s->r, s->cpsr, s->executed);
+    }
+    return 0;
+}
+
+void arm_jit_print_statistics(arm_jit jit, FILE *out) {
+    struct arm_jit_statistics *st = &jit->statistics;
+
+    fprintf(out, "Translation cache statistics:\n"
+            "  translated blocks:         %lu\n"
+            "  translated instructions:   %lu\n"
+            "  untranslatable blocks:     %lu\n"
+            "  native executions:         %lu\n"
+            "  interpreted executions:    %lu\n"
+            "  invalidated translations:  %lu\n"
+            "  flushes:                   %lu\n"
+            "  code buffer used:          %lu / %d bytes\n",
+            st->translations, st->translated_instructions, st->untranslatable,
+            st->native_runs, st->interpreted_runs, st->invalidations,
+            st->flushes, (unsigned long) (jit->code_top - jit->code),
+            ARM_JIT_CODE_SIZE);
+}
+
+#else
+
+arm_jit arm_jit_create(arm_core p) {
+    return NULL;
+}
+
+void arm_jit_destroy(arm_jit jit) {
+}
+
+void arm_jit_invalidate(arm_jit jit, uint32_t page_address) {
+}
+
+void arm_jit_flush(arm_jit jit) {
+}
+
+void arm_jit_print_statistics(arm_jit jit, FILE *out) {
+}
+
+int arm_jit_step(arm_core p, uint32_t budget) {
+    return arm_block_step(p, budget);
+}
+
+#endif
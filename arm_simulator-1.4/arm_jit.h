@@ -0,0 +1,48 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#ifndef __ARM_JIT_H__
+#define __ARM_JIT_H__
+#include <stdint.h>
+#include <stdio.h>
+#include "arm_core.h"
+
+/* Dynamic translation of hot basic blocks to x86-64 code. Translated code
+ * works on a copy of the registers of the current mode and keeps the
+ * condition flags lazily, as the operands and result of the last flag setting
+ * operation. Blocks are only translated up to their first unsupported
+ * instruction, anything not translated runs in the block engine.
+ * On other hosts, arm_jit_create returns NULL.
+ */
+arm_jit arm_jit_create(arm_core p);
+void arm_jit_destroy(arm_jit jit);
+void arm_jit_invalidate(arm_jit jit, uint32_t page_address);
+void arm_jit_flush(arm_jit jit);
+void arm_jit_print_statistics(arm_jit jit, FILE *out);
+
+/* Same as arm_block_step, but runs translated code whenever possible. Falls
+ * back to arm_block_step when the JIT is not enabled for p (see arm_set_jit)
+ * or when registers, memory or state are traced.
+ */
+int arm_jit_step(arm_core p, uint32_t budget);
+
+#endif
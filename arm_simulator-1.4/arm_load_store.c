@@ -21,20 +21,339 @@ Contact: Guillaume.Huard@imag.fr
 	 38401 Saint Martin d'Hres
 */
 #include "arm_load_store.h"
+#include "arm_decode.h"
+#include "arm_core_fast.h"
 #include "arm_exception.h"
 #include "arm_constants.h"
 #include "util.h"
 #include "debug.h"
 
+/* Addressing mode bits shared by all the load and store instructions */
+#define P 24
+#define U 23
+#define B 22
+#define W 21
+#define L 20
+#define S 22
+
+/* Kinds of offset, stored in the shift_imm field of decoded instructions */
+#define IMMEDIATE_OFFSET 0
+#define REGISTER_OFFSET  1
+#define SCALED_OFFSET    2
+
+/* Kinds of extra load/store, stored in the opcode field (bits 6 and 5) */
+#define SWAP            0
+#define HALF            1
+#define SIGNED_BYTE     2
+#define SIGNED_HALF     3
+
+/* Loads to the pc switch to Thumb state on bit 0 set (ARM manual A4-44) */
+static void load_pc(arm_core p, uint32_t value) {
+    arm_write_pc_exchange(p, value);
+}
+
+/* Return from exception by LDM with the S bit (ARM manual A4-40), the state
+ * is the one restored from the SPSR, so bit 0 of value is not used for it
+ */
+static void load_pc_restore(arm_core p, uint32_t value) {
+    if (arm_current_mode_has_spsr(p))
+        arm_write_cpsr(p, arm_read_spsr(p));
+    if (arm_in_thumb_state(p))
+        arm_write_register(p, 15, value & 0xFFFFFFFE);
+    else
+        arm_write_register(p, 15, value & 0xFFFFFFFC);
+}
+
+static uint32_t offset(arm_core p, arm_decoded d) {
+    uint32_t value;
+
+    switch (d->shift_imm) {
+      case IMMEDIATE_OFFSET:
+        return d->imm;
+      case REGISTER_OFFSET:
+        return arm_fast_read_register(p, d->rm);
+      default:
+        value = arm_fast_read_register(p, d->rm);
+        switch (d->shift) {
+          case LSL:
+            return value << d->imm;
+          case LSR:
+            return d->imm ? value >> d->imm : 0;
+          case ASR:
+            if (d->imm)
+                return asr(value, d->imm);
+            return get_bit(value, 31) ? 0xFFFFFFFF : 0;
+          default:
+            if (d->imm)
+                return ror(value, d->imm);
+            return ((uint32_t) get_bit(arm_fast_read_cpsr(p), C) << 31) |
+                   (value >> 1);
+        }
+    }
+}
+
+/* Computes the address of the access according to P and U and the value of
+ * the base register after the access (ARM manual A5-18 and A5-33)
+ */
+static uint32_t address(arm_core p, arm_decoded d, uint32_t *base) {
+    uint32_t result;
+
+    *base = arm_fast_read_register(p, d->rn);
+    if (get_bit(d->ins, U))
+        result = *base + offset(p, d);
+    else
+        result = *base - offset(p, d);
+    if (get_bit(d->ins, P)) {
+        if (get_bit(d->ins, W))
+            *base = result;
+        return result;
+    } else {
+        uint32_t access = *base;
+        *base = result;
+        return access;
+    }
+}
+
+/* Writes back the base register if needed, the value loaded has precedence
+ * when the base is also the destination
+ */
+static void write_back(arm_core p, arm_decoded d, uint32_t base) {
+    if (!get_bit(d->ins, P) || get_bit(d->ins, W))
+        arm_fast_write_register(p, d->rn, base);
+}
+
+/* LDR, LDRB, STR, STRB (ARM manual A4-43 and following). Unaligned word loads
+ * are rotated (ARM manual A4-44).
+ */
+
+static int load_store(arm_core p, arm_decoded d) {
+    uint32_t target, base, word;
+    uint8_t byte;
+
+    target = address(p, d, &base);
+    if (get_bit(d->ins, L)) {
+        if (get_bit(d->ins, B)) {
+            if (arm_fast_read_byte(p, target, &byte))
+                return DATA_ABORT;
+            word = byte;
+        } else {
+            if (arm_fast_read_word(p, target & 0xFFFFFFFC, &word))
+                return DATA_ABORT;
+            if (target & 3)
+                word = ror(word, 8*(target & 3));
+        }
+        write_back(p, d, base);
+        if (d->rd == 15)
+            load_pc(p, word);
+        else
+            arm_fast_write_register(p, d->rd, word);
+    } else {
+        word = arm_fast_read_register(p, d->rd);
+        if (get_bit(d->ins, B)) {
+            if (arm_fast_write_byte(p, target, word))
+                return DATA_ABORT;
+        } else {
+            if (arm_fast_write_word(p, target & 0xFFFFFFFC, word))
+                return DATA_ABORT;
+        }
+        write_back(p, d, base);
+    }
+    return 0;
+}
+
+/* LDRT, LDRBT, STRT, STRBT (ARM manual A4-48 and following), accesses with the
+ * permissions of the user mode
+ */
+static int load_store_user(arm_core p, arm_decoded d) {
+    int result;
+
+    p->user_access = 1;
+    result = load_store(p, d);
+    p->user_access = 0;
+    return result;
+}
+
+/* LDRH, LDRSB, LDRSH, STRH (ARM manual A4-54 and following) */
+static int load_store_extra(arm_core p, arm_decoded d) {
+    uint32_t target, base, value;
+    uint16_t half;
+    uint8_t byte;
+
+    target = address(p, d, &base);
+    if (get_bit(d->ins, L)) {
+        switch (d->opcode) {
+          case HALF:
+            if (arm_fast_read_half(p, target & 0xFFFFFFFE, &half))
+                return DATA_ABORT;
+            value = half;
+            break;
+          case SIGNED_BYTE:
+            if (arm_fast_read_byte(p, target, &byte))
+                return DATA_ABORT;
+            value = (int32_t) (int8_t) byte;
+            break;
+          default:
+            if (arm_fast_read_half(p, target & 0xFFFFFFFE, &half))
+                return DATA_ABORT;
+            value = (int32_t) (int16_t) half;
+        }
+        write_back(p, d, base);
+        arm_fast_write_register(p, d->rd, value);
+    } else {
+        if (arm_fast_write_half(p, target & 0xFFFFFFFE,
+                                arm_fast_read_register(p, d->rd)))
+            return DATA_ABORT;
+        write_back(p, d, base);
+    }
+    return 0;
+}
+
+/* SWP, SWPB (ARM manual A4-212) */
+static int swap(arm_core p, arm_decoded d) {
+    uint32_t target, word;
+    uint8_t byte;
+
+    target = arm_fast_read_register(p, d->rn);
+    if (get_bit(d->ins, B)) {
+        if (arm_fast_read_byte(p, target, &byte) ||
+            arm_fast_write_byte(p, target, arm_fast_read_register(p, d->rm)))
+            return DATA_ABORT;
+        word = byte;
+    } else {
+        if (arm_fast_read_word(p, target & 0xFFFFFFFC, &word) ||
+            arm_fast_write_word(p, target & 0xFFFFFFFC,
+                                arm_fast_read_register(p, d->rm)))
+            return DATA_ABORT;
+        if (target & 3)
+            word = ror(word, 8*(target & 3));
+    }
+    arm_fast_write_register(p, d->rd, word);
+    return 0;
+}
+
+/* LDM, STM (ARM manual A4-36, A4-189 and A5-41). With the S bit, user mode
+ * registers are transferred, unless the pc is loaded, in which case the CPSR
+ * is restored from the SPSR. The words are transferred at once, thus no
+ * register is loaded, not even the base written back, and no word is stored
+ * on a data abort.
+ */
+static int load_store_multiple(arm_core p, arm_decoded d) {
+    uint32_t base, start, values[16];
+    int count, reg, user, i;
+
+    count = __builtin_popcount(d->imm);
+    base = arm_fast_read_register(p, d->rn);
+    if (get_bit(d->ins, U))
+        start = base + (get_bit(d->ins, P) ? 4 : 0);
+    else
+        start = base - 4*count + (get_bit(d->ins, P) ? 0 : 4);
+    user = get_bit(d->ins, S) &&
+           !(get_bit(d->ins, L) && get_bit(d->imm, 15));
+    if (get_bit(d->ins, L)) {
+        if (arm_read_words(p, start, values, count))
+            return DATA_ABORT;
+        /* We write back first so that a loaded base has precedence */
+        if (get_bit(d->ins, W))
+            arm_fast_write_register(p, d->rn, get_bit(d->ins, U) ?
+                                              base + 4*count : base - 4*count);
+        i = 0;
+        for (reg=0; reg<16; reg++) {
+            if (get_bit(d->imm, reg)) {
+                if (reg == 15) {
+                    if (get_bit(d->ins, S))
+                        load_pc_restore(p, values[i]);
+                    else
+                        load_pc(p, values[i]);
+                } else if (user) {
+                    arm_write_usr_register(p, reg, values[i]);
+                } else {
+                    arm_fast_write_register(p, reg, values[i]);
+                }
+                i++;
+            }
+        }
+    } else {
+        i = 0;
+        for (reg=0; reg<16; reg++) {
+            if (get_bit(d->imm, reg)) {
+                if (user)
+                    values[i] = arm_read_usr_register(p, reg);
+                else
+                    values[i] = arm_fast_read_register(p, reg);
+                i++;
+            }
+        }
+        if (arm_write_words(p, start, values, count))
+            return DATA_ABORT;
+        if (get_bit(d->ins, W))
+            arm_fast_write_register(p, d->rn, get_bit(d->ins, U) ?
+                                              base + 4*count : base - 4*count);
+    }
+    return 0;
+}
+
+void arm_load_store_decode(arm_decoded d) {
+    uint32_t ins = d->ins;
+
+    d->rn = get_bits(ins, 19, 16);
+    d->rd = get_bits(ins, 15, 12);
+    d->rm = get_bits(ins, 3, 0);
+    if (get_bits(ins, 27, 25) == 0) {
+        d->opcode = get_bits(ins, 6, 5);
+        if (d->opcode == SWAP) {
+            d->handler = swap;
+            return;
+        }
+        /* Doubleword accesses are ARMv5TE */
+        if (!get_bit(ins, L) && (d->opcode != HALF)) {
+            d->handler = arm_undefined;
+            return;
+        }
+        if (get_bit(ins, B)) {
+            d->shift_imm = IMMEDIATE_OFFSET;
+            d->imm = (get_bits(ins, 11, 8) << 4) | get_bits(ins, 3, 0);
+        } else {
+            d->shift_imm = REGISTER_OFFSET;
+        }
+        d->handler = load_store_extra;
+        return;
+    }
+    if (get_bit(ins, 25)) {
+        d->shift = get_bits(ins, 6, 5);
+        d->imm = get_bits(ins, 11, 7);
+        if ((d->shift == LSL) && (d->imm == 0))
+            d->shift_imm = REGISTER_OFFSET;
+        else
+            d->shift_imm = SCALED_OFFSET;
+    } else {
+        d->shift_imm = IMMEDIATE_OFFSET;
+        d->imm = get_bits(ins, 11, 0);
+    }
+    if (!get_bit(ins, P) && get_bit(ins, W))
+        d->handler = load_store_user;
+    else
+        d->handler = load_store;
+}
+
+void arm_load_store_multiple_decode(arm_decoded d) {
+    d->rn = get_bits(d->ins, 19, 16);
+    d->imm = get_bits(d->ins, 15, 0);
+    d->handler = load_store_multiple;
+}
+
+void arm_coprocessor_load_store_decode(arm_decoded d) {
+    /* Not implemented */
+    d->handler = arm_undefined;
+}
+
 int arm_load_store(arm_core p, uint32_t ins) {
-    return UNDEFINED_INSTRUCTION;
+    return arm_decode_and_execute(p, ins, arm_load_store_decode);
 }
 
 int arm_load_store_multiple(arm_core p, uint32_t ins) {
-    return UNDEFINED_INSTRUCTION;
+    return arm_decode_and_execute(p, ins, arm_load_store_multiple_decode);
 }
 
 int arm_coprocessor_load_store(arm_core p, uint32_t ins) {
-    /* Not implemented */
-    return UNDEFINED_INSTRUCTION;
+    return arm_decode_and_execute(p, ins, arm_coprocessor_load_store_decode);
 }
@@ -29,4 +29,8 @@ int arm_load_store(arm_core p, uint32_t ins);
 int arm_load_store_multiple(arm_core p, uint32_t ins);
 int arm_coprocessor_load_store(arm_core p, uint32_t ins);
 
+void arm_load_store_decode(arm_decoded d);
+void arm_load_store_multiple_decode(arm_decoded d);
+void arm_coprocessor_load_store_decode(arm_decoded d);
+
 #endif
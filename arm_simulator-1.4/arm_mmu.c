@@ -0,0 +1,350 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include "arm_mmu.h"
+#include "util.h"
+#include <stdlib.h>
+
+/* Main ID of an ARM processor of architecture ARMv5T, with no particular part
+ * number in the ARM9 family, and cache type of a processor without cache
+ */
+#define ARM_MMU_ID         0x41049000
+#define ARM_MMU_CACHE_TYPE 0x00000000
+
+/* Bits of the control register (ARM manual B2-13), bits 4 to 6 read as one */
+#define ARM_MMU_M 0x0001
+#define ARM_MMU_B 0x0080
+#define ARM_MMU_S 0x0100
+#define ARM_MMU_R 0x0200
+#define ARM_MMU_V 0x2000
+#define ARM_MMU_CONTROL_ONES     0x0070
+#define ARM_MMU_CONTROL_WRITABLE 0x7B0F
+
+/* Fault status (ARM manual B4-20) */
+#define ARM_MMU_TRANSLATION_FIRST  0xC
+#define ARM_MMU_TRANSLATION_SECOND 0xE
+#define ARM_MMU_SECTION_TRANSLATION 0x5
+#define ARM_MMU_PAGE_TRANSLATION    0x7
+#define ARM_MMU_SECTION_DOMAIN      0x9
+#define ARM_MMU_PAGE_DOMAIN         0xB
+#define ARM_MMU_SECTION_PERMISSION  0xD
+#define ARM_MMU_PAGE_PERMISSION     0xF
+
+/* Accesses allowed by a translation, a bit per ARM_MMU_READ/WRITE/USER
+ * combination
+ */
+#define ARM_MMU_ALLOWED(access) (1 << ((access) & 3))
+#define ARM_MMU_PRIVILEGED_READ_ONLY ARM_MMU_ALLOWED(ARM_MMU_READ)
+#define ARM_MMU_PRIVILEGED (ARM_MMU_ALLOWED(ARM_MMU_READ) | \
+                            ARM_MMU_ALLOWED(ARM_MMU_WRITE))
+#define ARM_MMU_READ_ONLY (ARM_MMU_ALLOWED(ARM_MMU_READ) | \
+                           ARM_MMU_ALLOWED(ARM_MMU_USER | ARM_MMU_READ))
+#define ARM_MMU_USER_READ_ONLY (ARM_MMU_PRIVILEGED | \
+                                ARM_MMU_ALLOWED(ARM_MMU_USER | ARM_MMU_READ))
+#define ARM_MMU_ALL 0xF
+
+/* The TLB holds translations of 4 KB pages, the ones of tiny pages and of
+ * small pages whose subpages have different permissions are not kept
+ */
+#define ARM_MMU_PAGE_BITS 12
+#define ARM_MMU_TLB_SIZE 256
+#define ARM_MMU_NO_PAGE 0xFFFFFFFF
+
+struct arm_mmu_tlb_entry {
+    uint32_t page;
+    uint32_t physical;
+    uint8_t allowed;
+};
+
+struct arm_mmu_data {
+    struct arm_mmu_tlb_entry tlb[ARM_MMU_TLB_SIZE];
+    memory mem;
+    uint32_t control;
+    uint32_t translation_table;
+    uint32_t domain_access;
+    uint32_t fault_status;
+    uint32_t fault_address;
+    uint32_t process_id;
+};
+
+static void arm_mmu_flush(arm_mmu mmu) {
+    int i;
+
+    for (i=0; i<ARM_MMU_TLB_SIZE; i++)
+        mmu->tlb[i].page = ARM_MMU_NO_PAGE;
+}
+
+arm_mmu arm_mmu_create(memory mem) {
+    arm_mmu mmu;
+
+    mmu = calloc(1, sizeof(struct arm_mmu_data));
+    if (mmu) {
+        mmu->mem = mem;
+        /* The B bit gives the endianess of the memory, which is fixed */
+        mmu->control = ARM_MMU_CONTROL_ONES |
+                       (memory_is_big_endian(mem) ? ARM_MMU_B : 0);
+        arm_mmu_flush(mmu);
+    }
+    return mmu;
+}
+
+void arm_mmu_destroy(arm_mmu mmu) {
+    free(mmu);
+}
+
+int arm_mmu_is_enabled(arm_mmu mmu) {
+    return (mmu->control & ARM_MMU_M) != 0;
+}
+
+int arm_mmu_high_vectors(arm_mmu mmu) {
+    return (mmu->control & ARM_MMU_V) != 0;
+}
+
+/* Access permissions of client domains (ARM manual B4-9) */
+static uint8_t arm_mmu_allowed(arm_mmu mmu, uint32_t permissions) {
+    switch (permissions) {
+      case 0:
+        switch (mmu->control & (ARM_MMU_S | ARM_MMU_R)) {
+          case ARM_MMU_S:
+            return ARM_MMU_PRIVILEGED_READ_ONLY;
+          case ARM_MMU_R:
+            return ARM_MMU_READ_ONLY;
+          default:
+            return 0;
+        }
+      case 1:
+        return ARM_MMU_PRIVILEGED;
+      case 2:
+        return ARM_MMU_USER_READ_ONLY;
+      default:
+        return ARM_MMU_ALL;
+    }
+}
+
+/* Faults of instruction fetches are only reported by the prefetch abort */
+static int arm_mmu_fault(arm_mmu mmu, uint32_t address, int access,
+                         uint8_t status, uint8_t domain) {
+    if (!(access & ARM_MMU_FETCH)) {
+        mmu->fault_status = (domain << 4) | status;
+        mmu->fault_address = address;
+    }
+    return -1;
+}
+
+/* Translation table walk (ARM manual B3-8 and following), the descriptors are
+ * read with the endianess of the memory
+ */
+static int arm_mmu_walk(arm_mmu mmu, uint32_t address, int access,
+                        uint32_t *physical) {
+    struct arm_mmu_tlb_entry *entry;
+    uint32_t descriptor, table, base, permissions, size;
+    uint8_t domain, allowed;
+    int section, fine, cacheable;
+
+    if (memory_fetch_word(mmu->mem, (mmu->translation_table & 0xFFFFC000) |
+                                    ((address >> 20) << 2), &descriptor))
+        return arm_mmu_fault(mmu, address, access, ARM_MMU_TRANSLATION_FIRST,
+                             0);
+    domain = get_bits(descriptor, 8, 5);
+    section = 1;
+    fine = 0;
+    cacheable = 1;
+    switch (descriptor & 3) {
+      case 0:
+        return arm_mmu_fault(mmu, address, access,
+                             ARM_MMU_SECTION_TRANSLATION, 0);
+      case 2:
+        base = descriptor & 0xFFF00000;
+        size = 1 << 20;
+        permissions = get_bits(descriptor, 11, 10);
+        break;
+      default:
+        section = 0;
+        fine = (descriptor & 3) == 3;
+        /* Coarse tables have 256 entries, fine ones 1024 */
+        if (!fine)
+            table = (descriptor & 0xFFFFFC00) |
+                    (get_bits(address, 19, 12) << 2);
+        else
+            table = (descriptor & 0xFFFFF000) |
+                    (get_bits(address, 19, 10) << 2);
+        if (memory_fetch_word(mmu->mem, table, &descriptor))
+            return arm_mmu_fault(mmu, address, access,
+                                 ARM_MMU_TRANSLATION_SECOND, domain);
+        switch (descriptor & 3) {
+          case 1:
+            base = descriptor & 0xFFFF0000;
+            size = 1 << 16;
+            permissions = (descriptor >> (4 + 2*get_bits(address, 15, 14))) &
+                          3;
+            break;
+          case 2:
+            base = descriptor & 0xFFFFF000;
+            size = 1 << 12;
+            permissions = (descriptor >> (4 + 2*get_bits(address, 11, 10))) &
+                          3;
+            cacheable = get_bits(descriptor, 11, 4) == 0x55 * permissions;
+            break;
+          case 3:
+            /* Tiny pages only exist in fine tables */
+            if (!fine)
+                return arm_mmu_fault(mmu, address, access,
+                                     ARM_MMU_PAGE_TRANSLATION, domain);
+            base = descriptor & 0xFFFFFC00;
+            size = 1 << 10;
+            permissions = get_bits(descriptor, 5, 4);
+            cacheable = 0;
+            break;
+          default:
+            return arm_mmu_fault(mmu, address, access,
+                                 ARM_MMU_PAGE_TRANSLATION, domain);
+        }
+    }
+    switch ((mmu->domain_access >> (2*domain)) & 3) {
+      case 1:
+        allowed = arm_mmu_allowed(mmu, permissions);
+        break;
+      case 3:
+        allowed = ARM_MMU_ALL;
+        break;
+      default:
+        return arm_mmu_fault(mmu, address, access, section ?
+                             ARM_MMU_SECTION_DOMAIN : ARM_MMU_PAGE_DOMAIN,
+                             domain);
+    }
+    if (!(allowed & ARM_MMU_ALLOWED(access)))
+        return arm_mmu_fault(mmu, address, access, section ?
+                             ARM_MMU_SECTION_PERMISSION :
+                             ARM_MMU_PAGE_PERMISSION, domain);
+    *physical = base | (address & (size - 1));
+    if (cacheable) {
+        entry = &mmu->tlb[(address >> ARM_MMU_PAGE_BITS) % ARM_MMU_TLB_SIZE];
+        entry->page = address >> ARM_MMU_PAGE_BITS;
+        entry->physical = *physical & ~((1 << ARM_MMU_PAGE_BITS) - 1);
+        entry->allowed = allowed;
+    }
+    return 0;
+}
+
+/* Virtual addresses of the first 32 MB are relocated by the FCSE process ID
+ * (ARM manual B8-3) before being looked up in the TLB. Accesses not allowed
+ * by the TLB entry walk the tables, to find which fault they raise.
+ */
+int arm_mmu_translate(arm_mmu mmu, uint32_t address, int access,
+                      uint32_t *physical) {
+    struct arm_mmu_tlb_entry *entry;
+    uint32_t page;
+
+    if (address < 0x02000000)
+        address |= mmu->process_id;
+    page = address >> ARM_MMU_PAGE_BITS;
+    entry = &mmu->tlb[page % ARM_MMU_TLB_SIZE];
+    if ((entry->page == page) && (entry->allowed & ARM_MMU_ALLOWED(access))) {
+        *physical = entry->physical |
+                    (address & ((1 << ARM_MMU_PAGE_BITS) - 1));
+        return 0;
+    }
+    return arm_mmu_walk(mmu, address, access, physical);
+}
+
+/* Registers not implemented read as zero, c7 and c8 only hold operations */
+int arm_mmu_read_register(arm_mmu mmu, uint8_t crn, uint8_t crm,
+                          uint8_t opcode_2, uint32_t *value) {
+    switch (crn) {
+      case 0:
+        *value = (opcode_2 == 1) ? ARM_MMU_CACHE_TYPE : ARM_MMU_ID;
+        break;
+      case 1:
+        *value = mmu->control;
+        break;
+      case 2:
+        *value = mmu->translation_table;
+        break;
+      case 3:
+        *value = mmu->domain_access;
+        break;
+      case 5:
+        *value = mmu->fault_status;
+        break;
+      case 6:
+        *value = mmu->fault_address;
+        break;
+      case 7:
+      case 8:
+        return -1;
+      case 13:
+        *value = mmu->process_id;
+        break;
+      default:
+        *value = 0;
+    }
+    return 0;
+}
+
+/* There is no cache, so cache operations (c7) have no effect, neither have
+ * cache and TLB lockdown (c9 and c10). The TLB is unified, so the operations
+ * on the instruction or data TLB apply to it.
+ */
+int arm_mmu_write_register(arm_mmu mmu, uint8_t crn, uint8_t crm,
+                           uint8_t opcode_2, uint32_t value) {
+    uint32_t changed, page;
+
+    switch (crn) {
+      case 1:
+        value = (value & ARM_MMU_CONTROL_WRITABLE) |
+                (mmu->control & ~ARM_MMU_CONTROL_WRITABLE);
+        changed = (value ^ mmu->control) & (ARM_MMU_M | ARM_MMU_S | ARM_MMU_R);
+        mmu->control = value;
+        if (changed == 0)
+            return 0;
+        break;
+      case 2:
+        mmu->translation_table = value & 0xFFFFC000;
+        break;
+      case 3:
+        mmu->domain_access = value;
+        break;
+      case 5:
+        mmu->fault_status = value & 0xFF;
+        return 0;
+      case 6:
+        mmu->fault_address = value;
+        return 0;
+      case 8:
+        if (opcode_2 == 1) {
+            page = value >> ARM_MMU_PAGE_BITS;
+            if (mmu->tlb[page % ARM_MMU_TLB_SIZE].page == page)
+                mmu->tlb[page % ARM_MMU_TLB_SIZE].page = ARM_MMU_NO_PAGE;
+            return ARM_MMU_REMAPPED;
+        }
+        break;
+      case 13:
+        mmu->process_id = value & 0xFE000000;
+        return ARM_MMU_REMAPPED;
+      case 0:
+        return -1;
+      default:
+        return 0;
+    }
+    arm_mmu_flush(mmu);
+    return ARM_MMU_REMAPPED;
+}
@@ -0,0 +1,68 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#ifndef __ARM_MMU_H__
+#define __ARM_MMU_H__
+#include <stdint.h>
+#include "memory.h"
+
+typedef struct arm_mmu_data *arm_mmu;
+
+/* System control coprocessor (CP15) and memory management unit of ARMv5
+ * (ARM manual B3 and B4): sections and coarse or fine page tables, with large,
+ * small and tiny pages, domains and access permissions. Translations are kept
+ * in a direct mapped TLB of 4 KB pages, flushed by the CP15 TLB operations and
+ * by writes to the registers they depend on. Until the MMU is enabled by the
+ * M bit of the control register, addresses are not translated.
+ */
+arm_mmu arm_mmu_create(memory mem);
+void arm_mmu_destroy(arm_mmu mmu);
+int arm_mmu_is_enabled(arm_mmu mmu);
+/* V bit of the control register, exception vectors at 0xFFFF0000 */
+int arm_mmu_high_vectors(arm_mmu mmu);
+
+/* Kinds of accesses, a read or a write with or without user permissions. For
+ * instruction fetches, which read, faults are not recorded in the FSR and FAR.
+ */
+#define ARM_MMU_READ  0
+#define ARM_MMU_WRITE 1
+#define ARM_MMU_USER  2
+#define ARM_MMU_FETCH 4
+
+/* Translates the virtual address of an access into a physical one. The return
+ * value indicates a success (0) or a fault (-1), recorded for data accesses.
+ */
+int arm_mmu_translate(arm_mmu mmu, uint32_t address, int access,
+                      uint32_t *physical);
+
+/* MRC and MCR accesses to the CP15 register crn, with the given crm and
+ * opcode_2 (ARM manual B2-18 and B4-39). The return value is -1 if the register
+ * cannot be accessed this way, ARM_MMU_REMAPPED if the write changed the
+ * translation of virtual addresses or 0.
+ */
+#define ARM_MMU_REMAPPED 1
+int arm_mmu_read_register(arm_mmu mmu, uint8_t crn, uint8_t crm,
+                          uint8_t opcode_2, uint32_t *value);
+int arm_mmu_write_register(arm_mmu mmu, uint8_t crn, uint8_t crm,
+                           uint8_t opcode_2, uint32_t value);
+
+#endif
@@ -26,7 +26,11 @@ Contact: Guillaume.Huard@imag.fr
 #include "csapp.h"
 #include "scanner.h"
 #include "arm.h"
+#include "arm_block.h"
+#include "arm_jit.h"
+#include "arm_aot.h"
 #include "memory.h"
+#include "loader.h"
 #include "gdb_protocol.h"
 #include "trace.h"
 #include "debug.h"
@@ -38,6 +42,9 @@ struct shared_data {
     in_port_t gdb_port, irq_port;
 };
 
+/* Number of instructions run each time the lock is taken in headless mode */
+#define HEADLESS_BUDGET 65536
+
 struct server_data {
     int socket;
     unsigned short port;
@@ -99,8 +106,9 @@ static void *irq_listener(void *arg) {
         connection = Accept(server.socket, (struct sockaddr *) &peer,
                             &peer_length);
         while (Read(connection, &irq, 1) > 0) {
+            arm_post_interrupt(shared->arm, irq);
             pthread_mutex_lock(&shared->lock);
-            arm_exception(shared->arm, irq);
+            arm_take_interrupt(shared->arm);
             pthread_mutex_unlock(&shared->lock);
         }
         shutdown(connection, SHUT_RDWR);
@@ -110,11 +118,102 @@ static void *irq_listener(void *arg) {
     pthread_exit(NULL);
 }
 
+/* Runs the program until it ends with swi 0x123456, without gdb */
+static void run_headless(struct shared_data *shared) {
+    int reason, exception;
+
+    while (1) {
+        pthread_mutex_lock(&shared->lock);
+        reason = arm_run(shared->arm, HEADLESS_BUDGET, &exception);
+        /* Without gdb, breakpoints are mere undefined instructions */
+        if (reason == ARM_STOP_BREAKPOINT) {
+            arm_step(shared->arm);
+            trace_arm_state(shared->arm);
+        }
+        pthread_mutex_unlock(&shared->lock);
+        if (reason == ARM_STOP_HALT)
+            exit(0);
+    }
+}
+
+/* The simulated program may end the simulator with exit */
+static arm_jit statistics_jit;
+
+static void print_jit_statistics() {
+    arm_jit_print_statistics(statistics_jit, stderr);
+}
+
+static arm_block_cache statistics_block_cache;
+
+static void print_block_statistics() {
+    arm_block_print_statistics(statistics_block_cache, stderr);
+}
+
+static memory statistics_memory;
+
+static void print_memory_statistics() {
+    memory_print_statistics(statistics_memory, stderr);
+}
+
+/* Memory regions given on the command line, as address:size where the size
+ * can be followed by K or M
+ */
+#define MAX_REGIONS 16
+
+struct region {
+    uint32_t address;
+    size_t size;
+};
+
+static int parse_region(char *text, struct region *region) {
+    char *end;
+
+    region->address = strtoul(text, &end, 0);
+    if (*end != ':')
+        return -1;
+    region->size = strtoull(end + 1, &end, 0);
+    switch (*end) {
+      case 'K':
+        region->size <<= 10;
+        end++;
+        break;
+      case 'M':
+        region->size <<= 20;
+        end++;
+        break;
+    }
+    return (*end != 0) || (region->size == 0);
+}
+
+/* Files mapped as memory, given as address:file */
+struct image {
+    uint32_t address;
+    char *path;
+    int shared;
+};
+
+static int parse_image(char *text, int shared, struct image *image) {
+    char *end;
+
+    image->address = strtoul(text, &end, 0);
+    if ((*end != ':') || (end[1] == 0))
+        return -1;
+    image->path = end + 1;
+    image->shared = shared;
+    return 0;
+}
+
 void usage(char *name) {
     fprintf(stderr, "Usage:\n"
         "%s [ --help ] [ --gdb-port port ] [ --irq-port port ] "
         "[ --trace-file file ] [ --trace-registers ] [ --trace-memory ] "
-        "[ --trace-state ] [ --trace-position ] [ --debug filename ]\n\n"
+        "[ --trace-state ] [ --trace-position ] [ --debug filename ] "
+        "[ --headless executable ] [ --jit ] [ --jit-statistics ] "
+        "[ --translation object ] [ --block-statistics ] "
+        "[ --memory address:size ] [ --image address:file ] "
+        "[ --shared-image address:file ] [ --huge-pages ] "
+        "[ --memory-statistics ] [ --big-endian ] [ --little-endian ] "
+        "[ --binary-trace ]\n\n"
         "Start an ARMv5 instruction set simulator that acts as a gdb server "
         "and can receive interrupts. It is possible to specify on which ports "
         "the simulator listen to gdb client or irq sending program "
@@ -127,8 +226,41 @@ void usage(char *name) {
         "- trace state: outputs the processor state after each instruction\n"
         "- trace position: for each traced access, outputs the file and line"
         " at which the access has been performed\n"
+        "- binary trace: stores the traces of registers and memory accesses "
+        "as binary records, written by a separate thread, that trace_render "
+        "prints as text afterwards. State and position cannot be traced in "
+        "this mode\n"
         "The debug switch enable selective reporting of debug messages on a "
         "per source file basis\n"
+        "The headless switch loads the given ELF executable and runs it "
+        "without waiting for a gdb connection, until it executes "
+        "swi 0x123456\n"
+        "The jit switch translates frequently executed code to native code "
+        "when the host supports it (x86-64 only), translation is disabled "
+        "while tracing registers, memory or state. The jit statistics switch "
+        "prints statistics about translations when the simulator ends\n"
+        "The translation switch loads a shared object produced by "
+        "arm_translate from the executable, whose translated code is then "
+        "run instead of being interpreted\n"
+        "The block statistics switch prints, when the simulator ends, "
+        "statistics about the interpreted blocks and the superinstructions "
+        "they have been fused into\n"
+        "The memory switch maps a region of the given size (in bytes, or "
+        "followed by K or M) at the given address, it can be repeated. "
+        "Without it, 128K are mapped at address 0. Pages are only allocated "
+        "when first written\n"
+        "The image switch maps the content of a file at the given address, "
+        "aligned on 4K, without copying it: its pages are only read when "
+        "accessed, and writes are not kept. With the shared image switch, "
+        "writes are stored into the file. Both can be repeated\n"
+        "The huge pages switch backs the memory regions of at least 2M with "
+        "host huge pages when available, to spare host TLB misses on large "
+        "memories. The memory statistics switch prints, when the simulator "
+        "ends, whether huge pages have been obtained\n"
+        "The big and little endian switches select the endianess of the "
+        "simulated memory, which also gives the initial value of the E bit of "
+        "the CPSR. By default, it is the one of the headless executable, or "
+        "big endian\n"
         , name);
 }
 
@@ -139,6 +271,16 @@ int main(int argc, char *argv[]) {
     void *result;
     int opt;
     FILE *trace_file;
+    char *headless;
+    uint32_t entry;
+    int jit, jit_statistics, block_statistics;
+    int huge_pages, memory_statistics, binary_trace;
+    char *translation;
+    struct region regions[MAX_REGIONS];
+    int region_count, i;
+    struct image images[MAX_REGIONS];
+    int image_count;
+    int big_endian;
 
     struct option longopts[] = {
         { "gdb-port", required_argument, NULL, 'g' },
@@ -150,13 +292,38 @@ int main(int argc, char *argv[]) {
         { "trace-position", no_argument, NULL, 'p' },
         { "help", no_argument, NULL, 'h' },
         { "debug", required_argument, NULL, 'd' },
+        { "headless", required_argument, NULL, 'x' },
+        { "jit", no_argument, NULL, 'j' },
+        { "jit-statistics", no_argument, NULL, 'J' },
+        { "translation", required_argument, NULL, 'a' },
+        { "block-statistics", no_argument, NULL, 'B' },
+        { "memory", required_argument, NULL, 'M' },
+        { "image", required_argument, NULL, 'I' },
+        { "shared-image", required_argument, NULL, 'S' },
+        { "huge-pages", no_argument, NULL, 'H' },
+        { "memory-statistics", no_argument, NULL, 'T' },
+        { "binary-trace", no_argument, NULL, 'y' },
+        { "big-endian", no_argument, NULL, 'b' },
+        { "little-endian", no_argument, NULL, 'l' },
         { NULL, 0, NULL, 0 }
     };
 
     shared.gdb_port = 0;
     shared.irq_port = 0;
     trace_file = stdout;
-    while ((opt = getopt_long(argc, argv, "g:i:ht:rmspd:", longopts, NULL))
+    headless = NULL;
+    jit = 0;
+    jit_statistics = 0;
+    block_statistics = 0;
+    huge_pages = 0;
+    memory_statistics = 0;
+    binary_trace = 0;
+    translation = NULL;
+    region_count = 0;
+    image_count = 0;
+    big_endian = -1;
+    while ((opt = getopt_long(argc, argv, "g:i:ht:rmspd:x:jJa:BM:I:S:HTbly",
+                              longopts, NULL))
            != -1) {
         switch(opt) {
           case 'g':
@@ -190,6 +357,53 @@ int main(int argc, char *argv[]) {
           case 'd':
             add_debug_to(optarg);
             break;
+          case 'x':
+            headless = optarg;
+            break;
+          case 'j':
+            jit = 1;
+            break;
+          case 'J':
+            jit_statistics = 1;
+            break;
+          case 'a':
+            translation = optarg;
+            break;
+          case 'B':
+            block_statistics = 1;
+            break;
+          case 'M':
+            if (region_count == MAX_REGIONS ||
+                parse_region(optarg, &regions[region_count])) {
+                fprintf(stderr, "Invalid memory region %s\n", optarg);
+                exit(1);
+            }
+            region_count++;
+            break;
+          case 'I':
+          case 'S':
+            if (image_count == MAX_REGIONS ||
+                parse_image(optarg, opt == 'S', &images[image_count])) {
+                fprintf(stderr, "Invalid image %s\n", optarg);
+                exit(1);
+            }
+            image_count++;
+            break;
+          case 'H':
+            huge_pages = 1;
+            break;
+          case 'T':
+            memory_statistics = 1;
+            break;
+          case 'y':
+            binary_trace = 1;
+            break;
+          case 'b':
+            big_endian = 1;
+            break;
+          case 'l':
+            big_endian = 0;
+            break;
           default:
             fprintf(stderr, "Unrecognized option %c\n", opt);
             usage(argv[0]);
@@ -199,15 +413,78 @@ int main(int argc, char *argv[]) {
     gdb_init();
     arm_init();
     set_trace_file(trace_file);
+    if (binary_trace) {
+        if (trace_has(STATE | POSITION)) {
+            fprintf(stderr, "State and position are not traced in binary\n");
+            exit(1);
+        }
+        if (trace_set_binary()) {
+            fprintf(stderr, "Cannot start the binary trace\n");
+            exit(1);
+        }
+    }
 
-#ifdef BIG_ENDIAN_SIMULATOR
-    shared.mem = memory_create(0x20000, 1);
-#else
-    shared.mem = memory_create(0x20000, 0);
-#endif
+    if ((big_endian == -1) && headless)
+        big_endian = elf_is_big_endian(headless);
+    if (big_endian == -1)
+        big_endian = 1;
+    shared.mem = memory_create(region_count ? 0 : 0x20000, big_endian);
+    if (shared.mem == NULL) {
+        fprintf(stderr, "Cannot create the memory\n");
+        exit(1);
+    }
+    memory_set_huge_pages(shared.mem, huge_pages);
+    for (i=0; i<region_count; i++)
+        if (memory_map(shared.mem, regions[i].address, regions[i].size)) {
+            fprintf(stderr, "Cannot map the memory region at %08X\n",
+                    regions[i].address);
+            exit(1);
+        }
+    for (i=0; i<image_count; i++)
+        if (memory_map_file(shared.mem, images[i].address, images[i].path,
+                            images[i].shared)) {
+            fprintf(stderr, "Cannot map the image %s at %08X\n",
+                    images[i].path, images[i].address);
+            exit(1);
+        }
+    if (memory_statistics) {
+        statistics_memory = shared.mem;
+        atexit(print_memory_statistics);
+    }
     shared.arm = arm_create(shared.mem);
+    if (block_statistics) {
+        statistics_block_cache = arm_get_block_cache(shared.arm);
+        atexit(print_block_statistics);
+    }
+    if (jit) {
+        arm_set_jit(shared.arm, arm_jit_create(shared.arm));
+        if (arm_get_jit(shared.arm) == NULL)
+            fprintf(stderr, "Native translation not available, "
+                            "interpreting\n");
+        else if (jit_statistics) {
+            statistics_jit = arm_get_jit(shared.arm);
+            atexit(print_jit_statistics);
+        }
+    }
+    if (translation) {
+        arm_set_aot(shared.arm, arm_aot_load(shared.arm, translation));
+        if (arm_get_aot(shared.arm) == NULL) {
+            fprintf(stderr, "Cannot load translation %s\n", translation);
+            exit(1);
+        }
+    }
 
     pthread_mutex_init(&shared.lock, NULL);
+    if (headless) {
+        if (load_elf(shared.mem, big_endian, headless, &entry)) {
+            fprintf(stderr, "Cannot load executable %s\n", headless);
+            exit(1);
+        }
+        /* Bit 0 of the entry point is set for Thumb code */
+        arm_write_pc_exchange(shared.arm, entry);
+        pthread_create(&irq_thread, NULL, irq_listener, &shared);
+        run_headless(&shared);
+    }
     pthread_create(&gdb_thread, NULL, gdb_listener, &shared);
     pthread_create(&irq_thread, NULL, irq_listener, &shared);
     pthread_join(gdb_thread, &result);
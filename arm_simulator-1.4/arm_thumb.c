@@ -0,0 +1,472 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include "arm_thumb.h"
+#include "arm_decode.h"
+#include "arm_core_fast.h"
+#include "arm_instruction.h"
+#include "arm_constants.h"
+#include "util.h"
+
+/* Most Thumb instructions are translated at decode time into their ARM
+ * equivalent and executed by the ARM handlers, which read the pc as Thumb
+ * instructions do when the core is in Thumb state (see arm_read_register).
+ * The others, branches, pc relative instructions and writes to the pc, have
+ * handlers of their own.
+ */
+#define ARM_ALWAYS     0xE0000000
+
+/* Data processing opcodes (ARM manual A4-3) */
+#define AND 0x0
+#define EOR 0x1
+#define SUB 0x2
+#define RSB 0x3
+#define ADD 0x4
+#define ADC 0x5
+#define SBC 0x6
+#define TST 0x8
+#define CMP 0xA
+#define CMN 0xB
+#define ORR 0xC
+#define MOV 0xD
+#define BIC 0xE
+#define MVN 0xF
+
+/* Shifter operands of ARM data processing instructions */
+#define IMMEDIATE (1 << 25)
+/* Immediates multiplied by 4 are rotated right by 30 */
+#define IMMEDIATE_TIMES_4 (IMMEDIATE | (15 << 8))
+#define SHIFT_BY_IMMEDIATE(rm, shift, amount) \
+    (((amount) << 7) | ((shift) << 5) | (rm))
+#define SHIFT_BY_REGISTER(rm, shift, rs) \
+    (((rs) << 8) | ((shift) << 5) | (1 << 4) | (rm))
+
+/* Addressing mode bits of ARM loads and stores */
+#define P (1 << 24)
+#define U (1 << 23)
+#define W (1 << 21)
+#define L (1 << 20)
+
+static struct arm_decoded_instruction thumb_table[65536];
+
+static uint32_t data_processing(uint8_t opcode, int s, uint8_t rn, uint8_t rd,
+                                uint32_t operand) {
+    return ARM_ALWAYS | (opcode << 21) | (s << 20) | (rn << 16) | (rd << 12) |
+           operand;
+}
+
+/* Thumb instruction address + 2, with bit 0 set as in the link register */
+static uint32_t return_address(arm_core p) {
+    return (arm_fast_read_register(p, 15) - 2) | 1;
+}
+
+/* B, unconditional or not (ARM manual A7-19), the condition is checked by the
+ * caller as for ARM instructions
+ */
+static int branch(arm_core p, arm_decoded d) {
+    arm_fast_write_register(p, 15, arm_fast_read_register(p, 15) + d->imm);
+    return 0;
+}
+
+/* BL, BLX immediate (ARM manual A7-26), made of two instructions: the first
+ * one stores the high part of the offset in the link register
+ */
+static int branch_link_prefix(arm_core p, arm_decoded d) {
+    arm_fast_write_register(p, 14, arm_fast_read_register(p, 15) + d->imm);
+    return 0;
+}
+
+static int branch_link(arm_core p, arm_decoded d) {
+    uint32_t target = arm_fast_read_register(p, 14) + d->imm;
+
+    arm_fast_write_register(p, 14, return_address(p));
+    arm_fast_write_register(p, 15, target);
+    return 0;
+}
+
+/* The target of BLX is an ARM instruction */
+static int branch_link_exchange(arm_core p, arm_decoded d) {
+    uint32_t target = (arm_fast_read_register(p, 14) + d->imm) & 0xFFFFFFFC;
+
+    arm_fast_write_register(p, 14, return_address(p));
+    arm_write_pc_exchange(p, target);
+    return 0;
+}
+
+/* BX, BLX register (ARM manual A7-32 and A7-30) */
+static int branch_exchange(arm_core p, arm_decoded d) {
+    uint32_t target = arm_fast_read_register(p, d->rm);
+
+    if (d->opcode)
+        arm_fast_write_register(p, 14, return_address(p));
+    arm_write_pc_exchange(p, target);
+    return 0;
+}
+
+/* ADD and MOV of high registers with the pc as destination, bit 0 of the
+ * result is ignored (ARM manual A7-6 and A7-74)
+ */
+static int write_pc(arm_core p, arm_decoded d) {
+    uint32_t value = arm_fast_read_register(p, d->rm);
+
+    if (d->opcode == ADD)
+        value += arm_fast_read_register(p, 15);
+    arm_fast_write_register(p, 15, value & 0xFFFFFFFE);
+    return 0;
+}
+
+/* LDR (3) and ADD (5), relative to the pc aligned on a word (ARM manual A7-57
+ * and A7-8)
+ */
+static int load_literal(arm_core p, arm_decoded d) {
+    uint32_t base = arm_fast_read_register(p, 15) & 0xFFFFFFFC;
+    uint32_t value;
+
+    if (arm_fast_read_word(p, base + d->imm, &value))
+        return DATA_ABORT;
+    arm_fast_write_register(p, d->rd, value);
+    return 0;
+}
+
+static int add_pc(arm_core p, arm_decoded d) {
+    uint32_t base = arm_fast_read_register(p, 15) & 0xFFFFFFFC;
+
+    arm_fast_write_register(p, d->rd, base + d->imm);
+    return 0;
+}
+
+static int software_interrupt(arm_core p, arm_decoded d) {
+    return SOFTWARE_INTERRUPT;
+}
+
+/* BKPT (ARM manual A7-24), as in ARM state */
+static int breakpoint(arm_core p, arm_decoded d) {
+    return PREFETCH_ABORT;
+}
+
+/* Shift by immediate, add and subtract (ARM manual A6-8) */
+static void shift_add_subtract_decode(arm_decoded d, uint16_t ins) {
+    uint8_t rd = get_bits(ins, 2, 0), rn = get_bits(ins, 5, 3);
+    uint32_t operand;
+
+    if (get_bits(ins, 12, 11) != 3) {
+        d->ins = data_processing(MOV, 1, 0, rd,
+                                 SHIFT_BY_IMMEDIATE(rn, get_bits(ins, 12, 11),
+                                                    get_bits(ins, 10, 6)));
+    } else {
+        if (get_bit(ins, 10))
+            operand = IMMEDIATE | get_bits(ins, 8, 6);
+        else
+            operand = get_bits(ins, 8, 6);
+        d->ins = data_processing(get_bit(ins, 9) ? SUB : ADD, 1, rn, rd,
+                                 operand);
+    }
+    arm_decode_instruction(d);
+}
+
+/* MOV, CMP, ADD and SUB with an 8 bits immediate */
+static void immediate_decode(arm_decoded d, uint16_t ins) {
+    static uint8_t opcodes[4] = { MOV, CMP, ADD, SUB };
+    uint8_t opcode = opcodes[get_bits(ins, 12, 11)], rd = get_bits(ins, 10, 8);
+    uint32_t operand = IMMEDIATE | get_bits(ins, 7, 0);
+
+    if (opcode == MOV)
+        d->ins = data_processing(MOV, 1, 0, rd, operand);
+    else if (opcode == CMP)
+        d->ins = data_processing(CMP, 1, rd, 0, operand);
+    else
+        d->ins = data_processing(opcode, 1, rd, rd, operand);
+    arm_decode_instruction(d);
+}
+
+/* Data processing on low registers, in the order of their Thumb opcodes */
+static void data_processing_register_decode(arm_decoded d, uint16_t ins) {
+    uint8_t rd = get_bits(ins, 2, 0), rm = get_bits(ins, 5, 3);
+
+    switch (get_bits(ins, 9, 6)) {
+      case 0x0:
+        d->ins = data_processing(AND, 1, rd, rd, rm);
+        break;
+      case 0x1:
+        d->ins = data_processing(EOR, 1, rd, rd, rm);
+        break;
+      case 0x2:
+        d->ins = data_processing(MOV, 1, 0, rd, SHIFT_BY_REGISTER(rd, LSL, rm));
+        break;
+      case 0x3:
+        d->ins = data_processing(MOV, 1, 0, rd, SHIFT_BY_REGISTER(rd, LSR, rm));
+        break;
+      case 0x4:
+        d->ins = data_processing(MOV, 1, 0, rd, SHIFT_BY_REGISTER(rd, ASR, rm));
+        break;
+      case 0x5:
+        d->ins = data_processing(ADC, 1, rd, rd, rm);
+        break;
+      case 0x6:
+        d->ins = data_processing(SBC, 1, rd, rd, rm);
+        break;
+      case 0x7:
+        d->ins = data_processing(MOV, 1, 0, rd, SHIFT_BY_REGISTER(rd, ROR, rm));
+        break;
+      case 0x8:
+        d->ins = data_processing(TST, 1, rd, 0, rm);
+        break;
+      case 0x9:
+        /* NEG */
+        d->ins = data_processing(RSB, 1, rm, rd, IMMEDIATE);
+        break;
+      case 0xA:
+        d->ins = data_processing(CMP, 1, rd, 0, rm);
+        break;
+      case 0xB:
+        d->ins = data_processing(CMN, 1, rd, 0, rm);
+        break;
+      case 0xC:
+        d->ins = data_processing(ORR, 1, rd, rd, rm);
+        break;
+      case 0xD:
+        /* MULS Rd, Rm, Rd */
+        d->ins = ARM_ALWAYS | (1 << 20) | (rd << 16) | (rd << 8) | 0x90 | rm;
+        break;
+      case 0xE:
+        d->ins = data_processing(BIC, 1, rd, rd, rm);
+        break;
+      default:
+        d->ins = data_processing(MVN, 1, 0, rd, rm);
+    }
+    arm_decode_instruction(d);
+}
+
+/* ADD, CMP and MOV on high registers, BX and BLX */
+static void high_register_decode(arm_decoded d, uint16_t ins) {
+    uint8_t rd = (get_bit(ins, 7) << 3) | get_bits(ins, 2, 0);
+    uint8_t rm = get_bits(ins, 6, 3);
+
+    switch (get_bits(ins, 9, 8)) {
+      case 0:
+        d->ins = data_processing(ADD, 0, rd, rd, rm);
+        break;
+      case 1:
+        d->ins = data_processing(CMP, 1, rd, 0, rm);
+        break;
+      case 2:
+        d->ins = data_processing(MOV, 0, 0, rd, rm);
+        break;
+      default:
+        /* BLX when H1 is set */
+        d->opcode = get_bit(ins, 7);
+        d->rm = rm;
+        d->handler = branch_exchange;
+        return;
+    }
+    arm_decode_instruction(d);
+    if ((rd == 15) && (d->opcode != CMP))
+        d->handler = write_pc;
+}
+
+/* Loads and stores with a register offset */
+static void load_store_register_decode(arm_decoded d, uint16_t ins) {
+    static uint32_t extra[4] = { 0xB0, L | 0xD0, L | 0xB0, L | 0xF0 };
+    uint32_t registers = (get_bits(ins, 5, 3) << 16) |
+                         (get_bits(ins, 2, 0) << 12) | get_bits(ins, 8, 6);
+
+    if (get_bit(ins, 9))
+        /* STRH, LDRSB, LDRH, LDRSH */
+        d->ins = ARM_ALWAYS | P | U | extra[get_bits(ins, 11, 10)] | registers;
+    else
+        /* STR, STRB, LDR, LDRB */
+        d->ins = ARM_ALWAYS | (3 << 25) | P | U | (get_bit(ins, 11) ? L : 0) |
+                 (get_bit(ins, 10) << 22) | registers;
+    arm_decode_instruction(d);
+}
+
+/* Loads and stores with an immediate offset, scaled by the size of the access
+ * but for bytes
+ */
+static void load_store_immediate_decode(arm_decoded d, uint16_t ins) {
+    uint32_t registers = (get_bits(ins, 5, 3) << 16) |
+                         (get_bits(ins, 2, 0) << 12);
+    uint32_t offset = get_bits(ins, 10, 6);
+
+    if (get_bits(ins, 15, 13) == 3) {
+        /* STR, LDR, STRB, LDRB */
+        if (!get_bit(ins, 12))
+            offset *= 4;
+        d->ins = ARM_ALWAYS | (2 << 25) | P | U | (get_bit(ins, 12) << 22) |
+                 (get_bit(ins, 11) ? L : 0) | registers | offset;
+    } else {
+        /* STRH, LDRH */
+        offset *= 2;
+        d->ins = ARM_ALWAYS | P | U | (1 << 22) | (get_bit(ins, 11) ? L : 0) |
+                 registers | ((offset >> 4) << 8) | 0xB0 | (offset & 0xF);
+    }
+    arm_decode_instruction(d);
+}
+
+/* Adjust of the stack pointer, PUSH, POP and BKPT */
+static void miscellaneous_decode(arm_decoded d, uint16_t ins) {
+    uint32_t list = get_bits(ins, 7, 0);
+
+    switch (get_bits(ins, 11, 8)) {
+      case 0x0:
+        d->ins = data_processing(get_bit(ins, 7) ? SUB : ADD, 0, 13, 13,
+                                 IMMEDIATE_TIMES_4 | get_bits(ins, 6, 0));
+        break;
+      case 0x4:
+      case 0x5:
+        /* STMDB sp!, with lr */
+        d->ins = ARM_ALWAYS | (4 << 25) | P | W | (13 << 16) |
+                 (get_bit(ins, 8) << 14) | list;
+        break;
+      case 0xC:
+      case 0xD:
+        /* LDMIA sp!, with pc */
+        d->ins = ARM_ALWAYS | (4 << 25) | U | W | L | (13 << 16) |
+                 (get_bit(ins, 8) << 15) | list;
+        break;
+      case 0xE:
+        d->handler = breakpoint;
+        return;
+      default:
+        d->handler = arm_undefined;
+        return;
+    }
+    arm_decode_instruction(d);
+}
+
+/* Conditional branches, SWI and undefined instructions */
+static void conditional_branch_decode(arm_decoded d, uint16_t ins) {
+    d->cond = get_bits(ins, 11, 8);
+    if (d->cond == 0xF) {
+        d->cond = 0xE;
+        d->handler = software_interrupt;
+    } else if (d->cond == 0xE) {
+        d->handler = arm_undefined;
+    } else {
+        d->imm = (int32_t) ((uint32_t) ins << 24) >> 23;
+        d->handler = branch;
+    }
+}
+
+/* B, BLX and BL, with an 11 bits offset */
+static void branch_decode(arm_decoded d, uint16_t ins) {
+    uint32_t offset = get_bits(ins, 10, 0);
+
+    switch (get_bits(ins, 12, 11)) {
+      case 0:
+        d->imm = (int32_t) (offset << 21) >> 20;
+        d->handler = branch;
+        break;
+      case 1:
+        d->imm = offset << 1;
+        d->handler = get_bit(ins, 0) ? arm_undefined : branch_link_exchange;
+        break;
+      case 2:
+        d->imm = (int32_t) (offset << 21) >> 9;
+        d->handler = branch_link_prefix;
+        break;
+      default:
+        d->imm = offset << 1;
+        d->handler = branch_link;
+    }
+}
+
+/* Instruction classes (ARM manual A6-2), selected by bits 15 to 13 and 12 to
+ * 10 for some of them
+ */
+void arm_thumb_decode(arm_decoded d) {
+    uint16_t ins = d->ins;
+
+    d->cond = 0xE;
+    switch (get_bits(ins, 15, 13)) {
+      case 0:
+        shift_add_subtract_decode(d, ins);
+        break;
+      case 1:
+        immediate_decode(d, ins);
+        break;
+      case 2:
+        if (get_bits(ins, 12, 10) == 0) {
+            data_processing_register_decode(d, ins);
+        } else if (get_bits(ins, 12, 10) == 1) {
+            high_register_decode(d, ins);
+        } else if (get_bit(ins, 12) == 0) {
+            d->rd = get_bits(ins, 10, 8);
+            d->imm = get_bits(ins, 7, 0) * 4;
+            d->handler = load_literal;
+        } else {
+            load_store_register_decode(d, ins);
+        }
+        break;
+      case 3:
+        load_store_immediate_decode(d, ins);
+        break;
+      case 4:
+        if (get_bit(ins, 12) == 0) {
+            load_store_immediate_decode(d, ins);
+        } else {
+            /* STR, LDR relative to sp */
+            d->ins = ARM_ALWAYS | (2 << 25) | P | U |
+                     (get_bit(ins, 11) ? L : 0) | (13 << 16) |
+                     (get_bits(ins, 10, 8) << 12) | (get_bits(ins, 7, 0) * 4);
+            arm_decode_instruction(d);
+        }
+        break;
+      case 5:
+        if (get_bit(ins, 12)) {
+            miscellaneous_decode(d, ins);
+        } else if (get_bit(ins, 11)) {
+            /* ADD relative to sp */
+            d->ins = data_processing(ADD, 0, 13, get_bits(ins, 10, 8),
+                                     IMMEDIATE_TIMES_4 | get_bits(ins, 7, 0));
+            arm_decode_instruction(d);
+        } else {
+            d->rd = get_bits(ins, 10, 8);
+            d->imm = get_bits(ins, 7, 0) * 4;
+            d->handler = add_pc;
+        }
+        break;
+      case 6:
+        if (get_bit(ins, 12)) {
+            conditional_branch_decode(d, ins);
+        } else {
+            /* LDMIA, STMIA */
+            d->ins = ARM_ALWAYS | (4 << 25) | U | W |
+                     (get_bit(ins, 11) ? L : 0) | (get_bits(ins, 10, 8) << 16) |
+                     get_bits(ins, 7, 0);
+            arm_decode_instruction(d);
+        }
+        break;
+      default:
+        branch_decode(d, ins);
+    }
+}
+
+arm_decoded arm_thumb_predecoded(uint16_t ins) {
+    arm_decoded d = &thumb_table[ins];
+
+    if (d->handler == NULL) {
+        d->ins = ins;
+        arm_thumb_decode(d);
+    }
+    return d;
+}
@@ -0,0 +1,36 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#ifndef __ARM_THUMB_H__
+#define __ARM_THUMB_H__
+#include <stdint.h>
+#include "arm_core.h"
+
+/* Thumb instructions (ARM manual chapter A7) do not depend on their address
+ * once decoded, so they are predecoded once for all in a table holding an
+ * entry for each of the 65536 halfwords, filled on first use. There is no
+ * invalidation to perform on code writes.
+ */
+arm_decoded arm_thumb_predecoded(uint16_t ins);
+void arm_thumb_decode(arm_decoded d);
+
+#endif
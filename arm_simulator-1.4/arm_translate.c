@@ -0,0 +1,611 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "arm_aot_abi.h"
+#include "loader.h"
+#include "util.h"
+
+/* Ahead of time translation of the .text section of an ARM executable into C,
+ * compiled as a shared object that arm_simulator loads with --translation.
+ * Each instruction gets a label in a single function, so that direct branches
+ * are plain gotos and indirect ones go through a switch on the target.
+ * Instructions that are not translated, mostly system ones, leave the
+ * translated code so that the simulator interprets them.
+ */
+
+#ifndef ARM_AOT_INCLUDE_DIR
+#define ARM_AOT_INCLUDE_DIR "."
+#endif
+
+#define COMMAND_SIZE 4096
+
+/* Endianess of the executable, given by its ELF header */
+static int target_big_endian;
+
+/* Bits of load and store instructions */
+#define P 24
+#define U 23
+#define B 22
+#define W 21
+#define L 20
+
+#define is_test(opcode) (((opcode) >= 0x8) && ((opcode) <= 0xB))
+
+static uint32_t text_start, text_end;
+
+/* Expression giving the value of a register read by the instruction at
+ * address
+ */
+static char *reg(char *buffer, uint8_t n, uint32_t address) {
+    if (n == 15)
+        sprintf(buffer, "0x%08xu", address + 8);
+    else
+        sprintf(buffer, "s->r[%d]", n);
+    return buffer;
+}
+
+static int in_text(uint32_t address) {
+    return (address >= text_start) && (address < text_end) &&
+           !(address & 3);
+}
+
+static void translate_jump(FILE *out, uint32_t target) {
+    if (in_text(target))
+        fprintf(out, "        ARM_AOT_JUMP(0x%08xu, L_%08x);\n", target,
+                target);
+    else
+        fprintf(out, "        ARM_AOT_JUMP_INDIRECT(0x%08xu);\n", target);
+}
+
+/* Data processing (ARM manual A4 and A5-2) */
+static int translate_data_processing(FILE *out, uint32_t address,
+                                     uint32_t ins) {
+    uint8_t opcode = get_bits(ins, 24, 21), rd = get_bits(ins, 15, 12);
+    int s = get_bit(ins, 20);
+    uint32_t immediate;
+    char a[16], b[16];
+
+    if (s && (rd == 15) && !is_test(opcode))
+        return -1;
+    fprintf(out, "        int c = arm_aot_bit(s->cpsr, C);\n"
+                 "        uint32_t b, result;\n\n");
+    if (get_bit(ins, 25)) {
+        immediate = ror(get_bits(ins, 7, 0), 2*get_bits(ins, 11, 8));
+        fprintf(out, "        b = 0x%08xu;\n", immediate);
+        if (get_bits(ins, 11, 8))
+            fprintf(out, "        c = %d;\n", get_bit(immediate, 31));
+    } else if (get_bit(ins, 4)) {
+        fprintf(out, "        b = arm_aot_shift_register(%s, %d, "
+                     "%s & 0xFF, &c);\n",
+                reg(b, get_bits(ins, 3, 0), address), get_bits(ins, 6, 5),
+                reg(a, get_bits(ins, 11, 8), address));
+    } else {
+        fprintf(out, "        b = arm_aot_shift_immediate(%s, %d, %d, &c);\n",
+                reg(b, get_bits(ins, 3, 0), address), get_bits(ins, 6, 5),
+                get_bits(ins, 11, 7));
+    }
+    if ((opcode == 0xD) || (opcode == 0xF))
+        strcpy(a, "0");
+    else
+        reg(a, get_bits(ins, 19, 16), address);
+    fprintf(out, "        result = arm_aot_data_processing(&s->cpsr, %d, %s, "
+                 "b, c, %d);\n", opcode, a, s);
+    if (is_test(opcode))
+        fprintf(out, "        (void) result;\n");
+    else if (rd == 15)
+        fprintf(out, "        ARM_AOT_JUMP_INDIRECT(result);\n");
+    else
+        fprintf(out, "        s->r[%d] = result;\n", rd);
+    return 0;
+}
+
+/* Multiply and multiply long, as in the interpreter */
+static int translate_multiply(FILE *out, uint32_t address, uint32_t ins) {
+    uint8_t opcode = get_bits(ins, 23, 21);
+    uint8_t high = get_bits(ins, 19, 16), low = get_bits(ins, 15, 12);
+    uint8_t rs = get_bits(ins, 11, 8), rm = get_bits(ins, 3, 0);
+
+    if (((opcode & 6) == 2) || (high == 15) || ((opcode & 4) && low == 15))
+        return -1;
+    if (opcode & 4) {
+        fprintf(out, "        uint64_t result;\n\n");
+        if (opcode & 2)
+            fprintf(out, "        result = (int64_t) (int32_t) s->r[%d] * "
+                         "(int32_t) s->r[%d];\n", rm, rs);
+        else
+            fprintf(out, "        result = (uint64_t) s->r[%d] * s->r[%d];\n",
+                    rm, rs);
+        if (opcode & 1)
+            fprintf(out, "        result += ((uint64_t) s->r[%d] << 32) | "
+                         "s->r[%d];\n", high, low);
+        fprintf(out, "        s->r[%d] = result;\n"
+                     "        s->r[%d] = result >> 32;\n", low, high);
+    } else {
+        fprintf(out, "        uint64_t result;\n\n"
+                     "        result = (uint64_t) (uint32_t) (s->r[%d] * "
+                     "s->r[%d]", rm, rs);
+        if (opcode & 1)
+            fprintf(out, " + s->r[%d]", low);
+        fprintf(out, ") << 32;\n"
+                     "        s->r[%d] = result >> 32;\n", high);
+    }
+    if (get_bit(ins, 20))
+        fprintf(out, "        s->cpsr = (s->cpsr & 0x3FFFFFFF) | "
+                     "(((uint32_t) (result >> 63)) << N) |\n"
+                     "                  ((result == 0) << Z);\n");
+    return 0;
+}
+
+/* Address computation and write back of single loads and stores, offset is
+ * an expression
+ */
+static void translate_address(FILE *out, uint32_t address, uint32_t ins,
+                              char *offset) {
+    char base[16];
+
+    fprintf(out, "        uint32_t base = %s;\n"
+                 "        uint32_t address = base %c %s;\n",
+            reg(base, get_bits(ins, 19, 16), address),
+            get_bit(ins, U) ? '+' : '-', offset);
+}
+
+static char *access_address(uint32_t ins) {
+    return get_bit(ins, P) ? "address" : "base";
+}
+
+static void translate_write_back(FILE *out, uint32_t ins) {
+    if (!get_bit(ins, P) || get_bit(ins, W))
+        fprintf(out, "        s->r[%d] = address;\n", get_bits(ins, 19, 16));
+}
+
+static void translate_code_written(FILE *out, uint32_t address) {
+    fprintf(out, "        if (s->code_written)\n"
+                 "            ARM_AOT_EXIT(0x%08xu);\n", address + 4);
+}
+
+/* LDR, LDRB, STR, STRB */
+static int translate_load_store(FILE *out, uint32_t address, uint32_t ins) {
+    uint8_t rn = get_bits(ins, 19, 16), rd = get_bits(ins, 15, 12);
+    char offset[80], value[16];
+
+    if ((get_bits(ins, 27, 25) == 3) &&
+        (get_bit(ins, 4) || (get_bits(ins, 3, 0) == 15)))
+        return -1;
+    if ((rn == 15) && (!get_bit(ins, P) || get_bit(ins, W)))
+        return -1;
+    if (get_bits(ins, 27, 25) == 3)
+        sprintf(offset, "arm_aot_shift_immediate(s->r[%d], %d, %d, &c)",
+                get_bits(ins, 3, 0), get_bits(ins, 6, 5),
+                get_bits(ins, 11, 7));
+    else
+        sprintf(offset, "0x%xu", get_bits(ins, 11, 0));
+    fprintf(out, "        int c = arm_aot_bit(s->cpsr, C);\n");
+    translate_address(out, address, ins, offset);
+    if (get_bit(ins, L)) {
+        if (get_bit(ins, B)) {
+            fprintf(out, "        uint8_t value;\n\n"
+                         "        if (s->read_byte(s->mem, %s, &value))\n"
+                         "            ARM_AOT_ABORT(0x%08xu);\n",
+                    access_address(ins), address);
+        } else {
+            fprintf(out, "        uint32_t value;\n\n"
+                         "        if (s->read_word(s->mem, %s & 0xFFFFFFFC, "
+                         "&value))\n"
+                         "            ARM_AOT_ABORT(0x%08xu);\n"
+                         "        value = arm_aot_ror(value, 8*(%s & 3));\n",
+                    access_address(ins), address, access_address(ins));
+        }
+        fprintf(out, "        (void) c;\n");
+        translate_write_back(out, ins);
+        if (rd == 15)
+            fprintf(out, "        ARM_AOT_JUMP_EXCHANGE(value);\n");
+        else
+            fprintf(out, "        s->r[%d] = value;\n", rd);
+    } else {
+        fprintf(out, "\n        (void) c;\n"
+                     "        if (s->write_%s(s->mem, %s%s, %s))\n"
+                     "            ARM_AOT_ABORT(0x%08xu);\n",
+                get_bit(ins, B) ? "byte" : "word", access_address(ins),
+                get_bit(ins, B) ? "" : " & 0xFFFFFFFC",
+                reg(value, rd, address), address);
+        translate_write_back(out, ins);
+        translate_code_written(out, address);
+    }
+    return 0;
+}
+
+/* LDRH, LDRSB, LDRSH, STRH */
+static int translate_load_store_extra(FILE *out, uint32_t address,
+                                      uint32_t ins) {
+    uint8_t rn = get_bits(ins, 19, 16), rd = get_bits(ins, 15, 12);
+    uint8_t kind = get_bits(ins, 6, 5);
+    char offset[16], value[16];
+
+    if ((!get_bit(ins, L) && (kind != 1)) || (rd == 15) ||
+        ((rn == 15) && (!get_bit(ins, P) || get_bit(ins, W))))
+        return -1;
+    if (get_bit(ins, B))
+        sprintf(offset, "0x%xu", (get_bits(ins, 11, 8) << 4) |
+                                 get_bits(ins, 3, 0));
+    else
+        reg(offset, get_bits(ins, 3, 0), address);
+    translate_address(out, address, ins, offset);
+    if (get_bit(ins, L)) {
+        if (kind == 2)
+            fprintf(out, "        uint8_t value;\n\n"
+                         "        if (s->read_byte(s->mem, %s, &value))\n",
+                    access_address(ins));
+        else
+            fprintf(out, "        uint16_t value;\n\n"
+                         "        if (s->read_half(s->mem, %s & 0xFFFFFFFE, "
+                         "&value))\n", access_address(ins));
+        fprintf(out, "            ARM_AOT_ABORT(0x%08xu);\n", address);
+        translate_write_back(out, ins);
+        fprintf(out, "        s->r[%d] = %svalue;\n", rd,
+                (kind == 1) ? "" : (kind == 2) ? "(int32_t) (int8_t) " :
+                                                 "(int32_t) (int16_t) ");
+    } else {
+        fprintf(out, "\n        if (s->write_half(s->mem, %s & 0xFFFFFFFE, "
+                     "%s))\n"
+                     "            ARM_AOT_ABORT(0x%08xu);\n",
+                access_address(ins), reg(value, rd, address), address);
+        translate_write_back(out, ins);
+        translate_code_written(out, address);
+    }
+    return 0;
+}
+
+/* LDM, STM without the S bit. As in the interpreter, the words are
+ * transferred at once, so that nothing is loaded, written back or stored on a
+ * data abort, and the base is written back before the loads.
+ */
+static int translate_load_store_multiple(FILE *out, uint32_t address,
+                                         uint32_t ins) {
+    uint8_t rn = get_bits(ins, 19, 16);
+    uint16_t list = get_bits(ins, 15, 0);
+    int count = __builtin_popcount(list), i, j;
+    char value[16];
+
+    if (get_bit(ins, 22) || (rn == 15) || (list == 0))
+        return -1;
+    fprintf(out, "        uint32_t base = s->r[%d], values[%d];\n\n", rn,
+            count);
+    if (!get_bit(ins, L))
+        for (i=0, j=0; i<16; i++)
+            if (get_bit(list, i))
+                fprintf(out, "        values[%d] = %s;\n", j++,
+                        reg(value, i, address));
+    fprintf(out, "        if (s->%s_words(s->mem, base",
+            get_bit(ins, L) ? "read" : "write");
+    if (get_bit(ins, U) && get_bit(ins, P))
+        fprintf(out, " + 4");
+    else if (!get_bit(ins, U))
+        fprintf(out, " - %d", 4*count - (get_bit(ins, P) ? 0 : 4));
+    fprintf(out, ", values, %d))\n"
+                 "            ARM_AOT_ABORT(0x%08xu);\n", count, address);
+    if (get_bit(ins, W))
+        fprintf(out, "        s->r[%d] = base %c %d;\n", rn,
+                get_bit(ins, U) ? '+' : '-', 4*count);
+    if (get_bit(ins, L)) {
+        for (i=0, j=0; i<15; i++)
+            if (get_bit(list, i))
+                fprintf(out, "        s->r[%d] = values[%d];\n", i, j++);
+        if (get_bit(list, 15))
+            fprintf(out, "        ARM_AOT_JUMP_EXCHANGE(values[%d]);\n",
+                    count - 1);
+    } else {
+        translate_code_written(out, address);
+    }
+    return 0;
+}
+
+static int translate_branch(FILE *out, uint32_t address, uint32_t ins) {
+    uint32_t target;
+
+    target = address + 8 + (asr(get_bits(ins, 23, 0) << 8, 8) << 2);
+    if (get_bit(ins, 24))
+        fprintf(out, "        s->r[14] = 0x%08xu;\n", address + 4);
+    translate_jump(out, target);
+    return 0;
+}
+
+/* BX, BLX, switches to the Thumb state are left to the interpreter */
+static int translate_branch_exchange(FILE *out, uint32_t address,
+                                     uint32_t ins) {
+    char target[16];
+
+    fprintf(out, "        uint32_t target = %s;\n\n",
+            reg(target, get_bits(ins, 3, 0), address));
+    if (get_bit(ins, 5))
+        fprintf(out, "        s->r[14] = 0x%08xu;\n", address + 4);
+    fprintf(out, "        ARM_AOT_JUMP_INDIRECT(target);\n");
+    return 0;
+}
+
+static int translate_count_leading_zeros(FILE *out, uint32_t address,
+                                         uint32_t ins) {
+    char value[16];
+
+    if (get_bits(ins, 15, 12) == 15)
+        return -1;
+    fprintf(out, "        uint32_t value = %s;\n\n"
+                 "        s->r[%d] = value ? __builtin_clz(value) : 32;\n",
+            reg(value, get_bits(ins, 3, 0), address), get_bits(ins, 15, 12));
+    return 0;
+}
+
+static int is_branch_exchange(uint32_t ins) {
+    return (ins & 0x0FFFFFD0) == 0x012FFF10;
+}
+
+/* Emits the semantics of the instruction, returns -1 if it is not
+ * translated
+ */
+static int translate_semantics(FILE *out, uint32_t address, uint32_t ins) {
+    int miscellaneous = (get_bits(ins, 24, 23) == 2) && !get_bit(ins, 20);
+
+    switch (get_bits(ins, 27, 25)) {
+      case 0:
+        if (get_bit(ins, 4) && get_bit(ins, 7)) {
+            if (get_bits(ins, 6, 5))
+                return translate_load_store_extra(out, address, ins);
+            if (get_bits(ins, 24, 23) == 2)
+                return -1;
+            return translate_multiply(out, address, ins);
+        }
+        if (miscellaneous) {
+            if (is_branch_exchange(ins))
+                return translate_branch_exchange(out, address, ins);
+            if ((ins & 0x0FFF0FF0) == 0x016F0F10)
+                return translate_count_leading_zeros(out, address, ins);
+            return -1;
+        }
+        return translate_data_processing(out, address, ins);
+      case 1:
+        if (miscellaneous)
+            return -1;
+        return translate_data_processing(out, address, ins);
+      case 2:
+      case 3:
+        return translate_load_store(out, address, ins);
+      case 4:
+        return translate_load_store_multiple(out, address, ins);
+      case 5:
+        return translate_branch(out, address, ins);
+      default:
+        return -1;
+    }
+}
+
+static int translate_instruction(FILE *out, uint32_t address, uint32_t ins) {
+    uint8_t cond = get_bits(ins, 31, 28);
+    char target[16];
+    int result;
+
+    fprintf(out, "L_%08x:\n", address);
+    if ((address != text_start) && ((address & 0xFFF) == 0))
+        fprintf(out, "    if (ARM_AOT_STALE(0x%08xu))\n"
+                     "        ARM_AOT_EXIT(0x%08xu);\n", address, address);
+    if (cond == 0xF) {
+        fprintf(out, "    ARM_AOT_EXIT(0x%08xu);\n", address);
+        return -1;
+    }
+    /* Switching to Thumb is left to the interpreter */
+    if (is_branch_exchange(ins))
+        fprintf(out, "    if (%s & 1)\n"
+                     "        ARM_AOT_EXIT(0x%08xu);\n",
+                reg(target, get_bits(ins, 3, 0), address), address);
+    fprintf(out, "    s->executed++;\n");
+    if (cond == 0xE)
+        fprintf(out, "    {\n");
+    else
+        fprintf(out, "    if (arm_aot_condition(s->cpsr, %d)) {\n", cond);
+    /* Nothing is emitted for untranslated instructions, which are left to
+     * the interpreter when their condition holds
+     */
+    result = translate_semantics(out, address, ins);
+    if (result)
+        fprintf(out, "        s->executed--;\n"
+                     "        ARM_AOT_EXIT(0x%08xu);\n", address);
+    fprintf(out, "    }\n");
+    return result;
+}
+
+static void translate_text(FILE *out, char *executable, uint32_t *code,
+                           uint32_t count) {
+    uint32_t address, i;
+    unsigned long translated;
+
+    fprintf(out, "/* Translation of the .text section of %s generated by "
+                 "arm_translate */\n"
+                 "#include \"arm_aot_abi.h\"\n\n"
+                 "#define TEXT_START 0x%08xu\n"
+                 "#define TEXT_END   0x%08xu\n\n"
+                 "static int run(struct arm_aot_state *s) {\n"
+                 "    uint32_t target = s->r[15];\n\n"
+                 "dispatch:\n"
+                 "    if ((target < TEXT_START) || (target >= TEXT_END) ||\n"
+                 "        ARM_AOT_STALE(target) || "
+                 "(s->executed >= s->budget))\n"
+                 "        ARM_AOT_EXIT(target);\n"
+                 "    switch (target) {\n", executable, text_start, text_end);
+    for (address=text_start; address<text_end; address+=4)
+        fprintf(out, "      case 0x%08xu: goto L_%08x;\n", address, address);
+    fprintf(out, "      default: ARM_AOT_EXIT(target);\n"
+                 "    }\n");
+    translated = 0;
+    for (i=0; i<count; i++)
+        if (translate_instruction(out, text_start + 4*i, code[i]) == 0)
+            translated++;
+    fprintf(out, "    ARM_AOT_EXIT(TEXT_END);\n"
+                 "}\n\n"
+                 "static const uint32_t text[] = {");
+    for (i=0; i<count; i++)
+        fprintf(out, "%s0x%08xu,", (i % 6) ? " " : "\n    ", code[i]);
+    fprintf(out, "\n};\n\n"
+                 "struct arm_aot_translation arm_aot_translation = {\n"
+                 "    ARM_AOT_VERSION, %d, TEXT_START, TEXT_END, text, run\n"
+                 "};\n", target_big_endian);
+    fprintf(stderr, "%lu instructions out of %u translated\n", translated,
+            count);
+}
+
+/* Reads the instructions of the .text section, with the endianess of the
+ * target
+ */
+static uint32_t *read_text(char *executable, uint32_t *count) {
+    uint32_t address, size, offset, *code, i;
+    uint8_t bytes[4];
+    FILE *f;
+
+    target_big_endian = elf_is_big_endian(executable);
+    if ((target_big_endian == -1) ||
+        elf_section(target_big_endian, executable, ".text", &address, &size,
+                    &offset) || (address & 3) || (size < 4))
+        return NULL;
+    f = fopen(executable, "rb");
+    if (f == NULL)
+        return NULL;
+    *count = size / 4;
+    code = malloc(*count * sizeof(uint32_t));
+    if ((code == NULL) || fseek(f, offset, SEEK_SET)) {
+        free(code);
+        fclose(f);
+        return NULL;
+    }
+    for (i=0; i<*count; i++) {
+        if (fread(bytes, 1, 4, f) != 4) {
+            free(code);
+            fclose(f);
+            return NULL;
+        }
+        if (target_big_endian)
+            code[i] = (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) |
+                      bytes[3];
+        else
+            code[i] = (bytes[3] << 24) | (bytes[2] << 16) | (bytes[1] << 8) |
+                      bytes[0];
+    }
+    fclose(f);
+    text_start = address;
+    text_end = address + 4 * *count;
+    return code;
+}
+
+void usage(char *name) {
+    fprintf(stderr, "Usage:\n"
+        "%s [ --help ] [ --compiler command ] [ --include-dir directory ] "
+        "[ --source-only ] executable object\n\n"
+        "Translates the .text section of the given ARM ELF executable into C "
+        "and compiles it into a shared object that arm_simulator runs with "
+        "its --translation switch. The C source is kept next to the object, "
+        "with the .c suffix. Options have the following behavior:\n"
+        "- compiler: command used to compile the shared object (default is "
+        "cc)\n"
+        "- include dir: directory holding arm_aot_abi.h (default is %s)\n"
+        "- source only: only generates the C source, into the object file\n"
+        , name, ARM_AOT_INCLUDE_DIR);
+}
+
+int main(int argc, char *argv[]) {
+    char *compiler, *include_dir, *source, command[COMMAND_SIZE];
+    uint32_t *code, count;
+    int opt, source_only;
+    FILE *out;
+
+    struct option longopts[] = {
+        { "compiler", required_argument, NULL, 'c' },
+        { "include-dir", required_argument, NULL, 'I' },
+        { "source-only", no_argument, NULL, 'S' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    compiler = "cc";
+    include_dir = ARM_AOT_INCLUDE_DIR;
+    source_only = 0;
+    while ((opt = getopt_long(argc, argv, "c:I:Sh", longopts, NULL)) != -1) {
+        switch(opt) {
+          case 'c':
+            compiler = optarg;
+            break;
+          case 'I':
+            include_dir = optarg;
+            break;
+          case 'S':
+            source_only = 1;
+            break;
+          case 'h':
+            usage(argv[0]);
+            exit(0);
+          default:
+            fprintf(stderr, "Unrecognized option %c\n", opt);
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        exit(1);
+    }
+    code = read_text(argv[optind], &count);
+    if (code == NULL) {
+        fprintf(stderr, "Cannot read the .text section of %s\n",
+                argv[optind]);
+        exit(1);
+    }
+    source = malloc(strlen(argv[optind+1]) + 3);
+    if (source == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    if (source_only)
+        strcpy(source, argv[optind+1]);
+    else
+        sprintf(source, "%s.c", argv[optind+1]);
+    out = fopen(source, "w");
+    if (out == NULL) {
+        perror(source);
+        exit(1);
+    }
+    translate_text(out, argv[optind], code, count);
+    fclose(out);
+    free(code);
+    if (!source_only) {
+        if (snprintf(command, COMMAND_SIZE, "%s -O2 -shared -fPIC -I%s -o %s "
+                     "%s", compiler, include_dir, argv[optind+1], source)
+            >= COMMAND_SIZE) {
+            fprintf(stderr, "Command line too long\n");
+            exit(1);
+        }
+        if (system(command)) {
+            fprintf(stderr, "Compilation failed: %s\n", command);
+            exit(1);
+        }
+    }
+    free(source);
+    return 0;
+}
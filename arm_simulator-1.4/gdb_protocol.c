@@ -28,9 +28,15 @@ Contact: Guillaume.Huard@imag.fr
 #include "util.h"
 #include "arm_core.h"
 #include "arm_constants.h"
+#include "arm_instruction.h"
 #include "trace.h"
 
-#define MAX_PACKET_SIZE 1024
+/* Size of the data of the largest packet, advertised to gdb in the answer to
+ * qSupported so that it transfers memory in large blocks
+ */
+#define MAX_PACKET_SIZE 0x10000
+/* Number of instructions run by each call to arm_run during a continue */
+#define CONT_BUDGET 65536
 
 struct gdb_protocol_data {
     arm_core arm;
@@ -38,7 +44,8 @@ struct gdb_protocol_data {
     int target_exception;
     int fd;
     pthread_mutex_t *lock;
-    char packet[MAX_PACKET_SIZE];
+    /* Data framed by '$', '#', the checksum and a final '\0' */
+    char packet[MAX_PACKET_SIZE+5];
     int len;
     char *buffer;
 };
@@ -46,6 +53,38 @@ struct gdb_protocol_data {
 typedef void (*gdb_handler_t)(gdb_protocol_data_t, char *);
 static gdb_handler_t handler[256];
 
+/* Conversions between bytes and their two hexadecimal digits, through tables
+ * filled by gdb_init
+ */
+static char hex_digits[256][2];
+static int8_t hex_values[256];
+
+static void hex_encode(char *destination, uint8_t *source, size_t size) {
+    while (size--) {
+        memcpy(destination, hex_digits[*source++], 2);
+        destination += 2;
+    }
+}
+
+/* Returns the number of bytes decoded, which is less than size if an invalid
+ * digit is found
+ */
+static size_t hex_decode(uint8_t *destination, char *source, size_t size) {
+    int high, low;
+    size_t i;
+
+    for (i=0; i<size; i++) {
+        high = hex_values[(uint8_t) *source++];
+        if (high < 0)
+            break;
+        low = hex_values[(uint8_t) *source++];
+        if (low < 0)
+            break;
+        destination[i] = (high << 4) | low;
+    }
+    return i;
+}
+
 static void gdb_send_ack(gdb_protocol_data_t gdb) {
     Rio_writen(gdb->fd, "+", 1);
 }
@@ -61,7 +100,7 @@ static void gdb_send_buffer(gdb_protocol_data_t gdb) {
         i++;
     }
     gdb->packet[i++] = '#';
-    sprintf(gdb->packet+i, "%02x", check);
+    memcpy(gdb->packet+i, hex_digits[check], 2);
     i += 2;
     gdb->packet[i] = '\0';
     gdb->len = i;
@@ -73,70 +112,53 @@ static void gdb_send_data(gdb_protocol_data_t gdb, char *data) {
     gdb_send_buffer(gdb);
 }
 
-/* Read and write to/from a string of bytes (in hexadecimal) in local byte
- * order */
-static uint32_t read_uint32(char *data) {
-    unsigned int i, step, value;
-    int target_big_endian;
-    union {
-        unsigned char bytes[4];
-        uint32_t integer;
-    } mem;
-
-    #ifdef BIG_ENDIAN_SIMULATOR
-        target_big_endian = 1;
-    #else
-        target_big_endian = 0;
-    #endif
-
-    if (is_big_endian() == target_big_endian) {
-        i = 0;
-        step = 1;
-    } else {
-        i = 3;
-        step = -1;
-    }
+/* Read and write to/from a string of 8 hexadecimal digits, giving the bytes
+ * of a word in the byte order of the simulated memory */
+static uint32_t read_uint32(gdb_protocol_data_t gdb, char *data) {
+    uint8_t bytes[4] = { 0, 0, 0, 0 };
 
-    for (; (i<4) && (i>=0); i+=step) {
-        sscanf(data, "%02x", &value);
-        mem.bytes[i] = value;
-        data += 2;
-    }
-    return mem.integer;
+    hex_decode(bytes, data, 4);
+    if (memory_is_big_endian(gdb->mem))
+        return ((uint32_t) bytes[0] << 24) | (bytes[1] << 16) |
+               (bytes[2] << 8) | bytes[3];
+    else
+        return ((uint32_t) bytes[3] << 24) | (bytes[2] << 16) |
+               (bytes[1] << 8) | bytes[0];
 }
 
-static void write_uint32(char *data, uint32_t value) {
-    unsigned int i, step;
-    int target_big_endian;
-    union {
-        unsigned char bytes[4];
-        uint32_t integer;
-    } mem;
-
-    mem.integer = value;
-    #ifdef BIG_ENDIAN_SIMULATOR
-        target_big_endian = 1;
-    #else
-        target_big_endian = 0;
-    #endif
-
-    if (is_big_endian() == target_big_endian) {
-        i = 0;
-        step = 1;
-    } else {
-        i = 3;
-        step = -1;
-    }
+static void write_uint32(gdb_protocol_data_t gdb, char *data, uint32_t value) {
+    uint8_t bytes[4];
+    int i;
 
-    for (; (i<4) && (i>=0); i+=step) {
-        sprintf(data, "%02x", mem.bytes[i]);
-        data += 2;
-    }
-    *data = '\0';
+    for (i=0; i<4; i++)
+        if (memory_is_big_endian(gdb->mem))
+            bytes[i] = value >> (24 - 8*i);
+        else
+            bytes[i] = value >> (8*i);
+    hex_encode(data, bytes, 4);
+    data[8] = '\0';
 }
 
-/* Handling of exception raised in target */
+/* Handling of exception raised in target. A watchpoint hit is reported with
+ * the address of the access, as gdb expects.
+ */
 void gdb_send_stop_reason(gdb_protocol_data_t gdb) {
+    uint32_t address;
+
+    switch (memory_watch_hit(gdb->mem, &address)) {
+      case MEMORY_WATCH_WRITE:
+        sprintf(gdb->buffer, "T05watch:%08x;", address);
+        gdb_send_buffer(gdb);
+        return;
+      case MEMORY_WATCH_READ:
+        sprintf(gdb->buffer, "T05rwatch:%08x;", address);
+        gdb_send_buffer(gdb);
+        return;
+      case MEMORY_WATCH_ACCESS:
+        sprintf(gdb->buffer, "T05awatch:%08x;", address);
+        gdb_send_buffer(gdb);
+        return;
+    }
     switch (gdb->target_exception) {
       case UNDEFINED_INSTRUCTION:
         gdb_send_data(gdb, "S04");
@@ -145,6 +167,9 @@ void gdb_send_stop_reason(gdb_protocol_data_t gdb) {
       case DATA_ABORT:
         gdb_send_data(gdb, "S10");
         break;
+      case HALT:
+        gdb_send_data(gdb, "W00");
+        break;
       default:
         gdb_send_data(gdb, "S05");
     }
@@ -156,34 +181,19 @@ static void cont(gdb_protocol_data_t gdb, char *data) {
     /* When the simulator doesn't implement breakpoints (as it is the case
      * here), gdb implements soft breakpoints by placing an architecturally
      * undefined instruction at breakpoint position. Thus we implement the
-     * continue command as a loop that waits for this instruction.
+     * continue command as a run that stops before this instruction, we will
+     * not execute it because we don't know whether exceptions are properly
+     * implemented or not. At this point gdb should replace the offending
+     * instruction by the original one. This is hack but should perform better
+     * than other solution because of its few assumptions.
      */
-    uint32_t instruction, r15;
-    int end = 0;
-
-    while (!end) {
-        /* We read in anticipation the next instruction to handle our special
-         * cases
-         */
-        trace_disable();
-        r15 = arm_read_register(gdb->arm, 15) - 4;
-        (void) arm_read_word(gdb->arm, r15, &instruction);
-        trace_enable(); 
-        switch (instruction & 0xFFF000F0) {
-          case 0xE7F000F0:
-            /* This is a breakpoint, we will not execute it because we don't
-             * know whether exceptions are properly implemented or not.
-             * At this point gdb should replace the offending instruction by
-             * the original one. This is hack but should perform better than
-             * other solution because of its few assumptions.
-             */
-            end = 1;
-            break;
-          default:
-            gdb->target_exception = arm_step(gdb->arm);
-            trace_arm_state(gdb->arm);
-        }
-    }
+    int reason;
+
+    memory_clear_watch_hit(gdb->mem);
+    do {
+        reason = arm_run(gdb->arm, CONT_BUDGET, &gdb->target_exception);
+    } while ((reason != ARM_STOP_BREAKPOINT) && (reason != ARM_STOP_HALT) &&
+             (reason != ARM_STOP_WATCHPOINT));
 
     gdb_send_stop_reason(gdb);
 }
@@ -195,9 +205,10 @@ static void kill_request(gdb_protocol_data_t gdb, char *data) {
 static void query(gdb_protocol_data_t gdb, char *data) {
     if (strcmp(data, "Offsets") == 0)
         gdb_send_data(gdb, "Text=0;Data=0;Bss=0");
-    else if (strncmp(data, "Supported", 9) == 0)
-        gdb_send_data(gdb, "PacketSize=400");
-    else if (strcmp(data, "TStatus") == 0)
+    else if (strncmp(data, "Supported", 9) == 0) {
+        sprintf(gdb->buffer, "PacketSize=%x", MAX_PACKET_SIZE);
+        gdb_send_buffer(gdb);
+    } else if (strcmp(data, "TStatus") == 0)
         gdb_send_data(gdb, "T0;tnotrun:0");
     else if (strcmp(data, "Symbol::") == 0)
         gdb_send_data(gdb, "");
@@ -214,11 +225,11 @@ static void read_general_registers(gdb_protocol_data_t gdb, char *data) {
     position = gdb->buffer;
     /* General register r0..r14 */
     for (i=0; i<15; i++) {
-        write_uint32(position, arm_read_register(gdb->arm, i));
+        write_uint32(gdb, position, arm_read_register(gdb->arm, i));
         position += 8;
     }
     /* Special case, the pc is one instruction in advance (before fetch) */
-    write_uint32(position, arm_read_register(gdb->arm, i) - 4);
+    write_uint32(gdb, position, arm_read_register(gdb->arm, i) - 4);
     position += 8;
     /* Floating point register f0..f7 */
     /* Not implemented */
@@ -232,23 +243,26 @@ static void read_general_registers(gdb_protocol_data_t gdb, char *data) {
     /* fps not implemented */
     sprintf(position,"xxxxxxxx");
     position += 8;
-    write_uint32(position, arm_read_cpsr(gdb->arm));
+    write_uint32(gdb, position, arm_read_cpsr(gdb->arm));
     trace_enable();
     gdb_send_buffer(gdb);
 }
 
+/* The bytes are read into the second half of the buffer and encoded from
+ * there to the beginning of the buffer, each pair of digits overwriting bytes
+ * already encoded. The answer stops before the first byte that is not mapped.
+ */
 static void read_memory(gdb_protocol_data_t gdb, char *data) {
     unsigned int address, size;
-    char *position;
-    uint8_t value;
+    uint8_t *block;
+    size_t count;
 
     sscanf(data,"%x,%x", &address, &size);
-    position = gdb->buffer;
-    position[0] = '\0';
-    while (size-- && (memory_read_byte(gdb->mem, address++, &value) != -1)) {
-        sprintf(position, "%02x", value);
-        position += 2;
-    }
+    size = min(size, MAX_PACKET_SIZE / 2);
+    block = (uint8_t *) gdb->buffer + MAX_PACKET_SIZE / 2;
+    count = memory_read_block(gdb->mem, address, block, size);
+    hex_encode(gdb->buffer, block, count);
+    gdb->buffer[2*count] = '\0';
     gdb_send_buffer(gdb);
 }
 
@@ -257,8 +271,8 @@ static void read_register(gdb_protocol_data_t gdb, char *data) {
     reg = atoi(data);
     assert(reg < 16);
     trace_disable();
-    write_uint32(gdb->buffer, arm_read_register(gdb->arm, reg) -
-                              ((reg == 15) ? 4 : 0));
+    write_uint32(gdb, gdb->buffer, arm_read_register(gdb->arm, reg) -
+                                   ((reg == 15) ? 4 : 0));
     trace_enable();
     gdb_send_buffer(gdb);
 }
@@ -279,6 +293,7 @@ static void set_thread(gdb_protocol_data_t gdb, char *data) {
 }
 
 static void step(gdb_protocol_data_t gdb, char *data) {
+    memory_clear_watch_hit(gdb->mem);
     gdb->target_exception = arm_step(gdb->arm);
     trace_arm_state(gdb->arm);
     gdb_send_stop_reason(gdb);
@@ -293,7 +308,7 @@ static void write_general_registers(gdb_protocol_data_t gdb, char *data) {
     position = data;
     /* General register r0..r15 */
     for (i=0; i<16; i++) {
-        value = read_uint32(position);
+        value = read_uint32(gdb, position);
         arm_write_register(gdb->arm, i, value);
         debug("r%02d = %08x   ", i, value);
         if (i % 4 == 3)
@@ -305,7 +320,7 @@ static void write_general_registers(gdb_protocol_data_t gdb, char *data) {
     for (i=0; i<8; i++) {
         //printf("f%02d = ", i);
         for (j=0; j<3; j++) {
-            value = read_uint32(position);
+            value = read_uint32(gdb, position);
             //printf("%08x", value);
             position += 8;
         }
@@ -315,10 +330,10 @@ static void write_general_registers(gdb_protocol_data_t gdb, char *data) {
     }
     /* Status registers */
     /* fps not implemented */
-    value = read_uint32(position);
+    value = read_uint32(gdb, position);
     //printf("fps = %08x   ", value);
     position += 8;
-    value = read_uint32(position);
+    value = read_uint32(gdb, position);
     arm_write_cpsr(gdb->arm, value);
     debug("cpsr = %08x\n", value);
     trace_enable();
@@ -326,40 +341,61 @@ static void write_general_registers(gdb_protocol_data_t gdb, char *data) {
     gdb_send_data(gdb, "OK");
 }
 
-static void write_memory_binary(gdb_protocol_data_t gdb, char *data) {
-    unsigned int address, size, i, write_ok;
-    char *content;
-    uint8_t value;
+static void write_block(gdb_protocol_data_t gdb, uint32_t address,
+                        uint8_t *content, uint32_t size) {
+    uint32_t i;
 
-    sscanf(data,"%x,%x", &address, &size);
-    content = index(data, ':') + 1;
     debug("Writing %d bytes at address %08x : ", size, address);
-    write_ok = address < memory_get_size(gdb->mem);
-    for (i=0; (i<size) && write_ok; i++) {
-        if (*content == 0x7d) {
-            content++;
-            value = *content ^ (char) 0x20;
-        } else {
-            value = *content;
-        }
-        write_ok = memory_write_byte(gdb->mem, address++, value) == 0;
-        if (i<32)
-            debug_raw("%02x", value);
-        content++;
-    }
+    for (i=0; i<min(size, 32); i++)
+        debug_raw("%02x", content[i]);
     debug_raw("...\n");
-    if (write_ok)
+    if (memory_write_block(gdb->mem, address, content, size) == size)
         gdb_send_data(gdb, "OK");
     else
         gdb_send_data(gdb, "E02");
 }
 
+/* The bytes are decoded in place, each one taking the place of its first
+ * digit, and then written at once
+ */
+static void write_memory(gdb_protocol_data_t gdb, char *data) {
+    unsigned int address, size;
+    uint8_t *content;
+
+    sscanf(data,"%x,%x", &address, &size);
+    content = (uint8_t *) index(data, ':') + 1;
+    if (hex_decode(content, (char *) content, size) == size)
+        write_block(gdb, address, content, size);
+    else
+        gdb_send_data(gdb, "E01");
+}
+
+/* Same for the escaped binary bytes */
+static void write_memory_binary(gdb_protocol_data_t gdb, char *data) {
+    unsigned int address, size, i;
+    uint8_t *content, *position;
+
+    sscanf(data,"%x,%x", &address, &size);
+    content = (uint8_t *) index(data, ':') + 1;
+    position = content;
+    for (i=0; i<size; i++) {
+        if (*position == 0x7d) {
+            position++;
+            content[i] = *position ^ 0x20;
+        } else {
+            content[i] = *position;
+        }
+        position++;
+    }
+    write_block(gdb, address, content, size);
+}
+
 static void write_register(gdb_protocol_data_t gdb, char *data) {
     unsigned int reg, value;
 
     sscanf(data,"%x", &reg);
     data = index(data, '=') + 1;
-    value = read_uint32(data);
+    value = read_uint32(gdb, data);
     assert(reg < 16);
     trace_disable();
     arm_write_register(gdb->arm, reg, value);
@@ -368,6 +404,47 @@ static void write_register(gdb_protocol_data_t gdb, char *data) {
     gdb_send_data(gdb, "OK");
 }
 
+/* Watchpoints of types 2 (write), 3 (read) and 4 (access) are handled by the
+ * memory, the breakpoints (types 0 and 1) are left to gdb, which falls back to
+ * soft breakpoints written in memory when we send an empty reply.
+ */
+static int watch_kind(int type) {
+    switch (type) {
+      case 2:
+        return MEMORY_WATCH_WRITE;
+      case 3:
+        return MEMORY_WATCH_READ;
+      case 4:
+        return MEMORY_WATCH_ACCESS;
+      default:
+        return 0;
+    }
+}
+
+static void insert_watchpoint(gdb_protocol_data_t gdb, char *data) {
+    unsigned int type, address, size;
+
+    sscanf(data, "%x,%x,%x", &type, &address, &size);
+    if (watch_kind(type) == 0)
+        gdb_send_data(gdb, "");
+    else if (memory_add_watch(gdb->mem, address, size, watch_kind(type)))
+        gdb_send_data(gdb, "E01");
+    else
+        gdb_send_data(gdb, "OK");
+}
+
+static void remove_watchpoint(gdb_protocol_data_t gdb, char *data) {
+    unsigned int type, address, size;
+
+    sscanf(data, "%x,%x,%x", &type, &address, &size);
+    if (watch_kind(type) == 0)
+        gdb_send_data(gdb, "");
+    else if (memory_remove_watch(gdb->mem, address, size, watch_kind(type)))
+        gdb_send_data(gdb, "E01");
+    else
+        gdb_send_data(gdb, "OK");
+}
+
 /* End of GDB Protocol commands handlers */
 
 gdb_protocol_data_t gdb_init_data(arm_core arm, memory mem, int fd,
@@ -391,8 +468,16 @@ void gdb_init() {
     int i;
 
     debug("gdb protocol handlers initialization\n");
-    for (i=0; i<256; i++)
+    for (i=0; i<256; i++) {
         handler[i] = NULL;
+        hex_digits[i][0] = "0123456789abcdef"[i >> 4];
+        hex_digits[i][1] = "0123456789abcdef"[i & 0xF];
+        hex_values[i] = -1;
+    }
+    for (i=0; i<16; i++) {
+        hex_values[(uint8_t) "0123456789abcdef"[i]] = i;
+        hex_values[(uint8_t) "0123456789ABCDEF"[i]] = i;
+    }
     handler['c'] = cont;
     handler['k'] = kill_request;
     handler['q'] = query;
@@ -403,8 +488,11 @@ void gdb_init() {
     handler['H'] = set_thread;
     handler['s'] = step;
     handler['G'] = write_general_registers;
+    handler['M'] = write_memory;
     handler['X'] = write_memory_binary;
     handler['P'] = write_register;
+    handler['Z'] = insert_watchpoint;
+    handler['z'] = remove_watchpoint;
 }
 
 void gdb_require_retransmission(gdb_protocol_data_t gdb) {
@@ -0,0 +1,181 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include "loader.h"
+#include "util.h"
+#include "debug.h"
+
+/* ELF fields are stored with the endianess of the target */
+static uint32_t elf_word(uint32_t value, int swap) {
+    return swap ? reverse_4(value) : value;
+}
+
+static uint16_t elf_half(uint16_t value, int swap) {
+    return swap ? reverse_2(value) : value;
+}
+
+static int load_segment(memory mem, FILE *f, Elf32_Phdr *segment, int swap) {
+    uint32_t address, file_size, memory_size, i;
+    int c;
+
+    address = elf_word(segment->p_paddr, swap);
+    file_size = elf_word(segment->p_filesz, swap);
+    memory_size = elf_word(segment->p_memsz, swap);
+    debug("Loading segment of %d bytes at address %08x\n", memory_size,
+          address);
+    if (fseek(f, elf_word(segment->p_offset, swap), SEEK_SET))
+        return -1;
+    for (i=0; i<memory_size; i++) {
+        if (i < file_size) {
+            c = fgetc(f);
+            if (c == EOF)
+                return -1;
+        } else {
+            c = 0;
+        }
+        if (memory_write_byte(mem, address + i, c))
+            return -1;
+    }
+    return 0;
+}
+
+/* Opens the file and checks that it is an ARM ELF executable with the
+ * endianess of the target, returns NULL otherwise
+ */
+static FILE *open_elf(int target_big_endian, char *filename,
+                      Elf32_Ehdr *header, int *swap) {
+    FILE *f;
+
+    f = fopen(filename, "rb");
+    if (f == NULL)
+        return NULL;
+    if ((fread(header, sizeof(*header), 1, f) != 1) ||
+        (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0) ||
+        (header->e_ident[EI_CLASS] != ELFCLASS32) ||
+        (header->e_ident[EI_DATA] != (target_big_endian ? ELFDATA2MSB :
+                                                          ELFDATA2LSB))) {
+        fclose(f);
+        return NULL;
+    }
+    *swap = target_big_endian != is_big_endian();
+    if (elf_half(header->e_machine, *swap) != EM_ARM) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+int elf_is_big_endian(char *filename) {
+    Elf32_Ehdr header;
+    int swap;
+    FILE *f;
+
+    f = open_elf(1, filename, &header, &swap);
+    if (f) {
+        fclose(f);
+        return 1;
+    }
+    f = open_elf(0, filename, &header, &swap);
+    if (f) {
+        fclose(f);
+        return 0;
+    }
+    return -1;
+}
+
+int load_elf(memory mem, int target_big_endian, char *filename,
+             uint32_t *entry) {
+    Elf32_Ehdr header;
+    Elf32_Phdr segment;
+    int i, swap, result;
+    FILE *f;
+
+    f = open_elf(target_big_endian, filename, &header, &swap);
+    if (f == NULL)
+        return -1;
+    result = -1;
+    *entry = elf_word(header.e_entry, swap);
+    for (i=0; i<elf_half(header.e_phnum, swap); i++) {
+        result = -1;
+        if (fseek(f, elf_word(header.e_phoff, swap) +
+                     i*elf_half(header.e_phentsize, swap), SEEK_SET) ||
+            (fread(&segment, sizeof(segment), 1, f) != 1))
+            break;
+        result = 0;
+        if ((elf_word(segment.p_type, swap) == PT_LOAD) &&
+            load_segment(mem, f, &segment, swap)) {
+            result = -1;
+            break;
+        }
+    }
+    fclose(f);
+    return result;
+}
+
+static int read_section_header(FILE *f, Elf32_Ehdr *header, int swap, int i,
+                               Elf32_Shdr *section) {
+    return fseek(f, elf_word(header->e_shoff, swap) +
+                    i*elf_half(header->e_shentsize, swap), SEEK_SET) ||
+           (fread(section, sizeof(*section), 1, f) != 1);
+}
+
+int elf_section(int target_big_endian, char *filename, char *name,
+                uint32_t *address, uint32_t *size, uint32_t *offset) {
+    Elf32_Ehdr header;
+    Elf32_Shdr names, section;
+    char buffer[64];
+    size_t length;
+    int i, swap, result;
+    FILE *f;
+
+    f = open_elf(target_big_endian, filename, &header, &swap);
+    if (f == NULL)
+        return -1;
+    result = -1;
+    length = strlen(name) + 1;
+    if ((length <= sizeof(buffer)) &&
+        !read_section_header(f, &header, swap,
+                             elf_half(header.e_shstrndx, swap), &names)) {
+        for (i=0; i<elf_half(header.e_shnum, swap); i++) {
+            if (read_section_header(f, &header, swap, i, &section) ||
+                fseek(f, elf_word(names.sh_offset, swap) +
+                         elf_word(section.sh_name, swap), SEEK_SET) ||
+                (fread(buffer, 1, length, f) != length))
+                break;
+            if (memcmp(buffer, name, length) == 0) {
+                *address = elf_word(section.sh_addr, swap);
+                *size = elf_word(section.sh_size, swap);
+                *offset = elf_word(section.sh_offset, swap);
+                debug("Section %s of %d bytes at address %08x\n", name,
+                      *size, *address);
+                result = 0;
+                break;
+            }
+        }
+    }
+    fclose(f);
+    return result;
+}
@@ -0,0 +1,47 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#ifndef __LOADER_H__
+#define __LOADER_H__
+#include <stdint.h>
+#include "memory.h"
+
+/* Endianess of the given ARM ELF executable: 1 for big endian, 0 for little
+ * endian, -1 if it cannot be read.
+ */
+int elf_is_big_endian(char *filename);
+
+/* Loads the segments of a 32 bits ARM ELF executable into mem at their
+ * physical addresses, as gdb load would do, and stores its entry point into
+ * entry. The endianess of the file must match the one of mem.
+ * The return value indicates a succes (0) or a failure (-1).
+ */
+int load_elf(memory mem, int target_big_endian, char *filename,
+             uint32_t *entry);
+
+/* Finds the section called name in the given ELF executable and stores its
+ * address, size and offset in the file. Same return value as load_elf.
+ */
+int elf_section(int target_big_endian, char *filename, char *name,
+                uint32_t *address, uint32_t *size, uint32_t *offset);
+
+#endif
@@ -20,45 +20,1273 @@ Contact: Guillaume.Huard@imag.fr
 	 700 avenue centrale, domaine universitaire
 	 38401 Saint Martin d'Hres
 */
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "memory.h"
-#include "util.h"
+
+/* The 4 GiB address space is split into pages, described in second level
+ * tables of MEMORY_TABLE_SIZE pages. Tables are only allocated for the mapped
+ * regions that are accessed, and the content of a page is only allocated on
+ * its first write: until then, it reads as zeros.
+ * With huge pages enabled, large regions are instead backed by a single host
+ * mapping, given to the pages on their first access, so that the host TLB
+ * covers them with 2 MiB entries.
+ */
+#define MEMORY_TABLE_BITS 10
+#define MEMORY_TABLE_SIZE (1 << MEMORY_TABLE_BITS)
+#define MEMORY_DIRECTORY_SIZE (1 << (32 - MEMORY_PAGE_BITS - MEMORY_TABLE_BITS))
+#define MEMORY_OFFSET_MASK (MEMORY_PAGE_SIZE - 1)
+
+/* Direct mapped caches of host pointers to the recently accessed pages, one
+ * for reads and one for writes. The write cache never holds a page with
+ * cached code, neither cache holds a device page nor a page watched for the
+ * kind of accesses it serves, so that a hit needs no further check.
+ */
+#define MEMORY_CACHE_SIZE 64
+#define MEMORY_NO_PAGE 0xFFFFFFFF
+
+/* Dirty pages are recorded in a bitmap per table of descriptors, a page is
+ * marked when it enters the write cache, which is then emptied of the pages
+ * whose bit is cleared
+ */
+#define MEMORY_DIRTY_WORDS (MEMORY_TABLE_SIZE / 32)
+
+struct memory_page {
+    /* NULL until the first write */
+    uint8_t *data;
+    uint8_t mapped;
+    /* Set when the page holds instructions that have been decoded and cached
+     * by the core, see memory_mark_code.
+     */
+    uint8_t code;
+    /* Set when data points into a host mapping shared by the pages of a
+     * region, such as a file mapped by memory_map_file, and thus is not freed
+     */
+    uint8_t borrowed;
+    /* Kinds of the watchpoints overlapping the page, see memory_add_watch */
+    uint8_t watch;
+    /* Set when the page belongs to a device instead of holding memory */
+    struct memory_device *device;
+};
+
+struct memory_watch {
+    uint32_t address;
+    uint32_t size;
+    int kind;
+    struct memory_watch *next;
+};
+
+struct memory_file {
+    uint8_t *data;
+    size_t size;
+    struct memory_file *next;
+};
+
+struct memory_device {
+    uint32_t address;
+    uint32_t size;
+    memory_device_read read;
+    memory_device_write write;
+    void *data;
+    struct memory_device *next;
+};
+
+#define MEMORY_HUGE_PAGE_SIZE (2 << 20)
+
+struct memory_region {
+    uint32_t first_page;
+    uint32_t page_count;
+    /* Host mapping holding the pages, NULL if they are allocated one by one */
+    uint8_t *data;
+    size_t data_size;
+    /* How the mapping got huge pages, see memory_huge_mapping */
+    int huge;
+    /* Set when the pages are the ones of a file, see memory_map_file */
+    int file;
+    struct memory_region *next;
+};
+
+struct memory_cache_entry {
+    uint32_t page;
+    uint8_t *data;
+};
 
 struct memory_data {
+    struct memory_cache_entry read_cache[MEMORY_CACHE_SIZE];
+    struct memory_cache_entry write_cache[MEMORY_CACHE_SIZE];
+    struct memory_page *tables[MEMORY_DIRECTORY_SIZE];
+    uint32_t *dirty[MEMORY_DIRECTORY_SIZE];
+    struct memory_region *regions;
+    struct memory_device *devices;
+    struct memory_file *files;
+    struct memory_watch *watches;
+    /* Last watchpoint hit, kind 0 if none */
+    int watch_hit;
+    uint32_t watch_address;
+    size_t size;
+    int huge_pages;
+    int is_big_endian;
+    const struct memory_access *access;
+    memory_code_hook code_hook;
+    void *code_hook_data;
 };
 
+/* Content of the pages never written */
+static uint8_t zero_page[MEMORY_PAGE_SIZE];
+
 memory memory_create(size_t size, int is_big_endian) {
-    memory mem=NULL;
+    memory mem;
+    int i;
+
+    mem = calloc(1, sizeof(struct memory_data));
+    if (mem) {
+        for (i=0; i<MEMORY_CACHE_SIZE; i++) {
+            mem->read_cache[i].page = MEMORY_NO_PAGE;
+            mem->write_cache[i].page = MEMORY_NO_PAGE;
+        }
+        mem->is_big_endian = is_big_endian;
+        mem->access = is_big_endian ? &memory_big_endian_access :
+                                      &memory_little_endian_access;
+        if (memory_map(mem, 0, size)) {
+            memory_destroy(mem);
+            return NULL;
+        }
+    }
     return mem;
 }
 
-size_t memory_get_size(memory mem) {
+void memory_set_huge_pages(memory mem, int enabled) {
+    mem->huge_pages = enabled;
+}
+
+#define MEMORY_HUGE_NONE 0
+#define MEMORY_HUGE_TRANSPARENT 1
+#define MEMORY_HUGE_EXPLICIT 2
+
+/* Anonymous host mapping of size bytes, rounded to huge pages. Explicit huge
+ * pages (MAP_HUGETLB) are only available if the administrator has reserved
+ * them, and are then taken from the reserve at once (without it, the first
+ * access to a missing one would raise SIGBUS), otherwise the mapping is
+ * aligned on a huge page and the kernel is asked to back it with transparent
+ * huge pages. The way chosen is stored in huge. Returns NULL if no memory can
+ * be mapped.
+ */
+static uint8_t *memory_huge_mapping(size_t size, int *huge) {
+    uint8_t *data;
+    size_t offset;
+
+#ifdef MAP_HUGETLB
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (data != MAP_FAILED) {
+        *huge = MEMORY_HUGE_EXPLICIT;
+        return data;
+    }
+#endif
+    data = mmap(NULL, size + MEMORY_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED)
+        return NULL;
+    offset = -(uintptr_t) data & (MEMORY_HUGE_PAGE_SIZE - 1);
+    if (offset)
+        munmap(data, offset);
+    munmap(data + offset + size, MEMORY_HUGE_PAGE_SIZE - offset);
+    data += offset;
+    *huge = MEMORY_HUGE_NONE;
+#ifdef MADV_HUGEPAGE
+    if (madvise(data, size, MADV_HUGEPAGE) == 0)
+        *huge = MEMORY_HUGE_TRANSPARENT;
+#endif
+    return data;
+}
+
+/* The pages of a file region are given by memory_map_file, so they never get
+ * a huge pages mapping
+ */
+static int memory_add_region(memory mem, uint32_t address, size_t size,
+                             int file) {
+    struct memory_region *region;
+    uint64_t end = (uint64_t) address + size;
+
+    if (size == 0)
+        return 0;
+    if (end > ((uint64_t) 1 << 32))
+        return -1;
+    region = malloc(sizeof(struct memory_region));
+    if (region == NULL)
+        return -1;
+    region->first_page = address >> MEMORY_PAGE_BITS;
+    region->page_count = ((end + MEMORY_OFFSET_MASK) >> MEMORY_PAGE_BITS) -
+                         region->first_page;
+    region->data = NULL;
+    region->data_size = 0;
+    region->huge = MEMORY_HUGE_NONE;
+    region->file = file;
+    /* Falls back to pages allocated one by one */
+    if (!file && mem->huge_pages && (size >= MEMORY_HUGE_PAGE_SIZE)) {
+        region->data_size = ((size_t) region->page_count << MEMORY_PAGE_BITS) +
+                            MEMORY_HUGE_PAGE_SIZE - 1;
+        region->data_size &= ~((size_t) MEMORY_HUGE_PAGE_SIZE - 1);
+        region->data = memory_huge_mapping(region->data_size, &region->huge);
+        if (region->data == NULL)
+            region->data_size = 0;
+    }
+    region->next = mem->regions;
+    mem->regions = region;
+    mem->size += (size_t) region->page_count << MEMORY_PAGE_BITS;
     return 0;
 }
 
+int memory_map(memory mem, uint32_t address, size_t size) {
+    return memory_add_region(mem, address, size, 0);
+}
+
+size_t memory_get_size(memory mem) {
+    return mem->size;
+}
+
+/* Transparent huge pages are given by the kernel when the pages are first
+ * touched, or later, the amount actually obtained for the mapping at start is
+ * read from /proc/self/smaps (Linux only). Returns -1 if it is not known.
+ */
+static long memory_transparent_huge_kb(uint8_t *start) {
+    char line[256];
+    unsigned long address, end;
+    long size = -1;
+    int found = 0;
+    FILE *smaps;
+
+    smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), smaps)) {
+        if (sscanf(line, "%lx-%lx", &address, &end) == 2)
+            found = (address == (uintptr_t) start);
+        else if (found && (sscanf(line, "AnonHugePages: %ld", &size) == 1))
+            break;
+    }
+    fclose(smaps);
+    return found ? size : -1;
+}
+
+void memory_print_statistics(memory mem, FILE *out) {
+    static const char *huge_names[] = { "not obtained", "transparent",
+                                        "explicit (hugetlbfs)" };
+    struct memory_region *region;
+    unsigned long pages = 0;
+    long huge_kb;
+    int i, j;
+
+    for (i=0; i<MEMORY_DIRECTORY_SIZE; i++)
+        if (mem->tables[i])
+            for (j=0; j<MEMORY_TABLE_SIZE; j++)
+                if (mem->tables[i][j].data && !mem->tables[i][j].borrowed)
+                    pages++;
+    fprintf(out, "Memory statistics:\n"
+            "  mapped size:               %lu bytes\n"
+            "  pages allocated one by one: %lu\n",
+            (unsigned long) mem->size, pages);
+    for (region = mem->regions; region; region = region->next) {
+        if (region->file)
+            fprintf(out, "  region at %08X, %lu bytes: file-backed\n",
+                    region->first_page << MEMORY_PAGE_BITS,
+                    (unsigned long) region->page_count << MEMORY_PAGE_BITS);
+        if (region->data == NULL)
+            continue;
+        fprintf(out, "  region at %08X, %lu bytes: huge pages %s",
+                region->first_page << MEMORY_PAGE_BITS,
+                (unsigned long) region->data_size, huge_names[region->huge]);
+        huge_kb = -1;
+        if (region->huge == MEMORY_HUGE_TRANSPARENT)
+            huge_kb = memory_transparent_huge_kb(region->data);
+        if (huge_kb >= 0)
+            fprintf(out, ", %ld kB in huge pages", huge_kb);
+        fprintf(out, "\n");
+    }
+}
+
+int memory_is_big_endian(memory mem) {
+    return mem->is_big_endian;
+}
+
 void memory_destroy(memory mem) {
+    struct memory_region *region;
+    struct memory_device *device;
+    struct memory_file *file;
+    struct memory_watch *watch;
+    int i, j;
+
+    for (i=0; i<MEMORY_DIRECTORY_SIZE; i++)
+        if (mem->tables[i]) {
+            for (j=0; j<MEMORY_TABLE_SIZE; j++)
+                if (!mem->tables[i][j].borrowed)
+                    free(mem->tables[i][j].data);
+            free(mem->tables[i]);
+            free(mem->dirty[i]);
+        }
+    while (mem->regions) {
+        region = mem->regions;
+        mem->regions = region->next;
+        if (region->data)
+            munmap(region->data, region->data_size);
+        free(region);
+    }
+    while (mem->devices) {
+        device = mem->devices;
+        mem->devices = device->next;
+        free(device);
+    }
+    while (mem->watches) {
+        watch = mem->watches;
+        mem->watches = watch->next;
+        free(watch);
+    }
+    /* Shared mappings are written back to their file by the host */
+    while (mem->files) {
+        file = mem->files;
+        mem->files = file->next;
+        munmap(file->data, file->size);
+        free(file);
+    }
+    free(mem);
 }
 
-int memory_read_byte(memory mem, uint32_t address, uint8_t *value) {
-    return -1;
+void memory_set_code_hook(memory mem, memory_code_hook hook, void *data) {
+    mem->code_hook = hook;
+    mem->code_hook_data = data;
 }
 
-int memory_read_half(memory mem, uint32_t address, uint16_t *value) {
-    return -1;
+/* Descriptor of a page, mapped or not, allocating its table and dirty bitmap
+ * if needed
+ */
+static struct memory_page *memory_table_entry(memory mem, uint32_t page) {
+    struct memory_page **table = &mem->tables[page >> MEMORY_TABLE_BITS];
+    uint32_t **dirty = &mem->dirty[page >> MEMORY_TABLE_BITS];
+
+    if (*table == NULL) {
+        *dirty = calloc(MEMORY_DIRTY_WORDS, sizeof(uint32_t));
+        if (*dirty == NULL)
+            return NULL;
+        *table = calloc(MEMORY_TABLE_SIZE, sizeof(struct memory_page));
+        if (*table == NULL) {
+            free(*dirty);
+            *dirty = NULL;
+            return NULL;
+        }
+    }
+    return &(*table)[page % MEMORY_TABLE_SIZE];
 }
 
-int memory_read_word(memory mem, uint32_t address, uint32_t *value) {
+/* The table of the page has to be allocated */
+static inline void memory_set_dirty(memory mem, uint32_t page) {
+    mem->dirty[page >> MEMORY_TABLE_BITS][(page % MEMORY_TABLE_SIZE) / 32] |=
+        (uint32_t) 1 << (page % 32);
+}
+
+/* Descriptor of a page, allocated on the first access to a page of a mapped
+ * region. Returns NULL if the page is not mapped.
+ */
+static struct memory_page *memory_page(memory mem, uint32_t page) {
+    struct memory_page *table = mem->tables[page >> MEMORY_TABLE_BITS];
+    struct memory_page *descriptor;
+    struct memory_region *region;
+
+    if (table && table[page % MEMORY_TABLE_SIZE].mapped)
+        return &table[page % MEMORY_TABLE_SIZE];
+    for (region = mem->regions; region; region = region->next)
+        if (page - region->first_page < region->page_count)
+            break;
+    if (region == NULL)
+        return NULL;
+    descriptor = memory_table_entry(mem, page);
+    if (descriptor) {
+        descriptor->mapped = 1;
+        if (region->data) {
+            descriptor->data = region->data +
+                ((size_t) (page - region->first_page) << MEMORY_PAGE_BITS);
+            descriptor->borrowed = 1;
+        }
+    }
+    return descriptor;
+}
+
+/* Discards the content of a page, which is about to be replaced */
+static void memory_release(memory mem, uint32_t page,
+                           struct memory_page *descriptor) {
+    if (descriptor->code && mem->code_hook)
+        mem->code_hook(mem->code_hook_data, page << MEMORY_PAGE_BITS);
+    if (!descriptor->borrowed)
+        free(descriptor->data);
+    descriptor->data = NULL;
+    descriptor->borrowed = 0;
+    descriptor->code = 0;
+    if (mem->read_cache[page % MEMORY_CACHE_SIZE].page == page)
+        mem->read_cache[page % MEMORY_CACHE_SIZE].page = MEMORY_NO_PAGE;
+    if (mem->write_cache[page % MEMORY_CACHE_SIZE].page == page)
+        mem->write_cache[page % MEMORY_CACHE_SIZE].page = MEMORY_NO_PAGE;
+}
+
+/* Checks that the pages from first to last do not belong to a device, and
+ * allocates their tables
+ */
+static int memory_check_pages(memory mem, uint32_t first, uint32_t last) {
+    struct memory_page *descriptor;
+    uint32_t page;
+
+    for (page = first; page <= last; page++) {
+        descriptor = memory_table_entry(mem, page);
+        if ((descriptor == NULL) || descriptor->device)
+            return -1;
+    }
+    return 0;
+}
+
+/* The descriptors of the pages of a device are set at once, the memory they
+ * might hold is discarded.
+ */
+int memory_map_device(memory mem, uint32_t address, size_t size,
+                      memory_device_read read, memory_device_write write,
+                      void *data) {
+    struct memory_device *device;
+    struct memory_page *descriptor;
+    uint64_t end = (uint64_t) address + size;
+    uint32_t page, last;
+
+    if ((size == 0) || (end > ((uint64_t) 1 << 32)))
+        return -1;
+    last = (end - 1) >> MEMORY_PAGE_BITS;
+    if (memory_check_pages(mem, address >> MEMORY_PAGE_BITS, last))
+        return -1;
+    device = malloc(sizeof(struct memory_device));
+    if (device == NULL)
+        return -1;
+    device->address = address;
+    device->size = size;
+    device->read = read;
+    device->write = write;
+    device->data = data;
+    device->next = mem->devices;
+    mem->devices = device;
+    for (page = address >> MEMORY_PAGE_BITS; page <= last; page++) {
+        descriptor = memory_table_entry(mem, page);
+        memory_release(mem, page, descriptor);
+        descriptor->mapped = 1;
+        descriptor->device = device;
+    }
+    return 0;
+}
+
+/* The file is mapped once in the host, its pages are then given to the
+ * descriptors, so that nothing is read before the first access to each page.
+ * Beyond the end of the file, its last page reads as zeros.
+ */
+int memory_map_file(memory mem, uint32_t address, const char *path,
+                    int shared) {
+    struct memory_file *file;
+    struct memory_page *descriptor;
+    struct stat status;
+    uint32_t first, count, i;
+    void *data;
+    int fd;
+
+    if (address & MEMORY_OFFSET_MASK)
+        return -1;
+    fd = open(path, shared ? O_RDWR : O_RDONLY);
+    if (fd == -1)
+        return -1;
+    if ((fstat(fd, &status) == -1) || (status.st_size == 0) ||
+        ((uint64_t) address + status.st_size > ((uint64_t) 1 << 32))) {
+        close(fd);
+        return -1;
+    }
+    first = address >> MEMORY_PAGE_BITS;
+    count = (status.st_size + MEMORY_OFFSET_MASK) >> MEMORY_PAGE_BITS;
+    file = malloc(sizeof(struct memory_file));
+    if ((file == NULL) || memory_check_pages(mem, first, first + count - 1)) {
+        free(file);
+        close(fd);
+        return -1;
+    }
+    file->size = (size_t) count << MEMORY_PAGE_BITS;
+    data = mmap(NULL, file->size, PROT_READ | PROT_WRITE,
+                shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ((data == MAP_FAILED) ||
+        memory_add_region(mem, address, status.st_size, 1)) {
+        if (data != MAP_FAILED)
+            munmap(data, file->size);
+        free(file);
+        return -1;
+    }
+    file->data = data;
+    file->next = mem->files;
+    mem->files = file;
+    for (i=0; i<count; i++) {
+        descriptor = memory_table_entry(mem, first + i);
+        memory_release(mem, first + i, descriptor);
+        descriptor->data = file->data + ((size_t) i << MEMORY_PAGE_BITS);
+        descriptor->borrowed = 1;
+        descriptor->mapped = 1;
+        memory_set_dirty(mem, first + i);
+    }
+    return 0;
+}
+
+int memory_is_dirty(memory mem, uint32_t address) {
+    uint32_t page = address >> MEMORY_PAGE_BITS;
+    uint32_t *dirty = mem->dirty[page >> MEMORY_TABLE_BITS];
+
+    return (dirty != NULL) &&
+           ((dirty[(page % MEMORY_TABLE_SIZE) / 32] >> (page % 32)) & 1);
+}
+
+/* Tables never allocated and bitmap words without any bit set are skipped at
+ * once
+ */
+int memory_next_dirty(memory mem, uint32_t *address) {
+    uint64_t page = *address >> MEMORY_PAGE_BITS;
+    uint32_t *dirty, bits;
+
+    while (page < ((uint64_t) 1 << (32 - MEMORY_PAGE_BITS))) {
+        dirty = mem->dirty[page >> MEMORY_TABLE_BITS];
+        if (dirty == NULL) {
+            page = (page | (MEMORY_TABLE_SIZE - 1)) + 1;
+            continue;
+        }
+        bits = dirty[(page % MEMORY_TABLE_SIZE) / 32] >> (page % 32);
+        if (bits) {
+            *address = (page + __builtin_ctz(bits)) << MEMORY_PAGE_BITS;
+            return 0;
+        }
+        page = (page | 31) + 1;
+    }
     return -1;
 }
 
+void memory_clear_dirty(memory mem, uint32_t address, size_t size) {
+    struct memory_cache_entry *entry;
+    uint64_t page, last;
+    uint32_t *dirty, bit;
+
+    if ((size == 0) || ((uint64_t) address + size > ((uint64_t) 1 << 32)))
+        return;
+    last = ((uint64_t) address + size - 1) >> MEMORY_PAGE_BITS;
+    for (page = address >> MEMORY_PAGE_BITS; page <= last; page++) {
+        dirty = mem->dirty[page >> MEMORY_TABLE_BITS];
+        if (dirty == NULL) {
+            page |= MEMORY_TABLE_SIZE - 1;
+            continue;
+        }
+        bit = (uint32_t) 1 << (page % 32);
+        dirty[(page % MEMORY_TABLE_SIZE) / 32] &= ~bit;
+        entry = &mem->write_cache[page % MEMORY_CACHE_SIZE];
+        if (entry->page == page)
+            entry->page = MEMORY_NO_PAGE;
+    }
+}
+
+/* Two ranges overlap if one starts within the other */
+static int memory_overlaps(uint32_t address, uint32_t size,
+                           struct memory_watch *watch) {
+    return (address - watch->address < watch->size) ||
+           (watch->address - address < size);
+}
+
+/* Computes the watch flags of the pages from first to last and removes them
+ * from the caches of the kinds they are watched for
+ */
+static void memory_update_watch(memory mem, uint32_t first, uint32_t last) {
+    struct memory_page *descriptor;
+    struct memory_watch *watch;
+    uint32_t page;
+
+    page = first;
+    do {
+        descriptor = memory_table_entry(mem, page);
+        if (descriptor == NULL)
+            continue;
+        descriptor->watch = 0;
+        for (watch = mem->watches; watch; watch = watch->next)
+            if (memory_overlaps(page << MEMORY_PAGE_BITS, MEMORY_PAGE_SIZE,
+                                watch))
+                descriptor->watch |= watch->kind;
+        if ((descriptor->watch & MEMORY_WATCH_READ) &&
+            (mem->read_cache[page % MEMORY_CACHE_SIZE].page == page))
+            mem->read_cache[page % MEMORY_CACHE_SIZE].page = MEMORY_NO_PAGE;
+        if ((descriptor->watch & MEMORY_WATCH_WRITE) &&
+            (mem->write_cache[page % MEMORY_CACHE_SIZE].page == page))
+            mem->write_cache[page % MEMORY_CACHE_SIZE].page = MEMORY_NO_PAGE;
+    } while (page++ != last);
+}
+
+int memory_add_watch(memory mem, uint32_t address, uint32_t size, int kind) {
+    struct memory_watch *watch;
+
+    if ((size == 0) || ((uint64_t) address + size > ((uint64_t) 1 << 32)) ||
+        (kind & ~MEMORY_WATCH_ACCESS) || (kind == 0))
+        return -1;
+    watch = malloc(sizeof(struct memory_watch));
+    if (watch == NULL)
+        return -1;
+    watch->address = address;
+    watch->size = size;
+    watch->kind = kind;
+    watch->next = mem->watches;
+    mem->watches = watch;
+    memory_update_watch(mem, address >> MEMORY_PAGE_BITS,
+                        (address + size - 1) >> MEMORY_PAGE_BITS);
+    return 0;
+}
+
+int memory_remove_watch(memory mem, uint32_t address, uint32_t size,
+                        int kind) {
+    struct memory_watch **watch, *removed;
+
+    for (watch = &mem->watches; *watch; watch = &(*watch)->next)
+        if (((*watch)->address == address) && ((*watch)->size == size) &&
+            ((*watch)->kind == kind))
+            break;
+    if (*watch == NULL)
+        return -1;
+    removed = *watch;
+    *watch = removed->next;
+    free(removed);
+    memory_update_watch(mem, address >> MEMORY_PAGE_BITS,
+                        (address + size - 1) >> MEMORY_PAGE_BITS);
+    return 0;
+}
+
+int memory_has_watches(memory mem) {
+    return mem->watches != NULL;
+}
+
+int memory_watch_hit(memory mem, uint32_t *address) {
+    if (address)
+        *address = mem->watch_address;
+    return mem->watch_hit;
+}
+
+void memory_clear_watch_hit(memory mem) {
+    mem->watch_hit = 0;
+}
+
+/* Records the first watchpoint of the given kind overlapping an access, which
+ * is only looked for if one of the pages of the access is flagged
+ */
+static void memory_check_watch(memory mem, uint32_t address, uint32_t size,
+                               int kind) {
+    struct memory_page *first, *last;
+    struct memory_watch *watch;
+
+    if (mem->watch_hit)
+        return;
+    first = memory_page(mem, address >> MEMORY_PAGE_BITS);
+    last = memory_page(mem, (address + size - 1) >> MEMORY_PAGE_BITS);
+    if (!((first && (first->watch & kind)) || (last && (last->watch & kind))))
+        return;
+    for (watch = mem->watches; watch; watch = watch->next)
+        if ((watch->kind & kind) && memory_overlaps(address, size, watch)) {
+            mem->watch_hit = watch->kind;
+            mem->watch_address = address;
+            return;
+        }
+}
+
+int memory_is_mapped(memory mem, uint32_t address) {
+    return memory_page(mem, address >> MEMORY_PAGE_BITS) != NULL;
+}
+
+void memory_mark_code(memory mem, uint32_t address) {
+    uint32_t page = address >> MEMORY_PAGE_BITS;
+    struct memory_page *descriptor = memory_page(mem, page);
+
+    if (descriptor) {
+        descriptor->code = 1;
+        if (mem->write_cache[page % MEMORY_CACHE_SIZE].page == page)
+            mem->write_cache[page % MEMORY_CACHE_SIZE].page = MEMORY_NO_PAGE;
+    }
+}
+
+/* Slow paths of the host pointer caches. Returns the content of the page, or
+ * NULL if it is not mapped, belongs to a device (or cannot be allocated, for
+ * writes).
+ */
+static uint8_t *memory_read_miss(memory mem, uint32_t page) {
+    struct memory_page *descriptor = memory_page(mem, page);
+    struct memory_cache_entry *entry;
+
+    if ((descriptor == NULL) || descriptor->device)
+        return NULL;
+    if (descriptor->watch & MEMORY_WATCH_READ)
+        return descriptor->data ? descriptor->data : zero_page;
+    entry = &mem->read_cache[page % MEMORY_CACHE_SIZE];
+    entry->page = page;
+    entry->data = descriptor->data ? descriptor->data : zero_page;
+    return entry->data;
+}
+
+/* The hook is only run for the first write to a page holding cached
+ * instructions, the page has to be marked again afterwards.
+ */
+static uint8_t *memory_write_miss(memory mem, uint32_t page) {
+    struct memory_page *descriptor = memory_page(mem, page);
+    struct memory_cache_entry *entry;
+
+    if ((descriptor == NULL) || descriptor->device)
+        return NULL;
+    if (descriptor->data == NULL) {
+        descriptor->data = calloc(MEMORY_PAGE_SIZE, 1);
+        if (descriptor->data == NULL)
+            return NULL;
+        /* The read cache may still give the zero page */
+        entry = &mem->read_cache[page % MEMORY_CACHE_SIZE];
+        if (entry->page == page)
+            entry->data = descriptor->data;
+    }
+    if (descriptor->code) {
+        descriptor->code = 0;
+        if (mem->code_hook)
+            mem->code_hook(mem->code_hook_data, page << MEMORY_PAGE_BITS);
+    }
+    memory_set_dirty(mem, page);
+    if (descriptor->watch & MEMORY_WATCH_WRITE)
+        return descriptor->data;
+    entry = &mem->write_cache[page % MEMORY_CACHE_SIZE];
+    entry->page = page;
+    entry->data = descriptor->data;
+    return entry->data;
+}
+
+/* Host address of the given guest address, through the caches. Returns NULL
+ * if the page is not mapped or belongs to a device.
+ */
+static uint8_t *memory_read_pointer(memory mem, uint32_t address) {
+    uint32_t page = address >> MEMORY_PAGE_BITS;
+    struct memory_cache_entry *entry;
+    uint8_t *data;
+
+    entry = &mem->read_cache[page % MEMORY_CACHE_SIZE];
+    data = entry->data;
+    if (entry->page != page) {
+        data = memory_read_miss(mem, page);
+        if (data == NULL)
+            return NULL;
+    }
+    return data + (address & MEMORY_OFFSET_MASK);
+}
+
+static uint8_t *memory_write_pointer(memory mem, uint32_t address) {
+    uint32_t page = address >> MEMORY_PAGE_BITS;
+    struct memory_cache_entry *entry;
+    uint8_t *data;
+
+    entry = &mem->write_cache[page % MEMORY_CACHE_SIZE];
+    data = entry->data;
+    if (entry->page != page) {
+        data = memory_write_miss(mem, page);
+        if (data == NULL)
+            return NULL;
+    }
+    return data + (address & MEMORY_OFFSET_MASK);
+}
+
+static inline int memory_crosses_page(uint32_t address, uint32_t size) {
+    return (address & MEMORY_OFFSET_MASK) > MEMORY_PAGE_SIZE - size;
+}
+
+/* Fast paths: host address for an access of size bytes that hits in the cache
+ * and does not cross a page boundary, NULL otherwise.
+ */
+static inline uint8_t *memory_read_hit(memory mem, uint32_t address,
+                                       uint32_t size) {
+    uint32_t page = address >> MEMORY_PAGE_BITS;
+    struct memory_cache_entry *entry;
+
+    entry = &mem->read_cache[page % MEMORY_CACHE_SIZE];
+    if ((entry->page != page) || memory_crosses_page(address, size))
+        return NULL;
+    return entry->data + (address & MEMORY_OFFSET_MASK);
+}
+
+static inline uint8_t *memory_write_hit(memory mem, uint32_t address,
+                                        uint32_t size) {
+    uint32_t page = address >> MEMORY_PAGE_BITS;
+    struct memory_cache_entry *entry;
+
+    entry = &mem->write_cache[page % MEMORY_CACHE_SIZE];
+    if ((entry->page != page) || memory_crosses_page(address, size))
+        return NULL;
+    return entry->data + (address & MEMORY_OFFSET_MASK);
+}
+
+/* Pages hold the bytes in the order of their addresses, so that byte accesses
+ * and block copies need no conversion. Halfwords and words are moved at once
+ * and byte swapped if the host has the other endianess. The accesses that
+ * depend on the endianess are written once, with the endianess as a constant
+ * parameter, and instantiated for both endianesses by MEMORY_ACCESS.
+ */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define HOST_BIG_ENDIAN 1
+#else
+#define HOST_BIG_ENDIAN 0
+#endif
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+ALWAYS_INLINE uint16_t load_half(uint8_t *position, int big_endian) {
+    uint16_t value;
+
+    memcpy(&value, position, 2);
+    return (big_endian != HOST_BIG_ENDIAN) ? __builtin_bswap16(value) : value;
+}
+
+ALWAYS_INLINE uint32_t load_word(uint8_t *position, int big_endian) {
+    uint32_t value;
+
+    memcpy(&value, position, 4);
+    return (big_endian != HOST_BIG_ENDIAN) ? __builtin_bswap32(value) : value;
+}
+
+ALWAYS_INLINE void store_half(uint8_t *position, uint16_t value,
+                              int big_endian) {
+    if (big_endian != HOST_BIG_ENDIAN)
+        value = __builtin_bswap16(value);
+    memcpy(position, &value, 2);
+}
+
+ALWAYS_INLINE void store_word(uint8_t *position, uint32_t value,
+                              int big_endian) {
+    if (big_endian != HOST_BIG_ENDIAN)
+        value = __builtin_bswap32(value);
+    memcpy(position, &value, 4);
+}
+
+/* Accesses to the pages of devices, which always miss the caches. The access
+ * has to fit in the device, and the device to have the matching callback.
+ */
+static int read_device(memory mem, uint32_t address, uint32_t size,
+                       uint32_t *value) {
+    struct memory_page *descriptor;
+    struct memory_device *device;
+    uint32_t offset;
+
+    descriptor = memory_page(mem, address >> MEMORY_PAGE_BITS);
+    if ((descriptor == NULL) || (descriptor->device == NULL))
+        return -1;
+    device = descriptor->device;
+    offset = address - device->address;
+    if (((uint64_t) offset + size > device->size) || (device->read == NULL))
+        return -1;
+    return device->read(device->data, offset, size, value);
+}
+
+/* Like memory_write_miss, runs the hook for a page holding cached code */
+static int write_device(memory mem, uint32_t address, uint32_t size,
+                        uint32_t value) {
+    struct memory_page *descriptor;
+    struct memory_device *device;
+    uint32_t offset;
+
+    descriptor = memory_page(mem, address >> MEMORY_PAGE_BITS);
+    if ((descriptor == NULL) || (descriptor->device == NULL))
+        return -1;
+    device = descriptor->device;
+    offset = address - device->address;
+    if (((uint64_t) offset + size > device->size) || (device->write == NULL))
+        return -1;
+    if (descriptor->code) {
+        descriptor->code = 0;
+        if (mem->code_hook)
+            mem->code_hook(mem->code_hook_data,
+                           address & ~MEMORY_OFFSET_MASK);
+    }
+    return device->write(device->data, offset, size, value);
+}
+
+/* Accesses missing the cache or crossing a page boundary, kept out of line.
+ * Accesses crossing a page boundary are made byte per byte, all the bytes are
+ * checked before any of them is written. They cannot reach a device.
+ */
+static int access_slow(memory mem, uint32_t address, uint32_t size,
+                       uint32_t *value, int big_endian) {
+    uint8_t *position;
+    int i;
+
+    if (memory_crosses_page(address, size)) {
+        *value = 0;
+        for (i=0; i<size; i++) {
+            position = memory_read_pointer(mem, address + i);
+            if (position == NULL)
+                return -1;
+            if (big_endian)
+                *value = (*value << 8) | *position;
+            else
+                *value |= (uint32_t) *position << (8*i);
+        }
+        return 0;
+    }
+    position = memory_read_pointer(mem, address);
+    if (position == NULL)
+        return read_device(mem, address, size, value);
+    switch (size) {
+      case 1:
+        *value = *position;
+        break;
+      case 2:
+        *value = load_half(position, big_endian);
+        break;
+      default:
+        *value = load_word(position, big_endian);
+    }
+    return 0;
+}
+
+/* Only the data accesses of the program are checked against the watchpoints,
+ * which cannot be cached
+ */
+static __attribute__((noinline)) int read_slow(memory mem, uint32_t address,
+                                               uint32_t size, uint32_t *value,
+                                               int big_endian) {
+    if (access_slow(mem, address, size, value, big_endian))
+        return -1;
+    if (mem->watches)
+        memory_check_watch(mem, address, size, MEMORY_WATCH_READ);
+    return 0;
+}
+
+static __attribute__((noinline)) int write_slow(memory mem, uint32_t address,
+                                                uint32_t size, uint32_t value,
+                                                int big_endian) {
+    uint8_t *position;
+    int i;
+
+    if (memory_crosses_page(address, size)) {
+        if ((memory_write_pointer(mem, address) == NULL) ||
+            (memory_write_pointer(mem, address + size - 1) == NULL))
+            return -1;
+        for (i=0; i<size; i++) {
+            position = memory_write_pointer(mem, address + i);
+            if (position == NULL)
+                return -1;
+            if (big_endian)
+                *position = value >> (8*(size-1-i));
+            else
+                *position = value >> (8*i);
+        }
+    } else {
+        position = memory_write_pointer(mem, address);
+        if (position == NULL) {
+            if (write_device(mem, address, size, value))
+                return -1;
+        } else {
+            switch (size) {
+              case 1:
+                *position = value;
+                break;
+              case 2:
+                store_half(position, value, big_endian);
+                break;
+              default:
+                store_word(position, value, big_endian);
+            }
+        }
+    }
+    if (mem->watches)
+        memory_check_watch(mem, address, size, MEMORY_WATCH_WRITE);
+    return 0;
+}
+
+int memory_read_byte(memory mem, uint32_t address, uint8_t *value) {
+    uint8_t *position = memory_read_hit(mem, address, 1);
+    uint32_t word;
+
+    if (position == NULL) {
+        if (read_slow(mem, address, 1, &word, 0))
+            return -1;
+        *value = word;
+        return 0;
+    }
+    *value = *position;
+    return 0;
+}
+
 int memory_write_byte(memory mem, uint32_t address, uint8_t value) {
-    return -1;
+    uint8_t *position = memory_write_hit(mem, address, 1);
+
+    if (position == NULL)
+        return write_slow(mem, address, 1, value, 0);
+    *position = value;
+    return 0;
+}
+
+ALWAYS_INLINE int read_half(memory mem, uint32_t address, uint16_t *value,
+                            int big_endian) {
+    uint8_t *position = memory_read_hit(mem, address, 2);
+    uint32_t word;
+
+    if (position == NULL) {
+        if (read_slow(mem, address, 2, &word, big_endian))
+            return -1;
+        *value = word;
+        return 0;
+    }
+    *value = load_half(position, big_endian);
+    return 0;
+}
+
+ALWAYS_INLINE int read_word(memory mem, uint32_t address, uint32_t *value,
+                            int big_endian) {
+    uint8_t *position = memory_read_hit(mem, address, 4);
+
+    if (position == NULL)
+        return read_slow(mem, address, 4, value, big_endian);
+    *value = load_word(position, big_endian);
+    return 0;
+}
+
+ALWAYS_INLINE int write_half(memory mem, uint32_t address, uint16_t value,
+                             int big_endian) {
+    uint8_t *position = memory_write_hit(mem, address, 2);
+
+    if (position == NULL)
+        return write_slow(mem, address, 2, value, big_endian);
+    store_half(position, value, big_endian);
+    return 0;
+}
+
+ALWAYS_INLINE int write_word(memory mem, uint32_t address, uint32_t value,
+                             int big_endian) {
+    uint8_t *position = memory_write_hit(mem, address, 4);
+
+    if (position == NULL)
+        return write_slow(mem, address, 4, value, big_endian);
+    store_word(position, value, big_endian);
+    return 0;
+}
+
+/* Checks that the count words at address are all mapped. Returns -1 if they
+ * are not, 1 if some of them belong to a device or are watched and 0
+ * otherwise.
+ */
+static int memory_words_pages(memory mem, uint32_t address, int count) {
+    struct memory_page *descriptor;
+    uint32_t page, last;
+    int device = 0;
+
+    if (count == 0)
+        return 0;
+    if ((uint64_t) address + 4*count > ((uint64_t) 1 << 32))
+        return -1;
+    last = (address + 4*count - 1) >> MEMORY_PAGE_BITS;
+    for (page = address >> MEMORY_PAGE_BITS; page <= last; page++) {
+        descriptor = memory_page(mem, page);
+        if (descriptor == NULL)
+            return -1;
+        if (descriptor->device || descriptor->watch)
+            device = 1;
+    }
+    return device;
+}
+
+/* The words are copied page per page, or one by one if they are not aligned
+ * or if some of them belong to a device. Loops are kept simple so that the
+ * compiler vectorizes the byte swap.
+ */
+ALWAYS_INLINE int read_words(memory mem, uint32_t address, uint32_t *values,
+                             int count, int big_endian) {
+    uint8_t *position;
+    int i, chunk, pages;
+
+    pages = memory_words_pages(mem, address, count);
+    if (pages < 0)
+        return -1;
+    if ((address & 3) || pages) {
+        for (i=0; i<count; i++)
+            if (read_word(mem, address + 4*i, &values[i], big_endian))
+                return -1;
+        return 0;
+    }
+    while (count > 0) {
+        chunk = (MEMORY_PAGE_SIZE - (address & MEMORY_OFFSET_MASK)) / 4;
+        if (chunk > count)
+            chunk = count;
+        position = memory_read_pointer(mem, address);
+        memcpy(values, position, 4*chunk);
+        if (big_endian != HOST_BIG_ENDIAN)
+            for (i=0; i<chunk; i++)
+                values[i] = __builtin_bswap32(values[i]);
+        address += 4*chunk;
+        values += chunk;
+        count -= chunk;
+    }
+    return 0;
+}
+
+ALWAYS_INLINE int write_words(memory mem, uint32_t address, uint32_t *values,
+                              int count, int big_endian) {
+    uint8_t *position;
+    int i, chunk, pages;
+
+    pages = memory_words_pages(mem, address, count);
+    if (pages < 0)
+        return -1;
+    if ((address & 3) || pages) {
+        for (i=0; i<count; i++)
+            if (write_word(mem, address + 4*i, values[i], big_endian))
+                return -1;
+        return 0;
+    }
+    while (count > 0) {
+        chunk = (MEMORY_PAGE_SIZE - (address & MEMORY_OFFSET_MASK)) / 4;
+        if (chunk > count)
+            chunk = count;
+        position = memory_write_pointer(mem, address);
+        if (position == NULL)
+            return -1;
+        if (big_endian != HOST_BIG_ENDIAN)
+            for (i=0; i<chunk; i++)
+                store_word(position + 4*i, values[i], big_endian);
+        else
+            memcpy(position, values, 4*chunk);
+        address += 4*chunk;
+        values += chunk;
+        count -= chunk;
+    }
+    return 0;
+}
+
+#define MEMORY_ACCESS(endianess, big_endian) \
+static int read_half_##endianess(memory mem, uint32_t address, \
+                                 uint16_t *value) { \
+    return read_half(mem, address, value, big_endian); \
+} \
+static int read_word_##endianess(memory mem, uint32_t address, \
+                                 uint32_t *value) { \
+    return read_word(mem, address, value, big_endian); \
+} \
+static int write_half_##endianess(memory mem, uint32_t address, \
+                                  uint16_t value) { \
+    return write_half(mem, address, value, big_endian); \
+} \
+static int write_word_##endianess(memory mem, uint32_t address, \
+                                  uint32_t value) { \
+    return write_word(mem, address, value, big_endian); \
+} \
+static int read_words_##endianess(memory mem, uint32_t address, \
+                                  uint32_t *values, int count) { \
+    return read_words(mem, address, values, count, big_endian); \
+} \
+static int write_words_##endianess(memory mem, uint32_t address, \
+                                   uint32_t *values, int count) { \
+    return write_words(mem, address, values, count, big_endian); \
+} \
+const struct memory_access memory_##endianess##_access = { \
+    read_half_##endianess, read_word_##endianess, \
+    write_half_##endianess, write_word_##endianess, \
+    read_words_##endianess, write_words_##endianess \
+};
+
+MEMORY_ACCESS(big_endian, 1)
+MEMORY_ACCESS(little_endian, 0)
+
+/* Accesses with the endianess of the memory */
+const struct memory_access *memory_get_access(memory mem) {
+    return mem->access;
+}
+
+int memory_read_half(memory mem, uint32_t address, uint16_t *value) {
+    return mem->access->read_half(mem, address, value);
+}
+
+int memory_read_word(memory mem, uint32_t address, uint32_t *value) {
+    return mem->access->read_word(mem, address, value);
 }
 
 int memory_write_half(memory mem, uint32_t address, uint16_t value) {
-    return -1;
+    return mem->access->write_half(mem, address, value);
 }
 
 int memory_write_word(memory mem, uint32_t address, uint32_t value) {
-    return -1;
+    return mem->access->write_word(mem, address, value);
+}
+
+int memory_read_words(memory mem, uint32_t address, uint32_t *values,
+                      int count) {
+    return mem->access->read_words(mem, address, values, count);
+}
+
+int memory_write_words(memory mem, uint32_t address, uint32_t *values,
+                       int count) {
+    return mem->access->write_words(mem, address, values, count);
+}
+
+int memory_fetch_half(memory mem, uint32_t address, uint16_t *value) {
+    uint8_t *position = memory_read_hit(mem, address, 2);
+    uint32_t word;
+
+    if (position == NULL) {
+        if (access_slow(mem, address, 2, &word, mem->is_big_endian))
+            return -1;
+        *value = word;
+        return 0;
+    }
+    *value = load_half(position, mem->is_big_endian);
+    return 0;
+}
+
+int memory_fetch_word(memory mem, uint32_t address, uint32_t *value) {
+    uint8_t *position = memory_read_hit(mem, address, 4);
+
+    if (position == NULL)
+        return access_slow(mem, address, 4, value, mem->is_big_endian);
+    *value = load_word(position, mem->is_big_endian);
+    return 0;
+}
+
+/* Blocks are copied page per page between the host buffer and the pages,
+ * stopping at the first page not mapped or belonging to a device, or at the
+ * end of the address space.
+ */
+size_t memory_read_block(memory mem, uint32_t address, void *buffer,
+                         size_t size) {
+    uint8_t *position, *destination = buffer;
+    size_t done, chunk;
+
+    if (size > ((uint64_t) 1 << 32) - address)
+        size = ((uint64_t) 1 << 32) - address;
+    for (done = 0; done < size; done += chunk) {
+        chunk = MEMORY_PAGE_SIZE - ((address + done) & MEMORY_OFFSET_MASK);
+        if (chunk > size - done)
+            chunk = size - done;
+        position = memory_read_pointer(mem, address + done);
+        if (position == NULL)
+            break;
+        memcpy(destination + done, position, chunk);
+    }
+    return done;
+}
+
+size_t memory_write_block(memory mem, uint32_t address, const void *buffer,
+                          size_t size) {
+    const uint8_t *source = buffer;
+    uint8_t *position;
+    size_t done, chunk;
+
+    if (size > ((uint64_t) 1 << 32) - address)
+        size = ((uint64_t) 1 << 32) - address;
+    for (done = 0; done < size; done += chunk) {
+        chunk = MEMORY_PAGE_SIZE - ((address + done) & MEMORY_OFFSET_MASK);
+        if (chunk > size - done)
+            chunk = size - done;
+        position = memory_write_pointer(mem, address + done);
+        if (position == NULL)
+            break;
+        memcpy(position, source + done, chunk);
+    }
+    return done;
 }
@@ -22,19 +22,114 @@ Contact: Guillaume.Huard@imag.fr
 */
 #ifndef __MEMORY_H__
 #define __MEMORY_H__
+#include <stdio.h>
 #include <stdint.h>
 #include <sys/types.h>
 
 typedef struct memory_data *memory;
 
+/* The memory is sparse, made of pages allocated on their first write.
+ * This is also the granularity at which the memory keeps track of pages holding
+ * instructions cached by the core.
+ */
+#define MEMORY_PAGE_BITS 12
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_BITS)
+
+typedef void (*memory_code_hook)(void *data, uint32_t page_address);
+
+/* The memory covers the whole 32 bits address space, but only the regions
+ * mapped are accessible, other accesses fail. memory_create maps a first
+ * region of size bytes at address 0 (none if size is 0), memory_map adds a
+ * region, extended to whole pages. memory_get_size gives the total size of the
+ * regions.
+ */
 memory memory_create(size_t size, int is_big_endian);
+int memory_map(memory mem, uint32_t address, size_t size);
+
+/* Once enabled, the regions of at least 2 MiB mapped afterwards are backed by
+ * host huge pages, explicit ones if reserved, transparent ones otherwise, or
+ * by regular pages if neither is available. Their pages are no longer
+ * allocated on their first write, but touching them is enough for the host to
+ * provide them. Files mapped by memory_map_file keep their own pages.
+ * memory_print_statistics tells whether huge pages have been obtained.
+ */
+void memory_set_huge_pages(memory mem, int enabled);
+void memory_print_statistics(memory mem, FILE *out);
+
+/* Memory mapped devices, such as UARTs, timers or interrupt controllers.
+ * memory_map_device gives to a device the pages covering size bytes at
+ * address, replacing the memory they might hold, and fails if one of these
+ * pages already belongs to a device. Accesses to the device, but the ones
+ * crossing a page boundary, are passed to its callbacks with their offset from
+ * address, their size (1, 2 or 4 bytes) and their value, as seen by the
+ * processor. Accesses outside of the device, or for which it has no callback,
+ * fail. The callbacks return 0 on success or -1 on failure.
+ * Device pages are never in the caches of host pointers, so that accesses
+ * hitting the caches, which only hold memory, do not check for devices.
+ */
+typedef int (*memory_device_read)(void *data, uint32_t offset, uint8_t size,
+                                  uint32_t *value);
+typedef int (*memory_device_write)(void *data, uint32_t offset, uint8_t size,
+                                   uint32_t value);
+int memory_map_device(memory mem, uint32_t address, size_t size,
+                      memory_device_read read, memory_device_write write,
+                      void *data);
+
+/* Maps the content of the file at path at address, which must be aligned on a
+ * page, as a region of the size of the file. The file is not copied: the pages
+ * of the region are the ones of the file mapped in the host, loaded on their
+ * first access. With shared set, writes go to the file, which keeps them after
+ * the simulation. Otherwise, they are private to mem (copy on write) and the
+ * file may be read only. The previous content of the pages is discarded. Fails
+ * if one of them belongs to a device.
+ */
+int memory_map_file(memory mem, uint32_t address, const char *path,
+                    int shared);
+int memory_is_mapped(memory mem, uint32_t address);
+
+/* Watchpoints on the size bytes at address, triggered by the data reads
+ * and/or writes overlapping them, depending on kind. The pages they overlap
+ * are flagged and no longer served by the caches for this kind of accesses,
+ * only the accesses to flagged pages are compared to the watchpoints.
+ * memory_remove_watch takes the same parameters as memory_add_watch. Both
+ * return 0 on success and -1 on failure.
+ * memory_watch_hit returns the kind of the first watchpoint hit since the last
+ * call to memory_clear_watch_hit, 0 if none, and the address of the access
+ * that hit it if address is not NULL.
+ */
+#define MEMORY_WATCH_WRITE 1
+#define MEMORY_WATCH_READ 2
+#define MEMORY_WATCH_ACCESS (MEMORY_WATCH_WRITE | MEMORY_WATCH_READ)
+int memory_add_watch(memory mem, uint32_t address, uint32_t size, int kind);
+int memory_remove_watch(memory mem, uint32_t address, uint32_t size,
+                        int kind);
+int memory_has_watches(memory mem);
+int memory_watch_hit(memory mem, uint32_t *address);
+void memory_clear_watch_hit(memory mem);
+
+/* Pages written since their dirty bit was last cleared, by any write,
+ * including the transfers of words and blocks, or mapped from a file. Writes
+ * to devices do not mark their pages.
+ * memory_next_dirty finds the first dirty page at or after address, whose
+ * address replaces it, and returns 0, or returns -1 if there is none. The
+ * following ones are found from the address of the page plus MEMORY_PAGE_SIZE,
+ * until the end of the address space. It skips the parts of the address space
+ * never accessed without looking at them.
+ * memory_clear_dirty clears the bits of the pages overlapping the size bytes
+ * at address.
+ */
+int memory_is_dirty(memory mem, uint32_t address);
+int memory_next_dirty(memory mem, uint32_t *address);
+void memory_clear_dirty(memory mem, uint32_t address, size_t size);
+
 size_t memory_get_size(memory mem);
+int memory_is_big_endian(memory mem);
 void memory_destroy(memory mem);
 
 /* All these functions perform a read/write access to a byte/half/word data at
  * address a in mem. The result is respectively taken from or stored to the
- * parameter value. The access is made using the given endianess (be == 1 for a
- * big endian access and be == 0 for a little endian access).
+ * parameter value. The access is made using the endianess of mem, see
+ * memory_access for the other one.
  * The return value indicates a succes (0) or a failure (-1).
  */
 int memory_read_byte(memory mem, uint32_t address, uint8_t *value);
@@ -44,4 +139,58 @@ int memory_write_byte(memory mem, uint32_t address, uint8_t value);
 int memory_write_half(memory mem, uint32_t address, uint16_t value);
 int memory_write_word(memory mem, uint32_t address, uint32_t value);
 
+/* Reads of instructions and of translation tables, which are never reported
+ * as watchpoint hits. Same as memory_read_half/word otherwise.
+ */
+int memory_fetch_half(memory mem, uint32_t address, uint16_t *value);
+int memory_fetch_word(memory mem, uint32_t address, uint32_t *value);
+
+/* Transfers of count consecutive words starting at address, all or none of
+ * them are transferred (unless a device fails). The range is checked once and
+ * copied at once, with a byte swap of each word when the endianess of mem and
+ * of the host differ.
+ */
+int memory_read_words(memory mem, uint32_t address, uint32_t *values,
+                      int count);
+int memory_write_words(memory mem, uint32_t address, uint32_t *values,
+                       int count);
+
+/* Transfers of size bytes between mem and a host buffer, in the order of their
+ * addresses, so without any endianess conversion. The return value is the
+ * number of bytes transferred, which is less than size if the block reaches a
+ * page that is not mapped or that belongs to a device.
+ */
+size_t memory_read_block(memory mem, uint32_t address, void *buffer,
+                         size_t size);
+size_t memory_write_block(memory mem, uint32_t address, const void *buffer,
+                          size_t size);
+
+/* The accesses depending on the endianess are compiled once for each
+ * endianess, so that each access does not have to check it. These tables
+ * give them, the ones of the endianess of mem being also returned by
+ * memory_get_access.
+ */
+struct memory_access {
+    int (*read_half)(memory mem, uint32_t address, uint16_t *value);
+    int (*read_word)(memory mem, uint32_t address, uint32_t *value);
+    int (*write_half)(memory mem, uint32_t address, uint16_t value);
+    int (*write_word)(memory mem, uint32_t address, uint32_t value);
+    int (*read_words)(memory mem, uint32_t address, uint32_t *values,
+                      int count);
+    int (*write_words)(memory mem, uint32_t address, uint32_t *values,
+                       int count);
+};
+
+extern const struct memory_access memory_big_endian_access;
+extern const struct memory_access memory_little_endian_access;
+const struct memory_access *memory_get_access(memory mem);
+
+/* memory_mark_code flags the page containing address as holding cached
+ * instructions. The next write to this page, whatever its origin, calls the
+ * hook registered with memory_set_code_hook with the address of the page and
+ * clears the flag.
+ */
+void memory_set_code_hook(memory mem, memory_code_hook hook, void *data);
+void memory_mark_code(memory mem, uint32_t address);
+
 #endif
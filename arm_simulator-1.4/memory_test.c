@@ -22,6 +22,9 @@ Contact: Guillaume.Huard@imag.fr
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "memory.h"
 #include "util.h"
 
@@ -67,13 +70,95 @@ int compare_with_sim(void *a, memory m, size_t size, int reverse) {
     return 1;
 }
 
+/* Throughput of the accesses of each size, made in sequence over a region of
+ * BENCHMARK_SIZE bytes, with the given endianess
+ */
+#define BENCHMARK_SIZE 0x10000
+#define BENCHMARK_ACCESSES (1 << 24)
+
+void print_throughput(char *name, clock_t start) {
+    double time = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    printf("- %s: %.1f millions per second\n", name,
+           time > 0 ? BENCHMARK_ACCESSES / time / 1e6 : 0.0);
+}
+
+/* Device made of 4 registers, recording the size of the last access */
+struct test_device {
+    uint32_t registers[4];
+    uint8_t last_size;
+};
+
+int test_device_read(void *data, uint32_t offset, uint8_t size,
+                     uint32_t *value) {
+    struct test_device *device = data;
+
+    device->last_size = size;
+    *value = device->registers[offset / 4];
+    return 0;
+}
+
+int test_device_write(void *data, uint32_t offset, uint8_t size,
+                      uint32_t value) {
+    struct test_device *device = data;
+
+    device->last_size = size;
+    device->registers[offset / 4] = value;
+    return 0;
+}
+
+void benchmark(int is_big_endian) {
+    char *endianess[] = { "little", "big" };
+    memory m;
+    clock_t start;
+    uint32_t i, word;
+    uint16_t half;
+    uint8_t byte;
+
+    m = memory_create(BENCHMARK_SIZE, is_big_endian);
+    if (m == NULL) {
+        fprintf(stderr, "Error when creating simulated memory\n");
+        exit(1);
+    }
+    printf("Throughput of %s endian accesses :\n", endianess[is_big_endian]);
+    start = clock();
+    for (i=0; i<BENCHMARK_ACCESSES; i++)
+        memory_write_word(m, (4*i) % BENCHMARK_SIZE, i);
+    print_throughput("word writes", start);
+    start = clock();
+    for (i=0; i<BENCHMARK_ACCESSES; i++)
+        memory_read_word(m, (4*i) % BENCHMARK_SIZE, &word);
+    print_throughput("word reads", start);
+    start = clock();
+    for (i=0; i<BENCHMARK_ACCESSES; i++)
+        memory_write_half(m, (2*i) % BENCHMARK_SIZE, i);
+    print_throughput("half writes", start);
+    start = clock();
+    for (i=0; i<BENCHMARK_ACCESSES; i++)
+        memory_read_half(m, (2*i) % BENCHMARK_SIZE, &half);
+    print_throughput("half reads", start);
+    start = clock();
+    for (i=0; i<BENCHMARK_ACCESSES; i++)
+        memory_write_byte(m, i % BENCHMARK_SIZE, i);
+    print_throughput("byte writes", start);
+    start = clock();
+    for (i=0; i<BENCHMARK_ACCESSES; i++)
+        memory_read_byte(m, i % BENCHMARK_SIZE, &byte);
+    print_throughput("byte reads", start);
+    memory_destroy(m);
+}
+
 int main() {
     char *endianess[] = { "little", "big" };
-    memory m[2];
+    memory m[2], sparse;
+    struct test_device device = { { 0, 0, 0, 0 }, 0 };
+    uint32_t words[2], words_read[8], address;
     uint32_t word_value = 0x11223344, word_read;
     uint16_t half_value = 0x5566, half_read;
-    uint8_t *position;
-    int i;
+    uint8_t byte_read, *position, block[0x3000], block_read[0x3000];
+    char path[32];
+    FILE *file;
+    int i, result;
 
     m[1] = memory_create(4,1);
     m[0] = memory_create(4,0);
@@ -119,5 +204,232 @@ int main() {
     memory_write_half(m[1-is_big_endian()], 0, half_value);
     print_test(compare_with_sim(&half_value, m[1-is_big_endian()], 2, 1));
 
+    printf("Sparse memory with regions at 0x20000000 and 0x40000000 :\n");
+    sparse = memory_create(0, 1);
+    if ((sparse == NULL) || memory_map(sparse, 0x20000000, 0x40000) ||
+        memory_map(sparse, 0x40000000, 0x1000)) {
+        fprintf(stderr, "Error when mapping simulated memory\n");
+        exit(1);
+    }
+    printf("- read of a page never written, ");
+    print_test((memory_read_word(sparse, 0x20010000, &word_read) == 0) &&
+               (word_read == 0));
+    printf("- word written and read at the end of a region, ");
+    print_test((memory_write_word(sparse, 0x2003FFFC, word_value) == 0) &&
+               (memory_read_word(sparse, 0x2003FFFC, &word_read) == 0) &&
+               (word_read == word_value));
+    printf("- word written and read across two pages, ");
+    print_test((memory_write_word(sparse, 0x20000FFE, word_value) == 0) &&
+               (memory_read_word(sparse, 0x20000FFE, &word_read) == 0) &&
+               (word_read == word_value));
+    printf("- accesses outside of the regions fail, ");
+    print_test((memory_read_word(sparse, 0x20040000, &word_read) == -1) &&
+               (memory_write_byte(sparse, 0x3FFFFFFF, 0) == -1) &&
+               (memory_write_word(sparse, 0x40000FFE, word_value) == -1) &&
+               (memory_write_byte(sparse, 0x40000FFF, 0) == 0));
+    printf("- size of the regions, ");
+    print_test(memory_get_size(sparse) == 0x41000);
+    printf("- block written and read up to the end of a region, ");
+    for (i=0; i<sizeof(block); i++)
+        block[i] = i * 7;
+    print_test((memory_write_block(sparse, 0x2003E800, block,
+                                   sizeof(block)) == 0x1800) &&
+               (memory_read_block(sparse, 0x2003E800, block_read,
+                                  sizeof(block)) == 0x1800) &&
+               (memcmp(block, block_read, 0x1800) == 0));
+    printf("- device mapped in a region, word and half accesses, ");
+    print_test((memory_write_word(sparse, 0x20001000, 1) == 0) &&
+               (memory_map_device(sparse, 0x20001000, 0x10, test_device_read,
+                                  test_device_write, &device) == 0) &&
+               (memory_read_word(sparse, 0x20001000, &word_read) == 0) &&
+               (word_read == 0) &&
+               (memory_write_word(sparse, 0x20001004, word_value) == 0) &&
+               (device.registers[1] == word_value) &&
+               (memory_read_half(sparse, 0x20001004, &half_read) == 0) &&
+               (half_read == (uint16_t) word_value) &&
+               (device.last_size == 2));
+    printf("- device accessed by words, ");
+    words[0] = 1;
+    words[1] = 2;
+    print_test((memory_write_words(sparse, 0x20001008, words, 2) == 0) &&
+               (device.registers[2] == 1) && (device.registers[3] == 2) &&
+               (memory_read_words(sparse, 0x20001004, words, 2) == 0) &&
+               (words[0] == word_value) && (words[1] == 1));
+    printf("- accesses outside of the device fail, ");
+    print_test((memory_read_word(sparse, 0x20001010, &word_read) == -1) &&
+               (memory_write_word(sparse, 0x20000FFE, word_value) == -1) &&
+               (memory_read_block(sparse, 0x20000F00, block_read, 0x200) ==
+                0x100) &&
+               (memory_map_device(sparse, 0x20001800, 4, test_device_read,
+                                  test_device_write, &device) == -1));
+    memory_destroy(sparse);
+
+    printf("Files mapped at 0x10000000 :\n");
+    strcpy(path, "/tmp/memory_test_XXXXXX");
+    file = fdopen(mkstemp(path), "w+");
+    if (file == NULL) {
+        fprintf(stderr, "Error when creating the file to map\n");
+        exit(1);
+    }
+    for (i=0; i<0x1800; i++)
+        fputc(i * 7, file);
+    fflush(file);
+    sparse = memory_create(0, 1);
+    if (sparse == NULL) {
+        fprintf(stderr, "Error when creating simulated memory\n");
+        exit(1);
+    }
+    printf("- private mapping, content and writes not reaching the file, ");
+    print_test((memory_map_file(sparse, 0x10000000, path, 0) == 0) &&
+               (memory_get_size(sparse) == 0x2000) &&
+               (memory_read_block(sparse, 0x10000000, block_read, 0x2000) ==
+                0x2000) &&
+               (memcmp(block, block_read, 0x1800) == 0) &&
+               (block_read[0x1800] == 0) &&
+               (memory_write_byte(sparse, 0x10000001, 0xAA) == 0) &&
+               (pread(fileno(file), block_read, 2, 0) == 2) &&
+               (block_read[1] == block[1]) &&
+               (memory_read_word(sparse, 0x10002000, &word_read) == -1));
+    memory_destroy(sparse);
+    sparse = memory_create(0, 1);
+    if (sparse == NULL) {
+        fprintf(stderr, "Error when creating simulated memory\n");
+        exit(1);
+    }
+    printf("- shared mapping, writes reaching the file, unaligned mapping and "
+           "mapping over a device fail, ");
+    result = (memory_map_file(sparse, 0x10000000, path, 1) == 0) &&
+             (memory_write_word(sparse, 0x10000000, word_value) == 0) &&
+             (memory_map_file(sparse, 0x10001800, path, 1) == -1) &&
+             (memory_map_device(sparse, 0x10001000, 4, test_device_read,
+                                test_device_write, &device) == 0) &&
+             (memory_map_file(sparse, 0x10000000, path, 0) == -1);
+    memory_destroy(sparse);
+    print_test(result && (pread(fileno(file), block_read, 4, 0) == 4) &&
+               (block_read[0] == 0x11) && (block_read[3] == 0x44));
+    fclose(file);
+    unlink(path);
+
+    printf("Watchpoints at 0x30000100 :\n");
+    sparse = memory_create(0, 1);
+    if ((sparse == NULL) || memory_map(sparse, 0x30000000, 0x2000)) {
+        fprintf(stderr, "Error when creating simulated memory\n");
+        exit(1);
+    }
+    printf("- accesses around a write watchpoint and reads are not hits, ");
+    print_test((memory_write_word(sparse, 0x30000100, word_value) == 0) &&
+               (memory_read_word(sparse, 0x30000100, &word_read) == 0) &&
+               (memory_add_watch(sparse, 0x30000100, 4,
+                                 MEMORY_WATCH_WRITE) == 0) &&
+               memory_has_watches(sparse) &&
+               (memory_read_word(sparse, 0x30000100, &word_read) == 0) &&
+               (word_read == word_value) &&
+               (memory_write_word(sparse, 0x300000FC, 0) == 0) &&
+               (memory_write_byte(sparse, 0x30000104, 0) == 0) &&
+               (memory_write_word(sparse, 0x30001100, 0) == 0) &&
+               (memory_watch_hit(sparse, NULL) == 0));
+    printf("- write hit recorded with its address, ");
+    print_test((memory_write_byte(sparse, 0x30000102, 0x55) == 0) &&
+               (memory_write_word(sparse, 0x30000100, 0) == 0) &&
+               (memory_watch_hit(sparse, &address) == MEMORY_WATCH_WRITE) &&
+               (address == 0x30000102));
+    memory_clear_watch_hit(sparse);
+    printf("- read hit by a block of words, removal, ");
+    print_test((memory_add_watch(sparse, 0x30000200, 1,
+                                 MEMORY_WATCH_READ) == 0) &&
+               (memory_read_words(sparse, 0x300001F0, words_read, 8) == 0) &&
+               (memory_watch_hit(sparse, &address) == MEMORY_WATCH_READ) &&
+               (address == 0x30000200) &&
+               (memory_remove_watch(sparse, 0x30000200, 1,
+                                    MEMORY_WATCH_READ) == 0) &&
+               (memory_remove_watch(sparse, 0x30000100, 4,
+                                    MEMORY_WATCH_READ) == -1) &&
+               (memory_remove_watch(sparse, 0x30000100, 4,
+                                    MEMORY_WATCH_WRITE) == 0) &&
+               !memory_has_watches(sparse));
+    memory_clear_watch_hit(sparse);
+    printf("- no hit once removed, instruction fetches never hit, ");
+    print_test((memory_write_word(sparse, 0x30000100, 0) == 0) &&
+               (memory_read_byte(sparse, 0x30000200, &byte_read) == 0) &&
+               (memory_add_watch(sparse, 0x30000100, 4,
+                                 MEMORY_WATCH_ACCESS) == 0) &&
+               (memory_fetch_word(sparse, 0x30000100, &word_read) == 0) &&
+               (memory_watch_hit(sparse, NULL) == 0) &&
+               (memory_read_half(sparse, 0x30000102, &half_read) == 0) &&
+               (memory_watch_hit(sparse, NULL) == MEMORY_WATCH_ACCESS));
+    memory_destroy(sparse);
+
+    printf("Dirty pages at 0x40000000 :\n");
+    sparse = memory_create(0, 1);
+    if ((sparse == NULL) || memory_map(sparse, 0x40000000, 0x10000) ||
+        memory_map(sparse, 0xFFFFF000, 0x1000)) {
+        fprintf(stderr, "Error when creating simulated memory\n");
+        exit(1);
+    }
+    printf("- reads leave the pages clean, writes of any kind mark them, ");
+    address = 0;
+    result = (memory_read_word(sparse, 0x40000000, &word_read) == 0) &&
+             !memory_is_dirty(sparse, 0x40000000) &&
+             (memory_next_dirty(sparse, &address) == -1) &&
+             (memory_write_byte(sparse, 0x40001FFF, 1) == 0) &&
+             (memory_write_words(sparse, 0x40004FFC, words, 2) == 0) &&
+             (memory_write_block(sparse, 0xFFFFFFF0, block, 16) == 16) &&
+             memory_is_dirty(sparse, 0x40001000) &&
+             !memory_is_dirty(sparse, 0x40002000);
+    i = 0;
+    while ((i < 4) && (memory_next_dirty(sparse, &address) == 0)) {
+        words_read[i++] = address;
+        address += MEMORY_PAGE_SIZE;
+    }
+    print_test(result && (i == 4) && (words_read[0] == 0x40001000) &&
+               (words_read[1] == 0x40004000) &&
+               (words_read[2] == 0x40005000) &&
+               (words_read[3] == 0xFFFFF000));
+    printf("- cleared pages are marked again by cached writes, ");
+    address = 0;
+    memory_clear_dirty(sparse, 0x40001000, 1);
+    memory_clear_dirty(sparse, 0x40004FFC, 8);
+    result = !memory_is_dirty(sparse, 0x40001000) &&
+             !memory_is_dirty(sparse, 0x40005000) &&
+             (memory_next_dirty(sparse, &address) == 0) &&
+             (address == 0xFFFFF000);
+    memory_clear_dirty(sparse, 0, 0xFFFFFFFF);
+    memory_clear_dirty(sparse, 0xFFFFFFFF, 1);
+    address = 0;
+    print_test(result && (memory_next_dirty(sparse, &address) == -1) &&
+               (memory_write_byte(sparse, 0x40001000, 2) == 0) &&
+               memory_is_dirty(sparse, 0x40001000));
+    memory_destroy(sparse);
+
+    printf("Huge pages region at 0x80000000 :\n");
+    sparse = memory_create(0, 1);
+    if (sparse == NULL) {
+        fprintf(stderr, "Error when creating simulated memory\n");
+        exit(1);
+    }
+    memory_set_huge_pages(sparse, 1);
+    printf("- zeros until written, accesses across the region, devices "
+           "over it, ");
+    print_test((memory_map(sparse, 0x80000000, 0x400000) == 0) &&
+               (memory_read_word(sparse, 0x803FFFFC, &word_read) == 0) &&
+               (word_read == 0) &&
+               (memory_write_word(sparse, 0x80000FFE, word_value) == 0) &&
+               (memory_read_word(sparse, 0x80000FFE, &word_read) == 0) &&
+               (word_read == word_value) &&
+               (memory_write_block(sparse, 0x801FFFF8, block, 16) == 16) &&
+               (memory_read_block(sparse, 0x801FFFF8, block_read, 16) == 16) &&
+               (memcmp(block, block_read, 16) == 0) &&
+               memory_is_dirty(sparse, 0x80200000) &&
+               (memory_map_device(sparse, 0x80300000, 4, test_device_read,
+                                  test_device_write, &device) == 0) &&
+               (memory_write_word(sparse, 0x80300000, word_value) == 0) &&
+               (device.registers[0] == word_value) &&
+               (memory_read_word(sparse, 0x80400000, &word_read) == -1));
+    memory_print_statistics(sparse, stdout);
+    memory_destroy(sparse);
+
+    benchmark(is_big_endian());
+    benchmark(!is_big_endian());
+
     return 0;
 }
@@ -24,57 +24,77 @@ Contact: Guillaume.Huard@imag.fr
 #include "arm_constants.h"
 #include <stdlib.h>
 
-struct registers_data {
-};
+static void bank_registers(registers r, uint8_t mode, uint8_t first,
+                           uint32_t *bank, uint32_t *spsr) {
+    uint8_t reg;
+
+    for (reg=first; reg<15; reg++)
+        r->registers[mode][reg] = &bank[reg-first];
+    r->spsr[mode] = spsr;
+}
 
 registers registers_create() {
     registers r = NULL;
+    int mode, reg;
+
+    r = calloc(1, sizeof(struct registers_data));
+    if (r) {
+        for (mode=0; mode<32; mode++)
+            for (reg=0; reg<16; reg++)
+                r->registers[mode][reg] = &r->storage[reg];
+        bank_registers(r, FIQ, 8, &r->storage[FIQ_BANK], &r->spsr_storage[0]);
+        bank_registers(r, IRQ, 13, &r->storage[IRQ_BANK], &r->spsr_storage[1]);
+        bank_registers(r, SVC, 13, &r->storage[SVC_BANK], &r->spsr_storage[2]);
+        bank_registers(r, ABT, 13, &r->storage[ABT_BANK], &r->spsr_storage[3]);
+        bank_registers(r, UND, 13, &r->storage[UND_BANK], &r->spsr_storage[4]);
+        write_cpsr(r, 0);
+    }
     return r;
 }
 
 void registers_destroy(registers r) {
+    free(r);
 }
 
-uint8_t get_mode(registers r) {
-    return 0;
-} 
-
 int current_mode_has_spsr(registers r) {
-    return 0;
+    return r->current_spsr != NULL;
 }
 
 int in_a_privileged_mode(registers r) {
-    return 0;
+    return get_mode(r) != USR;
 }
 
-uint32_t read_register(registers r, uint8_t reg) {
-    uint32_t value=0;
-    return value;
+int is_banked_register(registers r, uint8_t mode, uint8_t reg) {
+    return r->registers[mode & 0x1F][reg] != &r->storage[reg];
 }
 
 uint32_t read_usr_register(registers r, uint8_t reg) {
-    uint32_t value=0;
-    return value;
+    return r->storage[reg];
 }
 
-uint32_t read_cpsr(registers r) {
-    uint32_t value=0;
-    return value;
+uint32_t read_mode_register(registers r, uint8_t mode, uint8_t reg) {
+    return *r->registers[mode & 0x1F][reg];
 }
 
+/* Reading the SPSR in a mode that has none is unpredictable, we return the
+ * CPSR in this case.
+ */
 uint32_t read_spsr(registers r) {
-    uint32_t value=0;
-    return value;
-}
-
-void write_register(registers r, uint8_t reg, uint32_t value) {
+    return r->current_spsr ? *r->current_spsr : r->cpsr;
 }
 
 void write_usr_register(registers r, uint8_t reg, uint32_t value) {
+    r->storage[reg] = value;
 }
 
+/* Selects the registers of the new mode */
 void write_cpsr(registers r, uint32_t value) {
+    r->cpsr = value;
+    r->current = r->registers[value & 0x1F];
+    r->current_spsr = r->spsr[value & 0x1F];
 }
 
 void write_spsr(registers r, uint32_t value) {
+    if (r->current_spsr)
+        *r->current_spsr = value;
 }
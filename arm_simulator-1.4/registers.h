@@ -26,20 +26,63 @@ Contact: Guillaume.Huard@imag.fr
 
 typedef struct registers_data *registers;
 
+/* Banked registers (ARM manual A2-4): r8-r14 are banked in FIQ mode, r13-r14
+ * in the other exception modes. USR and SYS share the same registers.
+ * All the physical registers are stored in a single array, and each mode has
+ * a table of pointers to its 16 registers in this array, so that a mode change
+ * only selects another table. Undefined mode numbers use the USR registers.
+ */
+#define FIQ_BANK 16
+#define IRQ_BANK 23
+#define SVC_BANK 25
+#define ABT_BANK 27
+#define UND_BANK 29
+#define STORAGE_SIZE 31
+
+/* The layout is public for the inline accessors below, used by the execution
+ * hot path
+ */
+struct registers_data {
+    /* Registers of the current mode */
+    uint32_t **current;
+    uint32_t *current_spsr;
+    uint32_t cpsr;
+    uint32_t storage[STORAGE_SIZE];
+    uint32_t spsr_storage[5];
+    uint32_t *registers[32][16];
+    /* NULL for modes without SPSR */
+    uint32_t *spsr[32];
+};
+
 registers registers_create();
 void registers_destroy(registers r);
 
-uint8_t get_mode(registers r);
 int current_mode_has_spsr(registers r);
 int in_a_privileged_mode(registers r);
 
-uint32_t read_register(registers r, uint8_t reg);
 uint32_t read_usr_register(registers r, uint8_t reg);
-uint32_t read_cpsr(registers r);
+/* Registers of any mode, and whether they are banked or shared with USR */
+uint32_t read_mode_register(registers r, uint8_t mode, uint8_t reg);
+int is_banked_register(registers r, uint8_t mode, uint8_t reg);
 uint32_t read_spsr(registers r);
-void write_register(registers r, uint8_t reg, uint32_t value);
 void write_usr_register(registers r, uint8_t reg, uint32_t value);
 void write_cpsr(registers r, uint32_t value);
 void write_spsr(registers r, uint32_t value);
 
+static inline uint8_t get_mode(registers r) {
+    return r->cpsr & 0x1F;
+}
+
+static inline uint32_t read_register(registers r, uint8_t reg) {
+    return *r->current[reg];
+}
+
+static inline uint32_t read_cpsr(registers r) {
+    return r->cpsr;
+}
+
+static inline void write_register(registers r, uint8_t reg, uint32_t value) {
+    *r->current[reg] = value;
+}
+
 #endif
@@ -21,9 +21,22 @@ Contact: Guillaume.Huard@imag.fr
 	 38401 Saint Martin d'Hres
 */
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include "trace.h"
+#include "trace_record.h"
 #include "arm_constants.h"
 
+/* Text format of the traces, chosen at compile time */
+#ifdef ARM_TRACE_FORMAT
+#define TRACE_FORMAT TRACE_RECORD_ARM
+#else
+#define TRACE_FORMAT TRACE_RECORD_TEXT
+#endif
+
 static FILE *output;
 /* "Randomly" chosen last address, if the first memory access is 4 bytes after
  * this address, the access will be misinterpreted as sequential. But as the
@@ -35,23 +48,111 @@ static char *location_file_stack[128];
 static int location_line_stack[128];
 static int location_stack_top = -1;
 static int trace_flags = 0;
+/* Flags of the currently produced traces, 0 when disabled */
+int trace_active_flags = 0;
+
+/* Binary traces: the execution thread, only producer, stores the records in a
+ * ring buffer drained by a writer thread, only consumer, in large writes to
+ * the trace file. Each index is only written by its owner, and published with
+ * release semantics after the records it covers, so no lock is needed. The
+ * producer waits for the writer when the ring is full, no record is lost.
+ */
+#define TRACE_RING_SIZE 65536
 
-#ifdef ARM_TRACE_FORMAT
-static char *trace_memory_seq[] = { "N", "S" };
-static char *trace_memory_cause[] = { "_", "O" };
-static char *trace_memory_type[] = { "W", "R" };
-static char *trace_register_type[] = { "W", "R" };
-#else
-static char *trace_memory_seq[] = { "", "" };
-static char *trace_memory_cause[] = { "", ", fetch" };
-static char *trace_memory_type[] = { "write", "read" };
-static char *trace_register_type[] = { "write", "read" };
-#endif
+static int binary;
+static struct trace_record *ring;
+static uint32_t ring_head;
+static uint32_t ring_tail;
+static int writer_stop;
+static pthread_t writer;
 
 void set_trace_file(FILE *f) {
     output = f;
 }
 
+static int trace_write(int fd, void *buffer, size_t size) {
+    char *position = buffer;
+    ssize_t written;
+
+    while (size > 0) {
+        written = write(fd, position, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        position += written;
+        size -= written;
+    }
+    return 0;
+}
+
+/* Writes the records available up to the end of the ring at once, sleeps a
+ * little when there is none
+ */
+static void *trace_writer(void *data) {
+    int fd = fileno(output);
+    uint32_t head, tail, count;
+    int stop;
+
+    tail = ring_tail;
+    while (1) {
+        stop = __atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (stop)
+                break;
+            usleep(1000);
+            continue;
+        }
+        count = head - tail;
+        if (count > TRACE_RING_SIZE - tail % TRACE_RING_SIZE)
+            count = TRACE_RING_SIZE - tail % TRACE_RING_SIZE;
+        if (trace_write(fd, &ring[tail % TRACE_RING_SIZE],
+                        count * sizeof(struct trace_record))) {
+            perror("Binary trace");
+            exit(1);
+        }
+        tail += count;
+        __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/* Run at exit, so that the records of the simulation are all written */
+static void trace_binary_end() {
+    __atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+}
+
+int trace_set_binary() {
+    uint32_t magic = TRACE_RECORD_MAGIC;
+
+    ring = malloc(TRACE_RING_SIZE * sizeof(struct trace_record));
+    if (ring == NULL)
+        return -1;
+    fflush(output);
+    if (trace_write(fileno(output), &magic, sizeof(magic)) ||
+        pthread_create(&writer, NULL, trace_writer, NULL)) {
+        free(ring);
+        ring = NULL;
+        return -1;
+    }
+    binary = 1;
+    atexit(trace_binary_end);
+    return 0;
+}
+
+static void trace_push(struct trace_record *record) {
+    uint32_t head = ring_head;
+
+    while (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) ==
+           TRACE_RING_SIZE)
+        sched_yield();
+    ring[head % TRACE_RING_SIZE] = *record;
+    __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+}
+
 void trace_start_location(char *file, int line) {
     if (enabled) {
         location_stack_top++;
@@ -67,73 +168,81 @@ uint8_t trace_end_location() {
     return 0;
 }
 
+/* Text traces are printed at once, with their location */
+static void trace_output(struct trace_record *record) {
+    if (binary) {
+        trace_push(record);
+        return;
+    }
 #ifndef ARM_TRACE_FORMAT
-static void trace_print_location() {
     if (enabled && (trace_flags & POSITION)) {
         if (location_stack_top >= 0) {
             fprintf(output, "%s, %d: ", location_file_stack[location_stack_top],
                     location_line_stack[location_stack_top]);
         }
     }
-}
 #endif
+    trace_record_print(record, TRACE_FORMAT, output);
+}
 
 void trace_memory(uint32_t cycle, uint8_t type, uint8_t size,
                     uint8_t cause, uint32_t address, uint32_t value) {
     if (enabled && (trace_flags & MEMORY)) {
-        uint8_t seq;
-
-        seq = (address == last_address+4) ? 1 : 0;
+        struct trace_record record;
+
+        record.cycle = cycle;
+        record.location = address;
+        record.value = value;
+        record.kind = MEMORY;
+        record.type = type;
+        record.size = size;
+        record.detail = cause;
+        if (address == last_address+4)
+            record.detail |= TRACE_RECORD_SEQUENTIAL;
         last_address = address;
-#ifdef ARM_TRACE_FORMAT
-        fprintf(output, "M%s%s%d%s__ %08X %08X\n", trace_memory_seq[seq],
-                trace_memory_type[type], size, trace_memory_cause[cause],
-                address, value);
-#else
-        trace_print_location();
-        fprintf(output,
-                "Cycle %d, Mem %s%s (%d bytes%s) addr: %08X, val: %08X\n",
-                cycle, trace_memory_seq[seq], trace_memory_type[type], size,
-                trace_memory_cause[cause], address, value);
-#endif
+        trace_output(&record);
     }
 }
 
 void trace_register(uint32_t cycle, uint8_t type, uint8_t reg,
                       uint8_t mode, uint32_t value) {
     if (enabled && (trace_flags & REGISTERS)) {
-        char mode_name[5] = "";
-        if (arm_get_mode_name(mode)) {
-            strcpy(mode_name, "_");
-            strcat(mode_name, arm_get_mode_name(mode));
-        }
-#ifdef ARM_TRACE_FORMAT
-        fprintf(output, "R%s %s%s %08X\n",
-                trace_register_type[type], arm_get_register_name(reg),
-                mode_name, value);
-#else
-        trace_print_location();
-        fprintf(output, "Cycle %d, Register %s, %s%s, val: %08X\n",
-                cycle, trace_register_type[type], arm_get_register_name(reg),
-                mode_name, value);
-#endif
+        struct trace_record record;
+
+        record.cycle = cycle;
+        record.location = reg;
+        record.value = value;
+        record.kind = REGISTERS;
+        record.type = type;
+        record.size = 0;
+        record.detail = mode;
+        trace_output(&record);
     }
 }
 
+/* The state is not recorded by binary traces */
 void trace_arm_state(arm_core p) {
-    if (enabled && (trace_flags & STATE)) {
+    if (enabled && (trace_flags & STATE) && !binary) {
         arm_print_state(p, output);
     }
 }
 
 void trace_disable() {
     enabled = 0;
+    trace_active_flags = 0;
 }
 
 void trace_enable() {
     enabled = 1;
+    trace_active_flags = trace_flags;
 }
 
 void trace_add(int flags) {
     trace_flags |= flags;
+    if (enabled)
+        trace_active_flags = trace_flags;
+}
+
+int trace_has(int flags) {
+    return enabled && (trace_flags & flags);
 }
@@ -41,6 +41,13 @@ Contact: Guillaume.Huard@imag.fr
 #define POSITION  8
 
 void set_trace_file(FILE *f);
+/* Switches the traces of memory and registers accesses to fixed size binary
+ * records (see trace_record.h), written to the trace file by a separate
+ * thread and turned back into text by trace_render. The file has to be set
+ * before. The state and positions are not traced in this mode. Returns 0 on
+ * success, -1 on failure.
+ */
+int trace_set_binary();
 void trace_start_location(char *file, int line);
 uint8_t trace_end_location();
 void trace_memory(uint32_t cycle, uint8_t type, uint8_t size,
@@ -51,5 +58,17 @@ void trace_arm_state(arm_core p);
 void trace_disable();
 void trace_enable();
 void trace_add(int flags);
+int trace_has(int flags);
+
+/* Cheap check for the execution hot path, which bypasses the traced accessors
+ * when none of the given traces are produced. Compiling with -DNO_TRACE makes
+ * it a constant, so that the traced paths are removed entirely.
+ */
+#ifdef NO_TRACE
+#define trace_is_active(flags) 0
+#else
+extern int trace_active_flags;
+#define trace_is_active(flags) (trace_active_flags & (flags))
+#endif
 
 #endif
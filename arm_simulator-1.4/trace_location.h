@@ -28,6 +28,10 @@ Contact: Guillaume.Huard@imag.fr
 #define END_LOCATION trace_end_location(__FILE__, __LINE__)
 
 #define arm_fetch(p, ins) (LOCATION, arm_fetch(p, ins)+END_LOCATION)
+#define arm_fetch_decoded(p, d) (LOCATION, \
+                                      arm_fetch_decoded(p, d)+END_LOCATION)
+#define arm_fetch_predecoded(p, d) (LOCATION, arm_fetch_predecoded(p, d), \
+                                    END_LOCATION)
 
 #define arm_read_register(p, reg) (LOCATION, \
                                         arm_read_register(p, reg)+END_LOCATION)
@@ -41,6 +45,8 @@ Contact: Guillaume.Huard@imag.fr
                   (LOCATION, arm_write_usr_register(p, reg, val), END_LOCATION)
 #define arm_write_cpsr(p, val) (LOCATION, arm_write_cpsr(p, val), END_LOCATION)
 #define arm_write_spsr(p, val) (LOCATION, arm_write_spsr(p, val), END_LOCATION)
+#define arm_write_flags(p, kind, a, b, result) \
+               (LOCATION, arm_write_flags(p, kind, a, b, result), END_LOCATION)
 
 #define arm_read_byte(p, addr, val) (LOCATION, \
                                       arm_read_byte(p, addr, val)+END_LOCATION)
@@ -54,5 +60,9 @@ Contact: Guillaume.Huard@imag.fr
                                      arm_write_half(p, addr, val)+END_LOCATION)
 #define arm_write_word(p, addr, val) (LOCATION, \
                                      arm_write_word(p, addr, val)+END_LOCATION)
+#define arm_read_words(p, addr, val, n) (LOCATION, \
+                                  arm_read_words(p, addr, val, n)+END_LOCATION)
+#define arm_write_words(p, addr, val, n) (LOCATION, \
+                                 arm_write_words(p, addr, val, n)+END_LOCATION)
 
 #endif
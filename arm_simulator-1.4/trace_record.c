@@ -0,0 +1,93 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include <string.h>
+#include "trace_record.h"
+#include "trace.h"
+#include "arm_constants.h"
+
+/* Indexed by the format, then by the field */
+static char *trace_memory_seq[][2] = { { "", "" }, { "N", "S" } };
+static char *trace_memory_cause[][2] = { { "", ", fetch" }, { "_", "O" } };
+static char *trace_memory_type[][2] = { { "write", "read" }, { "W", "R" } };
+static char *trace_register_type[][2] = { { "write", "read" },
+                                          { "W", "R" } };
+
+static void trace_record_print_memory(struct trace_record *record,
+                                      int format, FILE *out) {
+    uint8_t seq = (record->detail & TRACE_RECORD_SEQUENTIAL) ? 1 : 0;
+    uint8_t cause = record->detail & 1;
+
+    if (format == TRACE_RECORD_ARM)
+        fprintf(out, "M%s%s%d%s__ %08X %08X\n", trace_memory_seq[format][seq],
+                trace_memory_type[format][record->type], record->size,
+                trace_memory_cause[format][cause], record->location,
+                record->value);
+    else
+        fprintf(out, "Cycle %d, Mem %s%s (%d bytes%s) addr: %08X, "
+                "val: %08X\n", record->cycle, trace_memory_seq[format][seq],
+                trace_memory_type[format][record->type], record->size,
+                trace_memory_cause[format][cause], record->location,
+                record->value);
+}
+
+static void trace_record_print_register(struct trace_record *record,
+                                        int format, FILE *out) {
+    char mode_name[5] = "";
+
+    if (arm_get_mode_name(record->detail)) {
+        strcpy(mode_name, "_");
+        strcat(mode_name, arm_get_mode_name(record->detail));
+    }
+    if (format == TRACE_RECORD_ARM)
+        fprintf(out, "R%s %s%s %08X\n",
+                trace_register_type[format][record->type],
+                arm_get_register_name(record->location), mode_name,
+                record->value);
+    else
+        fprintf(out, "Cycle %d, Register %s, %s%s, val: %08X\n",
+                record->cycle, trace_register_type[format][record->type],
+                arm_get_register_name(record->location), mode_name,
+                record->value);
+}
+
+int trace_record_is_valid(struct trace_record *record) {
+    if (record->type > READ)
+        return 0;
+    switch (record->kind) {
+      case MEMORY:
+        return ((record->size == 1) || (record->size == 2) ||
+                (record->size == 4)) &&
+               (record->detail <= (TRACE_RECORD_SEQUENTIAL | OPCODE_FETCH));
+      case REGISTERS:
+        return (record->location <= SPSR) && (record->detail < 32);
+      default:
+        return 0;
+    }
+}
+
+void trace_record_print(struct trace_record *record, int format, FILE *out) {
+    if (record->kind == MEMORY)
+        trace_record_print_memory(record, format, out);
+    else
+        trace_record_print_register(record, format, out);
+}
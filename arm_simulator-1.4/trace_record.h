@@ -0,0 +1,64 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#ifndef __TRACE_RECORD_H__
+#define __TRACE_RECORD_H__
+#include <stdio.h>
+#include <stdint.h>
+
+/* Fixed size record of a traced event, as stored by the binary traces, in the
+ * byte order of the host. kind is MEMORY or REGISTERS and type READ or WRITE
+ * (see trace.h). For a memory access, location is its address, size its
+ * number of bytes and detail its cause, plus TRACE_RECORD_SEQUENTIAL when it
+ * follows the previous access. For a register, location is its number and
+ * detail the mode whose register is accessed.
+ */
+struct trace_record {
+    uint32_t cycle;
+    uint32_t location;
+    uint32_t value;
+    uint8_t kind;
+    uint8_t type;
+    uint8_t size;
+    uint8_t detail;
+};
+
+#define TRACE_RECORD_SEQUENTIAL 2
+
+/* Binary trace files start with this word, which also tells that they have
+ * been written by a host of the same byte order
+ */
+#define TRACE_RECORD_MAGIC 0x41524D54
+
+/* Tells if the fields of the record are in range, so that it can be printed */
+int trace_record_is_valid(struct trace_record *record);
+
+/* Text formats of the records, the human readable one or the compact one of
+ * the ARM traces
+ */
+#define TRACE_RECORD_TEXT 0
+#define TRACE_RECORD_ARM  1
+
+/* Prints the record in the given text format */
+void trace_record_print(struct trace_record *record, int format, FILE *out);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+Armator - simulateur de jeu d'instruction ARMv5T  but pdagogique
+Copyright (C) 2011 Guillaume Huard
+Ce programme est libre, vous pouvez le redistribuer et/ou le modifier selon les
+termes de la Licence Publique Gnrale GNU publie par la Free Software
+Foundation (version 2 ou bien toute autre version ultrieure choisie par vous).
+
+Ce programme est distribu car potentiellement utile, mais SANS AUCUNE
+GARANTIE, ni explicite ni implicite, y compris les garanties de
+commercialisation ou d'adaptation dans un but spcifique. Reportez-vous  la
+Licence Publique Gnrale GNU pour plus de dtails.
+
+Vous devez avoir reu une copie de la Licence Publique Gnrale GNU en mme
+temps que ce programme ; si ce n'est pas le cas, crivez  la Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+tats-Unis.
+
+Contact: Guillaume.Huard@imag.fr
+	 Btiment IMAG
+	 700 avenue centrale, domaine universitaire
+	 38401 Saint Martin d'Hres
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include "trace_record.h"
+
+/* Reads the records in batches, as they have been written */
+#define RECORDS 4096
+
+void usage(char *name) {
+    fprintf(stderr, "Usage:\n"
+        "%s [ --help ] [ --arm-format ] [ binary_trace_file ]\n\n"
+        "Prints the binary trace written by arm_simulator --binary-trace "
+        "(read from the standard input when no file is given) as text. "
+        "Options have the following behavior:\n"
+        "- arm format: prints the compact format of the ARM traces instead "
+        "of the human readable one\n"
+        , name);
+}
+
+int main(int argc, char *argv[]) {
+    static struct trace_record records[RECORDS];
+    FILE *input;
+    uint32_t magic;
+    size_t count, i;
+    int opt, format;
+
+    struct option longopts[] = {
+        { "arm-format", no_argument, NULL, 'a' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    format = TRACE_RECORD_TEXT;
+    while ((opt = getopt_long(argc, argv, "ah", longopts, NULL)) != -1) {
+        switch(opt) {
+          case 'a':
+            format = TRACE_RECORD_ARM;
+            break;
+          case 'h':
+            usage(argv[0]);
+            exit(0);
+          default:
+            fprintf(stderr, "Unrecognized option %c\n", opt);
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind > 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+    input = stdin;
+    if (argc - optind == 1) {
+        input = fopen(argv[optind], "r");
+        if (input == NULL) {
+            perror(argv[optind]);
+            exit(1);
+        }
+    }
+    if ((fread(&magic, sizeof(magic), 1, input) != 1) ||
+        (magic != TRACE_RECORD_MAGIC)) {
+        fprintf(stderr, "Not a binary trace, or written by a host of "
+                        "another byte order\n");
+        exit(1);
+    }
+    while ((count = fread(records, sizeof(struct trace_record), RECORDS,
+                          input)) > 0)
+        for (i=0; i<count; i++) {
+            if (!trace_record_is_valid(&records[i])) {
+                fprintf(stderr, "Invalid record\n");
+                exit(1);
+            }
+            trace_record_print(&records[i], format, stdout);
+        }
+    if (ferror(input)) {
+        perror("Binary trace");
+        exit(1);
+    }
+    return 0;
+}
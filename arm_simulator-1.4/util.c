@@ -22,12 +22,22 @@ Contact: Guillaume.Huard@imag.fr
 */
 #include "util.h"
 
-/* We implement asr because shifting a signed is non portable in ANSI C */
+/* We implement asr because shifting a signed is non portable in ANSI C. Shifts
+ * by 32 or more are undefined in C, hence the special cases.
+ */
 uint32_t asr(uint32_t value, uint8_t shift) {
-    return (value >> shift) | (get_bit(value, 31) ? ~0<<(32-shift) : 0);
+    if (shift == 0)
+        return value;
+    if (shift >= 32)
+        return get_bit(value, 31) ? 0xFFFFFFFF : 0;
+    return (value >> shift) | (get_bit(value, 31) ? ~0U<<(32-shift) : 0);
 }
 
+/* Rotations are modulo 32 */
 uint32_t ror(uint32_t value, uint8_t rotation) {
+    rotation &= 31;
+    if (rotation == 0)
+        return value;
     return (value >> rotation) | (value << (32-rotation));
 }
 